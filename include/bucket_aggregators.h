@@ -0,0 +1,370 @@
+#ifndef AAQIM_BUCKET_AGGREGATORS_H
+#define AAQIM_BUCKET_AGGREGATORS_H
+
+#include <math.h>
+
+#include "air_sample.h"
+#include "rollup_data.h"
+#include "sample_encoding.h"
+#include "stats.h"
+
+/** What a bucket aggregator gets from each stored record: a single sample, or
+ * an aggregate of `count` samples (like RollupData).
+ */
+struct BucketInput {
+  uint32_t seconds; /** timestamp of the record */
+  float sum;        /** sum of the values of the samples of the record */
+  float min;
+  float max;
+  uint32_t count; /** number of samples represented by the record */
+};
+
+/** Integer version of BucketInput, for the concentrations codes (1/128 ug/m3
+ * units, see cf_to_short): the bucket can be averaged without float (which
+ * are emulated on the ESP8266).
+ */
+struct CodeBucketInput {
+  uint32_t seconds;
+  uint32_t sum;
+  uint16_t min;
+  uint16_t max;
+  uint32_t count;
+};
+
+inline void single_bucket_input(uint32_t seconds, float value,
+                                BucketInput &input) {
+  input.seconds = seconds;
+  input.sum = value;
+  input.min = value;
+  input.max = value;
+  input.count = 1;
+}
+
+/**
+ * Field extractors: select the value of the records used by a DisplaySamples
+ * (static `void Extract(const RECORD &, uint32_t seconds, Input &)`, with
+ * Input being BucketInput, or CodeBucketInput for the integer aggregators).
+ * Only the pm2.5 concentration is available from the RollupData records.
+ */
+struct Pm_2_5Field {
+  typedef BucketInput Input;
+
+  static void Extract(const AirSampleData &data, uint32_t seconds,
+                      BucketInput &input) {
+    single_bucket_input(seconds, AirSampleView(data).Pm_2_5(), input);
+  }
+
+  static void Extract(const RollupData &data, uint32_t seconds,
+                      BucketInput &input) {
+    input.seconds = seconds;
+    input.sum = (float)data.pm_2_5_sum / 128.0f;
+    input.min = short_to_cf(data.pm_2_5_min);
+    input.max = short_to_cf(data.pm_2_5_max);
+    input.count = data.count;
+  }
+};
+
+struct Pm_1_0Field {
+  typedef BucketInput Input;
+
+  static void Extract(const AirSampleData &data, uint32_t seconds,
+                      BucketInput &input) {
+    single_bucket_input(seconds, AirSampleView(data).Pm_1_0(), input);
+  }
+};
+
+struct Pm_10_0Field {
+  typedef BucketInput Input;
+
+  static void Extract(const AirSampleData &data, uint32_t seconds,
+                      BucketInput &input) {
+    single_bucket_input(seconds, AirSampleView(data).Pm_10_0(), input);
+  }
+};
+
+struct TemperatureFField {
+  typedef BucketInput Input;
+
+  static void Extract(const AirSampleData &data, uint32_t seconds,
+                      BucketInput &input) {
+    single_bucket_input(seconds, (float)AirSampleView(data).TemperatureF(),
+                        input);
+  }
+};
+
+struct HumidityField {
+  typedef BucketInput Input;
+
+  static void Extract(const AirSampleData &data, uint32_t seconds,
+                      BucketInput &input) {
+    single_bucket_input(seconds, (float)AirSampleView(data).HumidityPercent(),
+                        input);
+  }
+};
+
+/** pm2.5 concentration codes, to be used with CodeMeanAggregator */
+struct Pm_2_5CodeField {
+  typedef CodeBucketInput Input;
+
+  static void Extract(const AirSampleData &data, uint32_t seconds,
+                      CodeBucketInput &input) {
+    input.seconds = seconds;
+    input.sum = data.pm_2_5_short;
+    input.min = data.pm_2_5_short;
+    input.max = data.pm_2_5_short;
+    input.count = 1;
+  }
+
+  static void Extract(const RollupData &data, uint32_t seconds,
+                      CodeBucketInput &input) {
+    input.seconds = seconds;
+    input.sum = data.pm_2_5_sum;
+    input.min = data.pm_2_5_min;
+    input.max = data.pm_2_5_max;
+    input.count = data.count;
+  }
+};
+
+/**
+ * Bucket aggregators: reduce the records of a bucket to a single value.
+ *
+ * They provide Reset(), Add(const BucketInput &), IsEmpty() and Value(), and
+ * have to be plain data (the state of the open bucket is persisted by
+ * DisplaySamples::Update). The records may be added in any time order.
+ */
+class MeanAggregator {
+ public:
+  void Reset() {
+    sum_ = 0.0f;
+    count_ = 0;
+  }
+  void Add(const BucketInput &input) {
+    sum_ += input.sum;
+    count_ += input.count;
+  }
+  bool IsEmpty() const { return count_ == 0; }
+  float Value() const { return sum_ / (float)(count_); }
+
+ protected:
+  float sum_;
+  uint32_t count_;
+};
+
+class MaxAggregator {
+ public:
+  void Reset() { empty_ = true; }
+  void Add(const BucketInput &input) {
+    if (empty_ || input.max > max_) {
+      max_ = input.max;
+    }
+    empty_ = false;
+  }
+  bool IsEmpty() const { return empty_; }
+  float Value() const { return max_; }
+
+ protected:
+  float max_;
+  bool empty_;
+};
+
+class MinAggregator {
+ public:
+  void Reset() { empty_ = true; }
+  void Add(const BucketInput &input) {
+    if (empty_ || input.min < min_) {
+      min_ = input.min;
+    }
+    empty_ = false;
+  }
+  bool IsEmpty() const { return empty_; }
+  float Value() const { return min_; }
+
+ protected:
+  float min_;
+  bool empty_;
+};
+
+/** Most recent value of the bucket (mean of the record for aggregates) */
+class LastAggregator {
+ public:
+  void Reset() { empty_ = true; }
+  void Add(const BucketInput &input) {
+    if (empty_ || input.seconds >= seconds_) {
+      seconds_ = input.seconds;
+      value_ = input.sum / (float)(input.count);
+    }
+    empty_ = false;
+  }
+  bool IsEmpty() const { return empty_; }
+  float Value() const { return value_; }
+
+ protected:
+  uint32_t seconds_;
+  float value_;
+  bool empty_;
+};
+
+/**
+ * Streaming estimation of a percentile with the P-square algorithm (Jain and
+ * Chlamtac, 1985): five markers are adjusted at each new value, so the memory
+ * is constant whatever the number of samples in the bucket. The percentile is
+ * exact (nearest rank) up to 5 samples.
+ *
+ * Aggregated records (RollupData) are only taken into account by their mean.
+ * @param PERCENT percentile to estimate (1 to 99)
+ */
+template <int PERCENT>
+class PercentileAggregator {
+ public:
+  void Reset() { n_ = 0; }
+
+  void Add(const BucketInput &input) {
+    const float x = input.sum / (float)(input.count);
+    if (n_ < kMarkers) {
+      heights_[n_++] = x;
+      if (n_ == kMarkers) {
+        Sort(heights_, kMarkers);
+        for (int i = 0; i < kMarkers; i++) {
+          positions_[i] = i + 1;
+          desired_[i] = 1.0f + 4.0f * Increment(i);
+        }
+      }
+      return;
+    }
+
+    // cell of the new value, extending the extreme markers if needed
+    int k;
+    if (x < heights_[0]) {
+      heights_[0] = x;
+      k = 0;
+    } else if (x >= heights_[kMarkers - 1]) {
+      heights_[kMarkers - 1] = x;
+      k = kMarkers - 2;
+    } else {
+      k = 0;
+      while (x >= heights_[k + 1]) {
+        k++;
+      }
+    }
+    for (int i = k + 1; i < kMarkers; i++) {
+      positions_[i]++;
+    }
+    for (int i = 0; i < kMarkers; i++) {
+      desired_[i] += Increment(i);
+    }
+    n_++;
+
+    // move the middle markers toward their desired position
+    for (int i = 1; i < kMarkers - 1; i++) {
+      float d = desired_[i] - (float)(positions_[i]);
+      if ((d >= 1.0f && positions_[i + 1] - positions_[i] > 1) ||
+          (d <= -1.0f && positions_[i - 1] - positions_[i] < -1)) {
+        int s = (d > 0.0f) ? 1 : -1;
+        float h = Parabolic(i, s);
+        if (heights_[i - 1] < h && h < heights_[i + 1]) {
+          heights_[i] = h;
+        } else {
+          heights_[i] += s * (heights_[i + s] - heights_[i]) /
+                         (float)(positions_[i + s] - positions_[i]);
+        }
+        positions_[i] += s;
+      }
+    }
+  }
+
+  bool IsEmpty() const { return n_ == 0; }
+
+  float Value() const {
+    if (n_ >= kMarkers) {
+      return heights_[2];
+    }
+    float sorted[kMarkers];
+    for (uint32_t i = 0; i < n_; i++) {
+      sorted[i] = heights_[i];
+    }
+    Sort(sorted, n_);
+    uint32_t rank = (PERCENT * n_ + 99) / 100;
+    return sorted[(rank > 0 ? rank : 1) - 1];
+  }
+
+ protected:
+  static const int kMarkers = 5;
+
+  static float Increment(int marker) {
+    const float p = (float)(PERCENT) / 100.0f;
+    const float increments[kMarkers] = {0.0f, p / 2.0f, p, (1.0f + p) / 2.0f,
+                                        1.0f};
+    return increments[marker];
+  }
+
+  static void Sort(float *values, uint32_t n) {
+    for (uint32_t i = 1; i < n; i++) {
+      float v = values[i];
+      uint32_t j = i;
+      while (j > 0 && values[j - 1] > v) {
+        values[j] = values[j - 1];
+        j--;
+      }
+      values[j] = v;
+    }
+  }
+
+  float Parabolic(int i, int s) const {
+    const float q = heights_[i];
+    const float n = (float)(positions_[i]);
+    const float nPrevious = (float)(positions_[i - 1]);
+    const float nNext = (float)(positions_[i + 1]);
+    return q + (float)(s) / (nNext - nPrevious) *
+                   ((n - nPrevious + s) * (heights_[i + 1] - q) /
+                        (nNext - n) +
+                    (nNext - n - s) * (q - heights_[i - 1]) /
+                        (n - nPrevious));
+  }
+
+  uint32_t n_;
+  float heights_[kMarkers];
+  int32_t positions_[kMarkers];
+  float desired_[kMarkers];
+};
+
+typedef PercentileAggregator<90> P90Aggregator;
+
+/** Spread of the bucket: standard deviation of the samples (the spread within
+ * aggregated records is unknown, only their mean is taken into account).
+ */
+class StdDevAggregator {
+ public:
+  void Reset() { stats_.Reset(); }
+  void Add(const BucketInput &input) {
+    stats_.AddAggregate(input.count, input.sum / (float)(input.count),
+                        input.min, input.max);
+  }
+  bool IsEmpty() const { return stats_.IsEmpty(); }
+  float Value() const { return stats_.StdDev(); }
+
+ protected:
+  StatsAccumulator<float> stats_;
+};
+
+/** Integer mean of the concentration codes (see Pm_2_5CodeField): the value
+ * is the rounded mean code, to map with pm25_short_to_aqi_value.
+ */
+class CodeMeanAggregator {
+ public:
+  void Reset() {
+    sum_ = 0;
+    count_ = 0;
+  }
+  void Add(const CodeBucketInput &input) {
+    sum_ += input.sum;
+    count_ += input.count;
+  }
+  bool IsEmpty() const { return count_ == 0; }
+  uint16_t Value() const { return (uint16_t)((sum_ + count_ / 2) / count_); }
+
+ protected:
+  uint32_t sum_;
+  uint32_t count_;
+};
+
+#endif
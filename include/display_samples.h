@@ -2,21 +2,54 @@
 #define AAQIM_DISPLAY_SAMPLES_H
 
 #include <limits>
+#include <string.h>
 
 #include "aaqim_debug.h"
-#include "air_sample.h"
+#include "abstract_store.h"
+#include "bucket_aggregators.h"
+#include "crc8_functions.h"
 #include "flash_samples.h"
+#include "samples_cursor.h"
+
+const uint16_t kDisplayStateMagic = 0xD15A;
+const uint8_t kDisplayStateVersion = 3;
+
+/** State of an incremental DisplaySamples (see Update), persisted between two
+ * wake ups. It is followed by the aggregator of the most recent bucket, and
+ * by the buffer of the bucket values.
+ */
+struct DisplayState {
+  uint16_t magic;
+  uint8_t version;
+  uint8_t crc; /** crc8 of the state and buffer, computed with crc = 0 */
+  uint16_t length;
+  uint16_t dataSize;
+  uint32_t period;
+  uint32_t windowEnd;   /** End of the most recent bucket */
+  uint32_t lastSeconds; /** Timestamp of the last sample folded in, or start
+                            of the window if none since the rebuild */
+  uint16_t aggregatorSize;
+  uint8_t folded;       /** Was a sample folded in since the rebuild? */
+  uint8_t reserved;
+};
 
 /**
  * Create a linear buffer which is a "view" of sample stored on flash.
  *
- * Each element of the buffer is a bucket containing the average of
- * all the flash samples withing a timeslice defined by a *period*.
+ * Each element of the buffer is a bucket containing the average (or another
+ * aggregate, see AGGREGATOR) of all the flash samples withing a timeslice
+ * defined by a *period*.
  *
  * @param BUFFER_LENGTH defines the length of the buffer
  * @param DATA_TYPE defines the type of data stored in the buffer
+ * @param AGGREGATOR reduces the samples of a bucket to a single value (see
+ *                   MeanAggregator, MaxAggregator, P90Aggregator...)
+ * @param FIELD selects the value of the samples to aggregate (see
+ *              Pm_2_5Field, TemperatureFField...). Pm_2_5CodeField with
+ *              CodeMeanAggregator averages the pm2.5 in integers.
  */
-template <size_t BUFFER_LENGTH, typename DATA_TYPE>
+template <size_t BUFFER_LENGTH, typename DATA_TYPE,
+          typename AGGREGATOR = MeanAggregator, typename FIELD = Pm_2_5Field>
 class DisplaySamples {
  public:
   /**
@@ -24,20 +57,32 @@ class DisplaySamples {
    * @param periodInSeconds
    */
   DisplaySamples(uint32_t periodInSeconds)
-      : length_(BUFFER_LENGTH), period_(periodInSeconds) {}
+      : length_(BUFFER_LENGTH),
+        period_(periodInSeconds),
+        windowEnd_(0),
+        lastSeconds_(0),
+        folded_(false),
+        rebuilt_(false),
+        now_(0),
+        bucket_(0),
+        count_(0) {
+    open_.Reset();
+    aggregator_.Reset();
+  }
 
   /**
    * Fills the buffer from samples stored on flash.
    *
-   * @param MAPPING_FUNC Function to map the average for each time slice to
+   * @param MAPPING_FUNC Function to map the aggregate of each time slice to
    *                     the bucket value. For example, for the air samples
    *                     we compute the average on the pm25 concentration
    *                     (linear scale), but desire to fill the buffer with
-   *                     the AQI index (using pm25_to_aqi_value).
+   *                     the AQI index (using pm25_to_aqi_value, or
+   *                     pm25_short_to_aqi_value with CodeMeanAggregator).
    *
-   * @param src accessor to the AirData samples stored on flash
-   *            (should become a template if we ever need retrieving other
-   * types)
+   * @param src accessor to the AirSampleData samples (or the RollupData
+   * records of a RollupArchive tier) stored on flash. The source needs to
+   * provide the sample timestamps (see AirSampleTime and RollupTime).
    * @param now Timestamp in seconds defining the most recent element in the
    * time time serie to retrieve. This value does not have to match an exact
    *            sample timestamp, and it can be either in the past of the future
@@ -49,17 +94,67 @@ class DisplaySamples {
   template <typename SAMPLES_SRC, typename MAPPING_FUNC>
   size_t Fill(SAMPLES_SRC &src, uint32_t now, MAPPING_FUNC mapf);
 
+  /** Streaming version of Fill, to feed several buffers from a single pass
+   * over the samples (see FillAll).
+   *
+   * Start(now), then Add() the samples from the most recent to the oldest
+   * while it returns true (false once the sample is older than the buffer
+   * window), and Finish() to get the number of buckets with data.
+   * @param data stored record (AirSampleData, or RollupData if FIELD can
+   *             extract its value)
+   * @param seconds timestamp of the record
+   */
+  void Start(uint32_t now);
+
+  template <typename RECORD, typename MAPPING_FUNC>
+  bool Add(const RECORD &data, uint32_t seconds, MAPPING_FUNC mapf);
+
+  template <typename MAPPING_FUNC>
+  size_t Finish(MAPPING_FUNC mapf);
+
+  /**
+   * Incremental version of Fill, for a device waking up regularly.
+   *
+   * The buckets are aligned on multiples of the period (the most recent one
+   * ends at the first multiple following now, and is still open), so the
+   * window only has to be shifted when time goes by. The bucket values and
+   * the aggregator of the open bucket are saved in the store, and at the
+   * next call only the samples stored since the last one are read from
+   * flash.
+   *
+   * The buffer is fully rebuilt from flash when the saved state is missing
+   * or does not match the samples source (different period, samples erased,
+   * time going backward...).
+   *
+   * @param store persistent memory holding the state (see RtcStore), it
+   *              needs sizeof(DisplayState) + sizeof(AGGREGATOR) +
+   *              BUFFER_LENGTH * sizeof(DATA_TYPE) bytes
+   * @param storeOffset position of the state in the store
+   * @return number of buckets with data
+   */
+  template <typename SAMPLES_SRC, typename MAPPING_FUNC>
+  size_t Update(SAMPLES_SRC &src, uint32_t now, MAPPING_FUNC mapf,
+                AbstractStore &store, uint32_t storeOffset = 0);
+
+  /** Was the buffer fully rebuilt by the last call to Update? */
+  bool WasRebuilt() const { return rebuilt_; }
+
+  /** Size of the state saved by Update in the store */
+  static constexpr size_t StateSize() { return kStateWords * 4; }
+
   /** Return the sample at the requested position in the buffer.
    * @param position of the sample requested
    *          - 0 = first element of the buffer = older sample of the serie
    *          - Length()-1 = last element of the buffer = most recent sample
    * @return AQI for the sample at this position
-   *          - If index is out of range, return INT16_MAX
-   *          - If no sample in the bucket, return INT16_MIN
+   *          - If index is out of range, return the max of DATA_TYPE
+   *            (INT16_MAX for int16_t)
+   *          - If no sample in the bucket, return the min of DATA_TYPE
+   *            (INT16_MIN for int16_t)
    */
-  int16_t Value(size_t position) {
+  DATA_TYPE Value(size_t position) const {
     if (position >= length_) {
-      return INT16_MAX;
+      return std::numeric_limits<DATA_TYPE>::max();
     } else {
       return buffer_[position];
     }
@@ -67,9 +162,9 @@ class DisplaySamples {
 
   size_t Length() const { return length_; }
 
-  int16_t SerieMin() const { return min_; }
+  DATA_TYPE SerieMin() const { return min_; }
 
-  int16_t SerieMax() const { return max_; }
+  DATA_TYPE SerieMax() const { return max_; }
 
  protected:
   size_t length_;
@@ -77,6 +172,33 @@ class DisplaySamples {
   DATA_TYPE min_;
   DATA_TYPE max_;
   DATA_TYPE buffer_[BUFFER_LENGTH];
+  // incremental mode only (see Update)
+  uint32_t windowEnd_;
+  uint32_t lastSeconds_;
+  bool folded_;
+  AGGREGATOR open_;
+  bool rebuilt_;
+  // streaming fill (see Start/Add/Finish)
+  uint32_t now_;
+  size_t bucket_;
+  AGGREGATOR aggregator_;
+  size_t count_;
+
+  template <typename MAPPING_FUNC>
+  void Flush(MAPPING_FUNC mapf);
+
+  static const size_t kStateWords =
+      (sizeof(DisplayState) + sizeof(AGGREGATOR) +
+       BUFFER_LENGTH * sizeof(DATA_TYPE) + 3) /
+      4;
+
+  bool LoadState(AbstractStore &store, uint32_t offset);
+
+  bool SaveState(AbstractStore &store, uint32_t offset);
+
+  /** Shift the window so its most recent bucket ends at windowEnd */
+  template <typename MAPPING_FUNC>
+  void AdvanceTo(uint32_t windowEnd, MAPPING_FUNC mapf);
 
   void UpdateLimits(DATA_TYPE v) {
     if (v < min_) {
@@ -88,11 +210,37 @@ class DisplaySamples {
   }
 };
 
-template <size_t BUFFER_LENGTH, typename DATA_TYPE>
+template <size_t BUFFER_LENGTH, typename DATA_TYPE, typename AGGREGATOR,
+          typename FIELD>
 template <typename SAMPLES_SRC, typename MAPPING_FUNC>
-size_t DisplaySamples<BUFFER_LENGTH, DATA_TYPE>::Fill(SAMPLES_SRC &src,
-                                                      uint32_t now,
-                                                      MAPPING_FUNC mapf) {
+size_t DisplaySamples<BUFFER_LENGTH, DATA_TYPE, AGGREGATOR, FIELD>::Fill(
+    SAMPLES_SRC &src, uint32_t now, MAPPING_FUNC mapf) {
+  Start(now);
+  if (!src.IsScanned() || src.IsEmpty()) {
+    return Finish(mapf);
+  }
+  // Skip directly the samples more recent than now
+  size_t samplesIndex = src.FindRecentIndexAtOrBefore(now);
+  if (samplesIndex != SIZE_MAX) {
+    // Samples are read by pages while moving back in time
+    SamplesCursor<SAMPLES_SRC> cursor(src, samplesIndex);
+    typename SAMPLES_SRC::SampleType data;
+    while (cursor.Next(data)) {
+      // The AQI is a non-linear scale. So to perform a correct average
+      // we use the initial concentration. This forces to reconvert
+      // the final results to AQI.
+      if (!Add(data, SAMPLES_SRC::TimeAccessor::Seconds(data), mapf)) {
+        break;
+      }
+    }
+  }
+  return Finish(mapf);
+}
+
+template <size_t BUFFER_LENGTH, typename DATA_TYPE, typename AGGREGATOR,
+          typename FIELD>
+void DisplaySamples<BUFFER_LENGTH, DATA_TYPE, AGGREGATOR, FIELD>::Start(
+    uint32_t now) {
   // Initialize min/max (cannot use INT16_MIN because it is already used
   // to mark "no data"
   min_ = std::numeric_limits<DATA_TYPE>::max() - 1;
@@ -103,96 +251,284 @@ size_t DisplaySamples<BUFFER_LENGTH, DATA_TYPE>::Fill(SAMPLES_SRC &src,
   for (size_t i = 0; i < length_; i++) {
     buffer_[i] = std::numeric_limits<DATA_TYPE>::min();
   }
+  now_ = now;
+  bucket_ = 0;
+  aggregator_.Reset();
+  count_ = 0;
+  dbg_printf("==== now = %d\n", now);
+}
 
-  uint32_t count = 0;
-  if (!src.IsScanned() || src.IsEmpty()) {
-    return count;
+template <size_t BUFFER_LENGTH, typename DATA_TYPE, typename AGGREGATOR,
+          typename FIELD>
+template <typename RECORD, typename MAPPING_FUNC>
+bool DisplaySamples<BUFFER_LENGTH, DATA_TYPE, AGGREGATOR, FIELD>::Add(
+    const RECORD &data, uint32_t seconds, MAPPING_FUNC mapf) {
+  if (seconds > now_) {
+    dbg_printf("-- skip sample more recent than now (ts=%d)\n", seconds);
+    return true;
   }
+  // bucket r holds the samples in ]now - (r+1) * period, now - r * period]
+  size_t bucket = (now_ - seconds) / period_;
+  if (bucket >= length_) {
+    return false;
+  }
+  if (bucket < bucket_) {
+    // the buffer already moved to older buckets
+    dbg_printf("-- skip unordered sample (ts=%d)\n", seconds);
+    return true;
+  }
+  if (bucket > bucket_) {
+    Flush(mapf);
+    bucket_ = bucket;
+  }
+  typename FIELD::Input input;
+  FIELD::Extract(data, seconds, input);
+  aggregator_.Add(input);
+  dbg_printf("-- accumulate sample (age = %d)\n", now_ - seconds);
+  return true;
+}
 
-  const size_t numberOfAvailableSamples =
-      src.NumberOfSamples();  // this method is not efficient, so cache the
-                              // value
-  size_t samplesIndex = 0;
-  size_t previousSampleIndex = UINT32_MAX;
-  size_t bufferReversedIndex = 0;
-  size_t bucketCount = 0;
-  float samplePm_2_5 = 0.0f;
-  float accumulator = 0.0f;
+template <size_t BUFFER_LENGTH, typename DATA_TYPE, typename AGGREGATOR,
+          typename FIELD>
+template <typename MAPPING_FUNC>
+size_t DisplaySamples<BUFFER_LENGTH, DATA_TYPE, AGGREGATOR, FIELD>::Finish(
+    MAPPING_FUNC mapf) {
+  // flush last accumulated samples
+  Flush(mapf);
+  return count_;
+}
 
-  dbg_printf("==== now = %d\n", now);
-  AirSampleData data;
-  AirSample sample;
-  while (bufferReversedIndex < length_ &&
-         samplesIndex < numberOfAvailableSamples) {
-    if (previousSampleIndex != samplesIndex) {
-      src.ReadSample(samplesIndex, data);
-      sample.FromData(data);
-      previousSampleIndex = samplesIndex;
-      // The AQI is a non-linear scale. So to perform a correct average
-      // we use the initial concentration. This forces to reconvert
-      // the final results to AQI.
-      samplePm_2_5 = sample.Pm_2_5();
-      dbg_printf("Read sample # %d : pm_2_5 = %.1f\n", samplesIndex,
-                 samplePm_2_5);
-    }
-    uint32_t sampleTimestamp = sample.Seconds();
-    uint32_t bufferMaxTimestamp = now - bufferReversedIndex * period_;
-    uint32_t bufferMinTimestamp = bufferMaxTimestamp - period_;
-
-    dbg_printf("samplesIndex = %d / bufferReversedIndex = %d\n", samplesIndex,
-               bufferReversedIndex);
-    dbg_printf("sample age = %d (ts=%d)\n", now - sampleTimestamp,
-               sampleTimestamp);
-    dbg_printf("buffer min/max ts =  [%d, %d] | age = [%d, %d]\n",
-               bufferMinTimestamp, bufferMaxTimestamp, now - bufferMaxTimestamp,
-               now - bufferMinTimestamp);
-
-    if (bufferMinTimestamp < sampleTimestamp &&
-        sampleTimestamp <= bufferMaxTimestamp) {
-      accumulator += samplePm_2_5;
-      dbg_printf("-- accumulate with %.1f (sample age = %d) : sum = %.1f\n",
-                 samplePm_2_5, now - sampleTimestamp, accumulator);
-      bucketCount++;
-      samplesIndex++;
-    } else {
-      if (sampleTimestamp <= bufferMinTimestamp) {
-        // move to previous buffer slot
-        if (bucketCount > 0) {
-          auto value = mapf(accumulator / (float)(bucketCount));
-          buffer_[length_ - bufferReversedIndex - 1] = value;
-          UpdateLimits(value);
-          count++;
-          accumulator = 0;
-          bucketCount = 0;
-        } else {
-          // No samples belong to this time slice
-          dbg_printf(
-              "-- no data for this bucket, just move on (already initialized "
-              "N/A): # %d\n",
-              bufferReversedIndex);
+template <size_t BUFFER_LENGTH, typename DATA_TYPE, typename AGGREGATOR,
+          typename FIELD>
+template <typename MAPPING_FUNC>
+void DisplaySamples<BUFFER_LENGTH, DATA_TYPE, AGGREGATOR, FIELD>::Flush(
+    MAPPING_FUNC mapf) {
+  if (!aggregator_.IsEmpty()) {
+    auto value = mapf(aggregator_.Value());
+    buffer_[length_ - bucket_ - 1] = value;
+    UpdateLimits(value);
+    count_++;
+    aggregator_.Reset();
+  }
+}
+
+// Helpers of FillAll, applying a step to each display of the pack
+
+inline void StartAll(uint32_t) {}
+
+template <typename DISPLAY, typename... DISPLAYS>
+void StartAll(uint32_t now, DISPLAY &display, DISPLAYS &... others) {
+  display.Start(now);
+  StartAll(now, others...);
+}
+
+template <typename RECORD, typename MAPPING_FUNC>
+bool AddAll(const RECORD &, uint32_t, MAPPING_FUNC) {
+  return false;
+}
+
+template <typename RECORD, typename MAPPING_FUNC, typename DISPLAY,
+          typename... DISPLAYS>
+bool AddAll(const RECORD &data, uint32_t seconds, MAPPING_FUNC mapf,
+            DISPLAY &display, DISPLAYS &... others) {
+  bool more = display.Add(data, seconds, mapf);
+  return AddAll(data, seconds, mapf, others...) || more;
+}
+
+template <typename MAPPING_FUNC>
+void FinishAll(MAPPING_FUNC) {}
+
+template <typename MAPPING_FUNC, typename DISPLAY, typename... DISPLAYS>
+void FinishAll(MAPPING_FUNC mapf, DISPLAY &display, DISPLAYS &... others) {
+  display.Finish(mapf);
+  FinishAll(mapf, others...);
+}
+
+/** Fill several DisplaySamples (typically with different periods) from a
+ * single backward pass over the samples: each sample is read and decoded
+ * once, whatever the number of buffers it belongs to. The displays can use
+ * different aggregators and fields.
+ *
+ * Equivalent to calling Fill(src, now, mapf) on each of the displays.
+ * @return number of samples read
+ */
+template <typename SAMPLES_SRC, typename MAPPING_FUNC, typename... DISPLAYS>
+size_t FillAll(SAMPLES_SRC &src, uint32_t now, MAPPING_FUNC mapf,
+               DISPLAYS &... displays) {
+  StartAll(now, displays...);
+  size_t read = 0;
+  if (src.IsScanned() && !src.IsEmpty()) {
+    size_t samplesIndex = src.FindRecentIndexAtOrBefore(now);
+    if (samplesIndex != SIZE_MAX) {
+      SamplesCursor<SAMPLES_SRC> cursor(src, samplesIndex);
+      typename SAMPLES_SRC::SampleType data;
+      while (cursor.Next(data)) {
+        read++;
+        // stop when the sample is older than all the windows
+        if (!AddAll(data, SAMPLES_SRC::TimeAccessor::Seconds(data), mapf,
+                    displays...)) {
+          break;
         }
-        bufferReversedIndex++;
-      }
-      if (sampleTimestamp > bufferMaxTimestamp) {
-        // skip sample
-        dbg_printf("-- skip sample with flash index = %d\n", samplesIndex);
-        samplesIndex++;
       }
     }
   }
-  // flush last accumulated samples
-  if (bucketCount > 0) {
-    auto value = mapf(accumulator / (float)(bucketCount));
-    buffer_[length_ - bufferReversedIndex - 1] = value;
-    UpdateLimits(value);
-    bufferReversedIndex++;
-    count++;
+  FinishAll(mapf, displays...);
+  return read;
+}
+
+template <size_t BUFFER_LENGTH, typename DATA_TYPE, typename AGGREGATOR,
+          typename FIELD>
+template <typename SAMPLES_SRC, typename MAPPING_FUNC>
+size_t DisplaySamples<BUFFER_LENGTH, DATA_TYPE, AGGREGATOR, FIELD>::Update(
+    SAMPLES_SRC &src, uint32_t now, MAPPING_FUNC mapf, AbstractStore &store,
+    uint32_t storeOffset) {
+  const DATA_TYPE noData = std::numeric_limits<DATA_TYPE>::min();
+  const uint32_t windowEnd = period_ * ((now + period_ - 1) / period_);
+  typename SAMPLES_SRC::SampleType data;
+
+  // The saved state is only trusted if the last sample folded in is still
+  // the one on flash (nothing to check if there was none in the window)
+  size_t oldest = SIZE_MAX;
+  rebuilt_ = !LoadState(store, storeOffset) || windowEnd_ > windowEnd ||
+             lastSeconds_ > now;
+  if (!rebuilt_) {
+    oldest = src.FindRecentIndexAtOrBefore(lastSeconds_);
+    rebuilt_ = folded_ &&
+               (oldest == SIZE_MAX || !src.ReadSample(oldest, data) ||
+                SAMPLES_SRC::TimeAccessor::Seconds(data) != lastSeconds_);
   }
-  for (size_t r = bufferReversedIndex; r < length_; r++) {
-    dbg_printf("## mark %d with no data\n", r);
-    buffer_[length_ - r - 1] = INT16_MIN;
+  if (rebuilt_) {
+    dbg_printf("Rebuild display samples ending at %d\n", windowEnd);
+    for (size_t i = 0; i < length_; i++) {
+      buffer_[i] = noData;
+    }
+    // start with the oldest bucket open, AdvanceTo does the rest
+    windowEnd_ = windowEnd - (length_ - 1) * period_;
+    lastSeconds_ = windowEnd_ - period_;
+    folded_ = false;
+    open_.Reset();
+    oldest = src.FindIndexAtOrBefore(lastSeconds_);
+  }
+
+  // Fold the samples more recent than the last one, in chronological order
+  if (src.IsScanned() && !src.IsEmpty()) {
+    size_t newest = src.FindRecentIndexAtOrBefore(now);
+    oldest = (oldest == SIZE_MAX) ? src.NumberOfSamples() - 1 : oldest - 1;
+    if (newest != SIZE_MAX && oldest != SIZE_MAX && oldest >= newest) {
+      SamplesCursor<SAMPLES_SRC> cursor(src, oldest, CursorDirection::Forward);
+      while (cursor.Index() != SIZE_MAX && cursor.Index() >= newest &&
+             cursor.Next(data)) {
+        uint32_t seconds = SAMPLES_SRC::TimeAccessor::Seconds(data);
+        if (seconds <= lastSeconds_ || seconds > now) {
+          // out of order sample
+          continue;
+        }
+        AdvanceTo(period_ * ((seconds + period_ - 1) / period_), mapf);
+        typename FIELD::Input input;
+        FIELD::Extract(data, seconds, input);
+        open_.Add(input);
+        lastSeconds_ = seconds;
+        folded_ = true;
+      }
+    }
+  }
+  AdvanceTo(windowEnd, mapf);
+  SaveState(store, storeOffset);
+
+  // The open bucket is displayed with its current aggregate
+  buffer_[length_ - 1] = open_.IsEmpty() ? noData : mapf(open_.Value());
+  min_ = std::numeric_limits<DATA_TYPE>::max() - 1;
+  max_ = std::numeric_limits<DATA_TYPE>::min() + 1;
+  size_t count = 0;
+  for (size_t i = 0; i < length_; i++) {
+    if (buffer_[i] != noData) {
+      UpdateLimits(buffer_[i]);
+      count++;
+    }
   }
   return count;
 }
 
+template <size_t BUFFER_LENGTH, typename DATA_TYPE, typename AGGREGATOR,
+          typename FIELD>
+template <typename MAPPING_FUNC>
+void DisplaySamples<BUFFER_LENGTH, DATA_TYPE, AGGREGATOR, FIELD>::AdvanceTo(
+    uint32_t windowEnd, MAPPING_FUNC mapf) {
+  const DATA_TYPE noData = std::numeric_limits<DATA_TYPE>::min();
+  if (windowEnd <= windowEnd_) {
+    return;
+  }
+  // close the open bucket, and move the older ones back in time
+  buffer_[length_ - 1] = open_.IsEmpty() ? noData : mapf(open_.Value());
+  size_t shift = (windowEnd - windowEnd_) / period_;
+  if (shift > length_) {
+    shift = length_;
+  }
+  for (size_t i = 0; i + shift < length_; i++) {
+    buffer_[i] = buffer_[i + shift];
+  }
+  for (size_t i = length_ - shift; i < length_; i++) {
+    buffer_[i] = noData;
+  }
+  open_.Reset();
+  windowEnd_ = windowEnd;
+}
+
+template <size_t BUFFER_LENGTH, typename DATA_TYPE, typename AGGREGATOR,
+          typename FIELD>
+bool DisplaySamples<BUFFER_LENGTH, DATA_TYPE, AGGREGATOR, FIELD>::LoadState(
+    AbstractStore &store, uint32_t offset) {
+  uint32_t words[kStateWords];
+  if (store.Capacity() < offset + sizeof(words) ||
+      !store.Read(offset, words, sizeof(words))) {
+    return false;
+  }
+  DisplayState *state = (DisplayState *)(words);
+  uint8_t crc = state->crc;
+  state->crc = 0;
+  if (state->magic != kDisplayStateMagic ||
+      state->version != kDisplayStateVersion || state->length != length_ ||
+      state->dataSize != sizeof(DATA_TYPE) || state->period != period_ ||
+      state->aggregatorSize != sizeof(AGGREGATOR) ||
+      crc != crc8_maxim((const uint8_t *)(words), sizeof(words))) {
+    return false;
+  }
+  windowEnd_ = state->windowEnd;
+  lastSeconds_ = state->lastSeconds;
+  folded_ = (state->folded != 0);
+  const uint8_t *payload = (const uint8_t *)(words) + sizeof(DisplayState);
+  memcpy(&open_, payload, sizeof(AGGREGATOR));
+  memcpy(buffer_, payload + sizeof(AGGREGATOR), sizeof(buffer_));
+  return true;
+}
+
+template <size_t BUFFER_LENGTH, typename DATA_TYPE, typename AGGREGATOR,
+          typename FIELD>
+bool DisplaySamples<BUFFER_LENGTH, DATA_TYPE, AGGREGATOR, FIELD>::SaveState(
+    AbstractStore &store, uint32_t offset) {
+  uint32_t words[kStateWords];
+  memset(words, 0, sizeof(words));
+  DisplayState *state = (DisplayState *)(words);
+  state->magic = kDisplayStateMagic;
+  state->version = kDisplayStateVersion;
+  state->crc = 0;
+  state->length = (uint16_t)(length_);
+  state->dataSize = sizeof(DATA_TYPE);
+  state->period = period_;
+  state->windowEnd = windowEnd_;
+  state->lastSeconds = lastSeconds_;
+  state->folded = folded_ ? 1 : 0;
+  state->aggregatorSize = sizeof(AGGREGATOR);
+  uint8_t *payload = (uint8_t *)(words) + sizeof(DisplayState);
+  memcpy(payload, &open_, sizeof(AGGREGATOR));
+  memcpy(payload + sizeof(AGGREGATOR), buffer_, sizeof(buffer_));
+  state->crc = crc8_maxim((const uint8_t *)(words), sizeof(words));
+  if (store.Capacity() < offset + sizeof(words) ||
+      !store.Write(offset, words, sizeof(words))) {
+    dbg_printf("Cannot save the display samples state\n");
+    return false;
+  }
+  return true;
+}
+
 #endif
@@ -0,0 +1,75 @@
+#ifndef AAQIM_NOWCAST_SAMPLES_H
+#define AAQIM_NOWCAST_SAMPLES_H
+
+#include "display_samples.h"
+#include "nowcast.h"
+
+/**
+ * pm2.5 NowCast (see pm_nowcast) maintained from the samples stored on flash.
+ *
+ * The hourly averages are the buckets of a DisplaySamples (averaged in
+ * integers), kept up to date with DisplaySamples::Update: a wake up only
+ * reads the samples stored since the previous one, instead of the last 12
+ * hours. The most recent bucket is the current hour, which is not used
+ * until it is complete.
+ */
+class NowCastSamples {
+ public:
+  NowCastSamples() : hours_(3600), concentration_(0.0f), valid_(false) {}
+
+  /**
+   * @param src accessor of the AirSampleData samples stored on flash
+   * @param store persistent memory holding the hourly buckets (StateSize()
+   *              bytes from storeOffset)
+   * @return is the NowCast available (enough recent hours with samples)?
+   */
+  template <typename SAMPLES_SRC>
+  bool Update(SAMPLES_SRC &src, uint32_t now, AbstractStore &store,
+              uint32_t storeOffset = 0);
+
+  bool IsValid() const { return valid_; }
+
+  /** NowCast concentration in ug/m3 */
+  float Concentration() const { return concentration_; }
+
+  /** NowCast AQI, -1 if not valid */
+  int16_t Aqi() const {
+    return valid_ ? pm25_to_aqi_value(concentration_) : -1;
+  }
+
+  /** Were the hourly averages rebuilt from flash by the last Update? */
+  bool WasRebuilt() const { return hours_.WasRebuilt(); }
+
+  static constexpr size_t StateSize() {
+    return HourlySamples::StateSize();
+  }
+
+ protected:
+  typedef DisplaySamples<kNowCastHours + 1, int32_t, CodeMeanAggregator,
+                         Pm_2_5CodeField>
+      HourlySamples;
+
+  HourlySamples hours_;
+  float concentration_;
+  bool valid_;
+};
+
+template <typename SAMPLES_SRC>
+bool NowCastSamples::Update(SAMPLES_SRC &src, uint32_t now,
+                            AbstractStore &store, uint32_t storeOffset) {
+  hours_.Update(
+      src, now, [](uint16_t code) { return (int32_t)(code); }, store,
+      storeOffset);
+  float hourly[kNowCastHours];
+  for (size_t i = 0; i < kNowCastHours; i++) {
+    // skip the current hour, at the end of the buffer
+    int32_t code = hours_.Value(kNowCastHours - 1 - i);
+    hourly[i] = (code == std::numeric_limits<int32_t>::min())
+                    ? -1.0f
+                    : short_to_cf((uint16_t)(code));
+  }
+  valid_ = pm_nowcast(hourly, concentration_);
+  return valid_;
+}
+
+#endif
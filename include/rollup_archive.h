@@ -0,0 +1,159 @@
+#ifndef AAQIM_ROLLUP_ARCHIVE_H
+#define AAQIM_ROLLUP_ARCHIVE_H
+
+#include "aaqim_debug.h"
+#include "air_sample.h"
+#include "flash_samples.h"
+#include "rollup_data.h"
+#include "samples_cursor.h"
+
+typedef FlashSamples<RollupData, RollupTime> RollupFlashSamples;
+
+const size_t kMaxRollupTiers = 4;
+
+/**
+ * Maintain down sampled series (for example hourly and daily) of the pm2.5
+ * concentration next to the raw samples, so long time windows can be
+ * displayed by reading a single record per bucket.
+ *
+ * Each tier is stored in its own FlashSamples ring, and holds one RollupData
+ * (sum / count / min / max) per period. The periods are aligned on the unix
+ * epoch (UTC), and each period has to be a multiple of the period of the
+ * previous tier.
+ *
+ * A bucket is closed when the first sample of the next bucket is stored: the
+ * raw samples of the bucket are aggregated into a record of the first tier,
+ * then the records of this tier are aggregated into the next tier when its
+ * own bucket closes, and so on. Nothing has to be kept in RAM between two
+ * calls (the device deep sleeps between samples), only the last sample of
+ * each ring is needed to detect a bucket change.
+ *
+ * Usage:
+ *   RollupArchive<FlashSamples<AirSampleData, AirSampleTime>> archive(raw);
+ *   archive.AddTier(hourly, 3600);
+ *   archive.AddTier(daily, 24 * 3600);
+ *   archive.StoreSample(data);  // instead of raw.StoreSample(data)
+ *
+ * @param SAMPLES_SRC accessor of the raw AirSampleData samples (FlashSamples
+ *                    with AirSampleTime)
+ */
+template <typename SAMPLES_SRC>
+class RollupArchive {
+ public:
+  RollupArchive(SAMPLES_SRC &raw) : raw_(raw), tiersCount_(0) {}
+
+  /** Add a tier, from the shortest to the longest period
+   * @param ring storage of the tier (Begin() is left to the caller)
+   * @param periodInSeconds must be a multiple of the previous tier period
+   * @return false if the tier cannot be added
+   */
+  bool AddTier(RollupFlashSamples &ring, uint32_t periodInSeconds) {
+    if (tiersCount_ >= kMaxRollupTiers || periodInSeconds == 0) {
+      printf("Cannot add rollup tier\n");
+      return false;
+    }
+    if (tiersCount_ > 0 &&
+        (periodInSeconds % periods_[tiersCount_ - 1]) != 0) {
+      printf("Rollup period %d is not a multiple of %d\n", periodInSeconds,
+             periods_[tiersCount_ - 1]);
+      return false;
+    }
+    tiers_[tiersCount_] = &ring;
+    periods_[tiersCount_] = periodInSeconds;
+    tiersCount_++;
+    return true;
+  }
+
+  /** Store a new raw sample, and close the buckets it ends in all tiers.
+   * The samples are expected to be stored in chronological order.
+   */
+  bool StoreSample(const AirSampleData &data) {
+    uint32_t previous = 0;
+    bool hasPrevious = false;
+    if (raw_.IsScanned() && !raw_.IsEmpty()) {
+      AirSampleData last;
+      raw_.ReadSample(0, last);
+      previous = AirSampleTime::Seconds(last);
+      hasPrevious = true;
+    }
+    if (!raw_.StoreSample(data)) {
+      return false;
+    }
+    if (!hasPrevious) {
+      return true;
+    }
+    uint32_t seconds = AirSampleTime::Seconds(data);
+    // the previous sample is now at index 1 of the raw serie
+    for (size_t t = 0; t < tiersCount_; t++) {
+      if (seconds / periods_[t] == previous / periods_[t]) {
+        // longer periods cannot have changed either
+        break;
+      }
+      if (t == 0) {
+        CloseBucket(raw_, 1, t, previous);
+      } else {
+        CloseBucket(*tiers_[t - 1], 0, t, previous);
+      }
+    }
+    return true;
+  }
+
+  size_t TiersCount() const { return tiersCount_; }
+
+  uint32_t Period(size_t tier) const { return periods_[tier]; }
+
+  RollupFlashSamples &Tier(size_t tier) { return *tiers_[tier]; }
+
+ protected:
+  /** Aggregate the records of the bucket containing `seconds` from a source
+   * (raw samples or records of the previous tier), starting at `index`, and
+   * store the result in the given tier.
+   */
+  template <typename SRC>
+  bool CloseBucket(SRC &src, size_t index, size_t tier, uint32_t seconds) {
+    RollupFlashSamples &ring = *tiers_[tier];
+    const uint32_t bucket = seconds / periods_[tier];
+    if (!ring.IsScanned()) {
+      return false;
+    }
+    if (!ring.IsEmpty()) {
+      RollupData last;
+      ring.ReadSample(0, last);
+      if (RollupTime::Seconds(last) / periods_[tier] >= bucket) {
+        // already closed (for example after a reset while storing)
+        return false;
+      }
+    }
+
+    SamplesCursor<SRC> cursor(src, index);
+    typename SRC::SampleType data;
+    RollupData rollup;
+    bool started = false;
+    while (cursor.Next(data)) {
+      if (SRC::TimeAccessor::Seconds(data) / periods_[tier] != bucket) {
+        break;
+      }
+      if (!started) {
+        // most recent record first, so the rollup keeps its timestamp
+        rollup_init(rollup, data);
+        started = true;
+      } else {
+        rollup_add(rollup, data);
+      }
+    }
+    if (!started) {
+      return false;
+    }
+    rollup_seal(rollup);
+    dbg_printf("Close rollup bucket %u of tier %u : %u samples\n",
+               (unsigned)bucket, (unsigned)tier, (unsigned)rollup.count);
+    return ring.StoreSample(rollup);
+  }
+
+  SAMPLES_SRC &raw_;
+  RollupFlashSamples *tiers_[kMaxRollupTiers];
+  uint32_t periods_[kMaxRollupTiers];
+  size_t tiersCount_;
+};
+
+#endif
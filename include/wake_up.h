@@ -0,0 +1,115 @@
+#ifndef AAQIM_WAKE_UP_H
+#define AAQIM_WAKE_UP_H
+
+#include "abstract_store.h"
+#include "analysis.h"
+#include "display_samples.h"
+#include "nowcast_samples.h"
+#include "sensor_reliability.h"
+#include "sensors.h"
+
+/**
+ * What the monitor does with the sensors at each wake up, without the
+ * network, the display and the logs: shared by main.cpp and the native
+ * replay of the wake ups (test_replay), so that the replay runs the code of
+ * the device.
+ */
+
+// Uncomment to use real time data rather than sensor computed 10min averages
+// #define USE_PM_REAL_TIME
+
+// Comment out to average all the consistent sensors, rather than rejecting
+// the ones too far from the median (see SensorFusion)
+#define USE_ROBUST_FUSION
+
+// Uncomment to weight the sensors by the age of their readings and the
+// agreement of their A/B channels
+// #define USE_WEIGHTED_FUSION
+
+// 24h graph of the display: integer mean of the pm2.5 codes over 10 minutes
+// for each of its columns
+constexpr int16_t kGraphWidth = 144;
+const uint32_t kGraphPeriodSeconds = 10 * 60;
+typedef DisplaySamples<kGraphWidth, int16_t, CodeMeanAggregator,
+                       Pm_2_5CodeField>
+    GraphBuffer;
+
+// Scores of the sensors of the group
+typedef SensorReliabilityTable<AirSensors::kCapacity> GroupReliability;
+
+// In the RTC memory: the graph state, the NowCast hourly buckets, then the
+// reliability of the sensors (~500 bytes of the 512)
+constexpr uint32_t kGraphStateOffset = 0;
+constexpr uint32_t kNowCastStateOffset =
+    kGraphStateOffset + GraphBuffer::StateSize();
+constexpr uint32_t kReliabilityStateOffset =
+    kNowCastStateOffset + NowCastSamples::StateSize();
+static_assert(kReliabilityStateOffset + GroupReliability::StateSize() <=
+                  kRtcUserMemorySize,
+              "The states of a wake up fit in the RTC user memory");
+
+/** Add the sensors to the group, the sensors chronically rejected being only
+ * requested now and then (see SensorReliability::ShouldRequest) */
+inline void RequestSensors(const size_t ids[], size_t count,
+                           SensorReliability &reliability,
+                           AirSensorsBase &sensors) {
+  for (size_t i = 0; i < count; i++) {
+    sensors.AddSensor(ids[i]);
+    sensors.SetSkipped(ids[i], !reliability.ShouldRequest(ids[i]));
+  }
+  // all requested when they are all left out
+  for (size_t i = 0; i < count; i++) {
+    if (!sensors.IsSkipped(ids[i])) {
+      reliability.SetRequested(ids[i]);
+    }
+  }
+}
+
+/** Analysis of all the sensors of the group with the filters selected above
+ * @param spatialFilter optional, weights the sensors by their distance to
+ *                      the monitor (see DistanceFilter)
+ * @param reliability optional, scores of the sensors updated from the
+ *                    analysis
+ * @return number of sensors used in the sample (see SensorAnalysis::Analyze)
+ */
+template <size_t CAPACITY>
+size_t AnalyzeSensors(const AirSensorsGroup<CAPACITY> &sensors,
+                      AirSample &sample,
+                      GroupDiagnostics<CAPACITY> &diagnostics,
+                      const SensorFilter *spatialFilter = nullptr,
+                      SensorReliability *reliability = nullptr) {
+#if defined(USE_WEIGHTED_FUSION)
+  static const AgeFilter ageFilter(kMaxReadingAgeMinutes,
+                                   kAgeHalfWeightMinutes);
+  static const ConsistencyFilter consistencyFilter(true);
+#else
+  static const AgeFilter ageFilter;
+  static const ConsistencyFilter consistencyFilter;
+#endif
+  SensorAnalysis analysis;
+  analysis.AddFilter(ageFilter);
+  analysis.AddFilter(consistencyFilter);
+  if (spatialFilter != nullptr) {
+    analysis.AddFilter(*spatialFilter);
+  }
+#if !defined(USE_ROBUST_FUSION)
+  analysis.SetOutlierRejection(0.0f);
+#endif
+#if defined(USE_PM_REAL_TIME)
+  analysis.UseRealTime(true);
+#endif
+
+  size_t count = analysis.Analyze(&sensors.Data(0), sensors.Count(), sample,
+                                  diagnostics);
+  if (reliability != nullptr) {
+    uint32_t ids[CAPACITY];
+    for (size_t i = 0; i < diagnostics.sensorsCount; i++) {
+      ids[i] = sensors.Id(i);
+    }
+    reliability->Update(ids, &sensors.Data(0), diagnostics.sensorsCount,
+                        diagnostics, sample.Seconds());
+  }
+  return count;
+}
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef AAQIM_BYTE_SOURCE_H
+#define AAQIM_BYTE_SOURCE_H
+
+#include <stddef.h>
+#include <string.h>
+
+/** Where the sensors response is read from: the HTTP stream on the target,
+ * or a recorded response (file or memory) on native.
+ *
+ * read() and readBytes() make it usable as a custom reader by ArduinoJson.
+ */
+class ByteSource {
+ public:
+  /** Read up to size bytes
+   * @return number of bytes read, 0 at the end of the source */
+  virtual size_t Read(char *buffer, size_t size) = 0;
+
+  int read() {
+    char c;
+    return (Read(&c, 1) == 1) ? (unsigned char)(c) : -1;
+  }
+
+  size_t readBytes(char *buffer, size_t size) { return Read(buffer, size); }
+};
+
+/** Response already in memory */
+class MemorySource : public ByteSource {
+ public:
+  MemorySource(const char *data, size_t size)
+      : data_(data), size_(size), position_(0) {}
+
+  size_t Read(char *buffer, size_t size) {
+    if (size > size_ - position_) {
+      size = size_ - position_;
+    }
+    memcpy(buffer, data_ + position_, size);
+    position_ += size;
+    return size;
+  }
+
+  /** Read again from the start */
+  void Rewind() { position_ = 0; }
+
+ protected:
+  const char *data_;
+  const size_t size_;
+  size_t position_;
+};
+
+#if defined(ARDUINO)
+
+#include <Stream.h>
+
+/** Arduino stream (for example HTTPClient::getStream()), read with its
+ * timeout */
+class StreamSource : public ByteSource {
+ public:
+  explicit StreamSource(Stream &stream) : stream_(stream) {}
+
+  size_t Read(char *buffer, size_t size) {
+    return stream_.readBytes(buffer, size);
+  }
+
+ protected:
+  Stream &stream_;
+};
+
+#endif  // if defined(ARDUINO)
+
+#endif
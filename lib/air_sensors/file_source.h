@@ -0,0 +1,32 @@
+#ifndef AAQIM_FILE_SOURCE_H
+#define AAQIM_FILE_SOURCE_H
+
+#include "byte_source.h"
+
+#if !defined(ARDUINO)
+
+#include <stdio.h>
+
+/** Recorded response read from a file on native (see data/) */
+class FileSource : public ByteSource {
+ public:
+  explicit FileSource(const char *path) : file_(fopen(path, "rb")) {}
+  ~FileSource() {
+    if (file_ != NULL) {
+      fclose(file_);
+    }
+  }
+
+  bool IsOpen() const { return file_ != NULL; }
+
+  size_t Read(char *buffer, size_t size) {
+    return (file_ != NULL) ? fread(buffer, 1, size, file_) : 0;
+  }
+
+ protected:
+  FILE *file_;
+};
+
+#endif  // if !defined(ARDUINO)
+
+#endif
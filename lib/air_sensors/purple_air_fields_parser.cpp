@@ -0,0 +1,118 @@
+#include "purple_air_fields_parser.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// pm2.5_atm is the PM2_5Value of the legacy API (see purple_air_parser.cpp)
+const char *const ApiFieldNames[] = {
+    "sensor_index",   "last_seen",      "humidity",       "temperature",
+    "pressure",       "pm2.5_atm_a",    "pm2.5_atm_b",    "pm2.5_10minute",
+    "pm2.5_30minute", "pm2.5_60minute", "pm2.5_6hour",    "pm2.5_24hour",
+    "pm2.5_1week"};
+
+static ApiField find_field(const char *name) {
+  for (uint8_t f = 0; f < static_cast<uint8_t>(ApiField::Count); f++) {
+    if (strcmp(name, ApiFieldNames[f]) == 0) {
+      return static_cast<ApiField>(f);
+    }
+  }
+  return ApiField::Unknown;
+}
+
+void PurpleAirFieldsParser::Reset() {
+  RecordsParser::Reset();
+  columnsCount_ = 0;
+  column_ = 0;
+  section_ = Section::Other;
+  hasChannelB_ = false;
+  timestamp_ = 0;
+}
+
+void PurpleAirFieldsParser::OnStart(uint8_t depth, const char *key,
+                                    bool object) {
+  if (depth == kRowDepth - 1 && !object) {
+    if (strcmp(key, "fields") == 0) {
+      section_ = Section::Fields;
+      columnsCount_ = 0;
+      hasChannelB_ = false;
+    } else if (strcmp(key, "data") == 0) {
+      section_ = Section::Data;
+    }
+  } else if (depth == kRowDepth && section_ == Section::Data) {
+    memset(&record_, 0, sizeof(record_));
+    pm_2_5_B_ = 0.0f;
+    column_ = 0;
+  }
+}
+
+void PurpleAirFieldsParser::OnEnd(uint8_t depth, bool object) {
+  if (depth == kRowDepth - 1) {
+    section_ = Section::Other;
+  } else if (depth == kRowDepth && section_ == Section::Data) {
+    if (timestamp_ >= record_.lastSeen && record_.lastSeen > 0) {
+      record_.age = (int16_t)((timestamp_ - record_.lastSeen) / 60);
+    }
+    records_++;
+    OnRecord(record_);
+    if (hasChannelB_) {
+      record_.parentId = record_.id;
+      record_.id = 0;
+      record_.pm_2_5 = pm_2_5_B_;
+      OnRecord(record_);
+    }
+  }
+}
+
+void PurpleAirFieldsParser::OnValue(uint8_t depth, const char *key,
+                                    const char *value) {
+  if (depth == 1) {
+    if (strcmp(key, "time_stamp") == 0) {
+      timestamp_ = strtoul(value, nullptr, 10);
+    }
+  } else if (section_ == Section::Fields && depth == kRowDepth - 1) {
+    if (columnsCount_ < kMaxColumns) {
+      ApiField field = find_field(value);
+      hasChannelB_ = hasChannelB_ || (field == ApiField::Pm_2_5_B);
+      columns_[columnsCount_++] = field;
+    }
+  } else if (section_ == Section::Data && depth == kRowDepth) {
+    if (column_ < columnsCount_ && strcmp(value, "null") != 0) {
+      SetValue(columns_[column_], value);
+    }
+    column_++;
+  }
+}
+
+void PurpleAirFieldsParser::SetValue(ApiField field, const char *value) {
+  switch (field) {
+    case ApiField::SensorIndex:
+      record_.id = strtoul(value, nullptr, 10);
+      break;
+    case ApiField::LastSeen:
+      record_.lastSeen = strtoul(value, nullptr, 10);
+      break;
+    case ApiField::Humidity:
+      record_.humidity = (int16_t)(atoi(value));
+      break;
+    case ApiField::Temperature:
+      record_.temperature = (int16_t)(atoi(value));
+      break;
+    case ApiField::Pressure:
+      record_.pressure = strtof(value, nullptr);
+      break;
+    case ApiField::Pm_2_5_A:
+      record_.pm_2_5 = strtof(value, nullptr);
+      break;
+    case ApiField::Pm_2_5_B:
+      pm_2_5_B_ = strtof(value, nullptr);
+      break;
+    case ApiField::Unknown:
+      break;
+    default: {
+      int index = static_cast<int>(field) -
+                  static_cast<int>(ApiField::Pm_2_5_10Minutes);
+      record_.averages[index] = strtof(value, nullptr);
+      break;
+    }
+  }
+}
@@ -0,0 +1,67 @@
+#ifndef AAQIM_PURPLE_AIR_FIELDS_PARSER_H
+#define AAQIM_PURPLE_AIR_FIELDS_PARSER_H
+
+#include "purple_air_parser.h"
+
+/** Fields of the PurpleAir API (`v1/sensors?fields=`) used by the monitor */
+enum class ApiField : uint8_t {
+  SensorIndex,
+  LastSeen,
+  Humidity,
+  Temperature,
+  Pressure,
+  Pm_2_5_A,
+  Pm_2_5_B,
+  Pm_2_5_10Minutes,  // then the other averages, in PmAvgIndexes order
+  Pm_2_5_30Minutes,
+  Pm_2_5_1Hour,
+  Pm_2_5_6Hours,
+  Pm_2_5_24Hours,
+  Pm_2_5_1Week,
+  Count,
+  Unknown = Count
+};
+
+/** Names of the fields, indexed by ApiField */
+extern const char *const ApiFieldNames[];
+
+/**
+ * Parser of the responses of the PurpleAir API with selected fields: the
+ * names of the fields are listed once (`fields`), then each sensor is an
+ * array of values in the same order (`data`). A response is ~20 times smaller
+ * than the legacy one for the same sensors.
+ *
+ * Each row is delivered as a primary record (channel A), then a child record
+ * (channel B) if pm2.5_atm_b is one of the fields. The age of the readings is
+ * computed from the time_stamp of the response, which comes before the data.
+ */
+class PurpleAirFieldsParser : public RecordsParser {
+ public:
+  static const uint8_t kMaxColumns = 32;
+
+  PurpleAirFieldsParser() { Reset(); }
+
+  void Reset() override;
+
+  void OnStart(uint8_t depth, const char *key, bool object) override;
+  void OnEnd(uint8_t depth, bool object) override;
+  void OnValue(uint8_t depth, const char *key, const char *value) override;
+
+ protected:
+  enum class Section : uint8_t { Other, Fields, Data };
+
+  // depth of the rows: root object, data array, row
+  static const uint8_t kRowDepth = 3;
+
+  void SetValue(ApiField field, const char *value);
+
+  ApiField columns_[kMaxColumns];
+  uint8_t columnsCount_;
+  uint8_t column_;  // of the next value of the row
+  Section section_;
+  bool hasChannelB_;
+  uint32_t timestamp_;  // of the response
+  float pm_2_5_B_;
+};
+
+#endif
@@ -0,0 +1,80 @@
+#include "purple_air_parser.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// by observing the PA map, it looks like pm2_5_cf_1 and pm2_5_atm are
+// quite different in certain ranges. *_atm seems to be calibrated for
+// outdoor and is reflected in PM2_5Value.
+static const char *kPm2_5_key = "PM2_5Value";
+
+void PurpleAirParser::OnStart(uint8_t depth, const char *key, bool object) {
+  if (depth == kRecordDepth && object) {
+    memset(&record_, 0, sizeof(record_));
+  }
+}
+
+void PurpleAirParser::OnEnd(uint8_t depth, bool object) {
+  if (depth == kRecordDepth && object) {
+    records_++;
+    OnRecord(record_);
+  }
+}
+
+void PurpleAirParser::OnValue(uint8_t depth, const char *key,
+                              const char *value) {
+  if (depth != kRecordDepth) {
+    return;
+  }
+  // the numbers may be quoted, they are all unescaped strings here
+  if (strcmp(key, "ID") == 0) {
+    record_.id = strtoul(value, nullptr, 10);
+  } else if (strcmp(key, "ParentID") == 0) {
+    record_.parentId = strtoul(value, nullptr, 10);
+  } else if (strcmp(key, kPm2_5_key) == 0) {
+    record_.pm_2_5 = strtof(value, nullptr);
+  } else if (strcmp(key, "AGE") == 0) {
+    record_.age = (int16_t)(atoi(value));
+  } else if (strcmp(key, "LastSeen") == 0) {
+    record_.lastSeen = strtoul(value, nullptr, 10);
+  } else if (strcmp(key, "temp_f") == 0) {
+    record_.temperature = (int16_t)(atoi(value));
+  } else if (strcmp(key, "humidity") == 0) {
+    record_.humidity = (int16_t)(atoi(value));
+  } else if (strcmp(key, "pressure") == 0) {
+    record_.pressure = strtof(value, nullptr);
+  } else if (strcmp(key, "Lat") == 0) {
+    record_.latitude = strtof(value, nullptr);
+  } else if (strcmp(key, "Lon") == 0) {
+    record_.longitude = strtof(value, nullptr);
+  } else if (strcmp(key, "DEVICE_LOCATIONTYPE") == 0) {
+    record_.outside = (strcmp(value, "outside") == 0);
+  }
+}
+
+JsonScanner *PurpleAirParser::NestedScanner(uint8_t depth, const char *key) {
+  if (depth == kRecordDepth && strcmp(key, "Stats") == 0) {
+    stats_.record_ = &record_;
+    return &statsScanner_;
+  }
+  return nullptr;
+}
+
+void PurpleAirParser::StatsHandler::OnValue(uint8_t depth, const char *key,
+                                            const char *value) {
+  if (depth != 1) {
+    return;
+  }
+  if (key[0] == 'v') {
+    // v1 to v6, v being the real time value when the averages were computed
+    if (key[1] >= '1' && key[1] < '1' + PmAvgIndexes::PmAvgSize &&
+        key[2] == '\0') {
+      record_->averages[key[1] - '1'] = strtof(value, nullptr);
+    } else if (key[1] == '\0') {
+      record_->statsValue = strtof(value, nullptr);
+    }
+  } else if (strcmp(key, "lastModified") == 0) {
+    // milliseconds, beyond 32 bits
+    record_->statsTimestamp = (uint32_t)(strtoull(value, nullptr, 10) / 1000);
+  }
+}
@@ -0,0 +1,92 @@
+#ifndef AAQIM_PURPLE_AIR_PARSER_H
+#define AAQIM_PURPLE_AIR_PARSER_H
+
+#include "json_scanner.h"
+#include "sensor_data.h"
+
+/** Fields of a sensor record of the PurpleAir json API (`json?show=`): a
+ * primary record (channel A) or a child record (channel B, with ParentID) */
+struct PurpleAirRecord {
+  size_t id;
+  size_t parentId;  // 0 for a primary record
+  uint32_t lastSeen;
+  float pm_2_5;
+  float pressure;
+  float latitude;   // degrees (legacy API only)
+  float longitude;
+  float averages[PmAvgIndexes::PmAvgSize];  // from Stats v1 to v6
+  float statsValue;                         // Stats v
+  uint32_t statsTimestamp;                  // Stats lastModified (seconds)
+  int16_t age;
+  int16_t temperature;
+  int16_t humidity;
+  bool outside;  // DEVICE_LOCATIONTYPE of a primary record (legacy API only)
+};
+
+/**
+ * Base of the streaming parsers of the PurpleAir responses: the records are
+ * extracted as the response is read, and delivered to OnRecord, without
+ * building a document.
+ */
+class RecordsParser : public JsonHandler {
+ public:
+  RecordsParser() : scanner_(*this), records_(0) {}
+
+  /** Ready for a new response */
+  virtual void Reset() {
+    scanner_.Reset();
+    records_ = 0;
+  }
+
+  /** @return false on syntax error */
+  bool Feed(const char *data, size_t size) {
+    return scanner_.Feed(data, size);
+  }
+
+  bool IsComplete() const { return scanner_.IsComplete(); }
+
+  /** Number of records parsed */
+  size_t Records() const { return records_; }
+
+ protected:
+  /** Called for each record (channel A, then channel B if any) */
+  virtual void OnRecord(const PurpleAirRecord &record) = 0;
+
+  JsonScanner scanner_;
+  PurpleAirRecord record_;
+  size_t records_;
+};
+
+/**
+ * Parser of the responses of the legacy PurpleAir API (`json?show=`): a
+ * record per channel. The Stats string (JSON within JSON) is parsed in the
+ * same pass.
+ *
+ * A few hundred bytes of memory, whatever the size of the response.
+ */
+class PurpleAirParser : public RecordsParser {
+ public:
+  PurpleAirParser() : statsScanner_(stats_) {}
+
+  void OnStart(uint8_t depth, const char *key, bool object) override;
+  void OnEnd(uint8_t depth, bool object) override;
+  void OnValue(uint8_t depth, const char *key, const char *value) override;
+  JsonScanner *NestedScanner(uint8_t depth, const char *key) override;
+
+ protected:
+  /** Values of the Stats string */
+  class StatsHandler : public JsonHandler {
+   public:
+    void OnValue(uint8_t depth, const char *key, const char *value) override;
+
+    PurpleAirRecord *record_;
+  };
+
+  // depth of the records: root object, results array, record
+  static const uint8_t kRecordDepth = 3;
+
+  StatsHandler stats_;
+  JsonScanner statsScanner_;
+};
+
+#endif
@@ -1,91 +1,198 @@
 #include "sensors.h"
 
-#include <ArduinoJson.h>
-#include <ESP8266HTTPClient.h>
+#include <stdio.h>
 
-// To test with 8 sensors collection:
-// http://www.purpleair.com/json?show=59927|65489|67415|25301|54857|36667|66029|54411
-// ArduinoJson Assistant says 19416 bytes
+#include "aaqim_debug.h"
+#include "purple_air_fields_parser.h"
+#include "sensors_provider.h"
 
-static const size_t kJsonCapacity = 20000;
-static const char *kPurpleAirUrl = "http://www.purpleair.com/";
-static const char *kPurpleAirRequest = "json?show=";
+/** Parser storing the records in the sensors data */
+template <typename PARSER>
+class SensorsParser : public PARSER {
+ public:
+  explicit SensorsParser(AirSensorsBase &sensors)
+      : sensors_(sensors), primaryCount_(0) {}
 
-// by observing the PA map, it looks like pm2_5_cf_1 and pm2_5_atm are
-// quite different in certain ranges. *_atm seems to be calibrated for
-// outdoor and is reflected in PM2_5Value.
-static const char *kPm2_5_key = "PM2_5Value";
+  size_t PrimaryCount() const { return primaryCount_; }
+
+ protected:
+  void OnRecord(const PurpleAirRecord &record) override {
+    if (sensors_.StoreRecord(record) && record.parentId == 0) {
+      primaryCount_++;
+    }
+  }
+
+  AirSensorsBase &sensors_;
+  size_t primaryCount_;
+};
+
+bool AirSensorsBase::AddSensor(size_t sid) {
+  if (sensorsCount_ >= capacity_ || GetSensorIndex(sid) != SIZE_MAX) {
+    return false;
+  }
+  // insertion in the sorted ids (only done once, before the parsing)
+  size_t position = sensorsCount_;
+  while (position > 0 && sortedIds_[position - 1] > sid) {
+    sortedIds_[position] = sortedIds_[position - 1];
+    sortedIndexes_[position] = sortedIndexes_[position - 1];
+    position--;
+  }
+  sortedIds_[position] = (uint32_t)(sid);
+  sortedIndexes_[position] = (uint8_t)(sensorsCount_);
+  sensorsData_[sensorsCount_] = SensorData();
+  skipped_[sensorsCount_] = false;
+  sensorsCount_++;
+  return true;
+}
+
+bool AirSensorsBase::SetSkipped(size_t sid, bool skipped) {
+  size_t index = GetSensorIndex(sid);
+  if (index == SIZE_MAX) {
+    return false;
+  }
+  skipped_[index] = skipped;
+  return true;
+}
 
-bool AirSensors::UpdateData(WiFiClient &client, HTTPClient &http) {
-  String url = String(kPurpleAirUrl) + String(kPurpleAirRequest);
-  Serial.println(sensorsCount_);
+bool AirSensorsBase::IsSkipped(size_t sid) const {
+  size_t index = GetSensorIndex(sid);
+  return index != SIZE_MAX && IsSkippedIndex(index);
+}
+
+size_t AirSensorsBase::RequestedCount() const {
+  size_t count = 0;
   for (size_t index = 0; index < sensorsCount_; index++) {
-    // Build request to obtain all the sensors at once
-    if (index > 0) {
-      url += "|";
+    count += skipped_[index] ? 0 : 1;
+  }
+  return count;
+}
+
+size_t AirSensorsBase::Id(size_t index) const {
+  for (size_t rank = 0; rank < sensorsCount_; rank++) {
+    if (sortedIndexes_[rank] == index) {
+      return sortedIds_[rank];
     }
-    url += String(sensorIds_[index]);
   }
-  Serial.print("Request URL = ");
-  Serial.println(url);
+  return 0;
+}
 
-  unsigned long start = millis();
-  // Send request
-  http.useHTTP10(true);
-  http.begin(client, url);
-  http.GET();
-  Serial.print("Retrieve data time (ms) = ");
-  Serial.println(millis() - start);
+size_t AirSensorsBase::GetSensorIndex(size_t sid) const {
+  size_t low = 0;
+  size_t high = sensorsCount_;
+  while (low < high) {
+    size_t middle = (low + high) / 2;
+    if (sortedIds_[middle] < sid) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  if (low < sensorsCount_ && sortedIds_[low] == sid) {
+    return sortedIndexes_[low];
+  }
+  return SIZE_MAX;
+}
 
-  return (ParseSensors(http) > 0);
+bool AirSensorsBase::StoreRecord(const PurpleAirRecord &record) {
+  if (record.parentId == 0) {
+    size_t index = GetSensorIndex(record.id);
+    if (index == SIZE_MAX || IsSkippedIndex(index)) {
+      return false;
+    }
+    SensorData &data = sensorsData_[index];
+    data.id = record.id;
+    data.timestamp = record.lastSeen;
+    data.pm_2_5_A = record.pm_2_5;
+    data.age_A = record.age;
+    data.temperature = record.temperature;
+    data.humidity = record.humidity;
+    data.pressure = record.pressure;
+    for (short i = 0; i < PmAvgIndexes::PmAvgSize; i++) {
+      data.averages[i] = record.averages[i];
+    }
+    data.statsValue = record.statsValue;
+    data.statsTimestamp = record.statsTimestamp;
+  } else {
+    size_t index = GetSensorIndex(record.parentId);
+    if (index == SIZE_MAX || IsSkippedIndex(index)) {
+      return false;
+    }
+    sensorsData_[index].pm_2_5_B = record.pm_2_5;
+    sensorsData_[index].age_B = record.age;
+  }
+  return true;
 }
 
-void AirSensors::PrintSensorData(const SensorData &data) {
-  Serial.print("Sensor # ");
-  Serial.println(data.id);
-  Serial.print("  timestamp =   ");
-  Serial.println(data.timestamp);
-  Serial.print("  age_A (min) = ");
-  Serial.println(data.age_A);
-  Serial.print("  age_B (min) = ");
-  Serial.println(data.age_B);
-  Serial.print("  pm_2_5_A =    ");
-  Serial.println(data.pm_2_5_A);
-  Serial.print("  pm_2_5_B =    ");
-  Serial.println(data.pm_2_5_B);
-  Serial.print("  temperature = ");
-  Serial.println(data.temperature);
-  Serial.print("  humidity =    ");
-  Serial.println(data.humidity);
-  Serial.print("  pressure =    ");
-  Serial.println(data.pressure);
-  Serial.print("  stats = [ ");
-  for (short i = 0; i < PmAvgIndexes::PmAvgSize; i++) {
-    if ( i > 0 ) {
-      Serial.print(" | ");
+template <typename PARSER>
+size_t AirSensorsBase::Parse(ByteSource &source) {
+  SensorsParser<PARSER> parser(*this);
+  char buffer[kParseChunkSize];
+  size_t read;
+  parseBytes_ = 0;
+  while (!parser.IsComplete() &&
+         (read = source.Read(buffer, sizeof(buffer))) > 0) {
+    parseBytes_ += read;
+    if (!parser.Feed(buffer, read)) {
+      dbg_printf("Error, invalid JSON response\n");
+      break;
     }
-    Serial.print(data.averages[i]);
   }
-  Serial.println(" ]");
+  parseMemory_ = sizeof(parser) + sizeof(buffer);
+  return parser.PrimaryCount();
+}
+
+size_t AirSensorsBase::ParseSensors(ByteSource &source) {
+  return Parse<PurpleAirParser>(source);
+}
+
+size_t AirSensorsBase::ParseSensorsFields(ByteSource &source) {
+  return Parse<PurpleAirFieldsParser>(source);
 }
 
-size_t AirSensors::ParseSensors(HTTPClient &http) {
-  Serial.print("Memory heap before JSON doc = ");
-  Serial.println(ESP.getFreeHeap());
+#if defined(AAQIM_ARDUINOJSON)
+
+#include <ArduinoJson.h>
+
+// To test with 8 sensors collection:
+// http://www.purpleair.com/json?show=59927|65489|67415|25301|54857|36667|66029|54411
+// ArduinoJson Assistant says 19416 bytes
+
+static const size_t kJsonCapacity = 20000;
+static const size_t kStatsJsonCapacity = 400;
+
+static const char *kPm2_5_key = "PM2_5Value";
+static const char *kStatsKeys[PmAvgIndexes::PmAvgSize] = {"v1", "v2", "v3",
+                                                          "v4", "v5", "v6"};
+
+/** Source counting the bytes read by ArduinoJson */
+class CountingSource : public ByteSource {
+ public:
+  explicit CountingSource(ByteSource &source) : source_(source), count_(0) {}
+
+  size_t Read(char *buffer, size_t size) {
+    size_t read = source_.Read(buffer, size);
+    count_ += read;
+    return read;
+  }
+
+  size_t Count() const { return count_; }
+
+ protected:
+  ByteSource &source_;
+  size_t count_;
+};
+
+size_t AirSensorsBase::ParseSensorsDocument(ByteSource &source) {
   DynamicJsonDocument doc(kJsonCapacity);
-  StaticJsonDocument<400> subdoc;
-  Serial.print("Memory heap after JSON doc = ");
-  Serial.println(ESP.getFreeHeap());
+  StaticJsonDocument<kStatsJsonCapacity> subdoc;
+  parseMemory_ = kJsonCapacity + kStatsJsonCapacity;
 
-  unsigned long start = millis();
-  auto err = deserializeJson(doc, http.getStream());
+  CountingSource counting(source);
+  auto err = deserializeJson(doc, counting);
+  parseBytes_ = counting.Count();
   if (err) {
-    Serial.print("Error, doc deserializeJson() returned ");
-    Serial.println(err.c_str());
+    dbg_printf("Error, doc deserializeJson() returned %s\n", err.c_str());
   }
-  unsigned long step = millis();
-  Serial.print("Deserialization (ms) = ");
-  Serial.println(step - start);
 
   // Array of sensors
   JsonArray sensorsArray = doc["results"].as<JsonArray>();
@@ -99,7 +206,7 @@ size_t AirSensors::ParseSensors(HTTPClient &http) {
     if (parent == 0) {
       size_t sid = sensor["ID"];
       index = GetSensorIndex(sid);
-      if (index < kMaxSensors) {
+      if (index != SIZE_MAX && !IsSkippedIndex(index)) {
         sensorsData_[index].id = sid;
         sensorsData_[index].timestamp = sensor["LastSeen"];
         sensorsData_[index].pm_2_5_A = sensor[kPm2_5_key];
@@ -111,26 +218,109 @@ size_t AirSensors::ParseSensors(HTTPClient &http) {
         // Extract statistics
         auto result = deserializeJson(subdoc, sensor["Stats"]);
         if (result) {
-          Serial.print("Error, subdoc deserialization returned ");
-          Serial.println(result.c_str());
+          dbg_printf("Error, subdoc deserialization returned %s\n",
+                     result.c_str());
         } else {
           for (short i = 0; i < PmAvgIndexes::PmAvgSize; i++) {
-            char key[3];
-            sprintf(key, "v%d", i + 1);
-            sensorsData_[index].averages[i] = subdoc[key];
+            sensorsData_[index].averages[i] = subdoc[kStatsKeys[i]];
           }
+          sensorsData_[index].statsValue = subdoc["v"];
+          sensorsData_[index].statsTimestamp =
+              (uint32_t)(subdoc["lastModified"].as<uint64_t>() / 1000);
         }
       }
     } else {
+      // B channel, ignored if its parent is not one of the sensors
       index = GetSensorIndex(parent);
-      sensorsData_[index].pm_2_5_B = sensor[kPm2_5_key];
-      sensorsData_[index].age_B = sensor["AGE"];
+      if (index != SIZE_MAX && !IsSkippedIndex(index)) {
+        sensorsData_[index].pm_2_5_B = sensor[kPm2_5_key];
+        sensorsData_[index].age_B = sensor["AGE"];
+      }
     }
   }
 
-  unsigned long stop = millis();
-  Serial.print("Parsing to structure (ms) = ");
-  Serial.println(stop - step);
-
   return primaryCount;
-}
\ No newline at end of file
+}
+
+#endif  // if defined(AAQIM_ARDUINOJSON)
+
+#if defined(ARDUINO)
+
+#include <ESP8266HTTPClient.h>
+
+bool AirSensorsBase::UpdateData(WiFiClient &client, HTTPClient &http) {
+  static const PurpleAirJsonProvider legacy;
+  return UpdateData(client, http, legacy);
+}
+
+bool AirSensorsBase::UpdateData(WiFiClient &client, HTTPClient &http,
+                                const SensorsProvider &provider) {
+  // Build request to obtain all the sensors at once
+  char url[kMaxUrlLength];
+  if (!provider.RequestUrl(*this, url, sizeof(url))) {
+    Serial.println("Error, too many sensors for the request URL");
+    return false;
+  }
+  Serial.print(provider.Name());
+  Serial.print(" request URL = ");
+  Serial.println(url);
+
+  unsigned long start = millis();
+  // Send request
+  http.useHTTP10(true);
+  http.begin(client, url);
+  if (provider.ApiKey() != nullptr) {
+    http.addHeader("X-API-Key", provider.ApiKey());
+  }
+  http.GET();
+  Serial.print("Retrieve data time (ms) = ");
+  Serial.println(millis() - start);
+
+  start = millis();
+  StreamSource source(http.getStream());
+  size_t count = provider.Parse(source, *this);
+  Serial.print("Parse of ");
+  Serial.print(parseBytes_);
+  Serial.print(" bytes (ms) = ");
+  Serial.println(millis() - start);
+  Serial.print("Parse memory (bytes) = ");
+  Serial.println(parseMemory_);
+  if (count == 0) {
+    Serial.println("Error, no sensor data in the response");
+  }
+  return (count > 0);
+}
+
+void AirSensorsBase::PrintSensorData(const SensorData &data) {
+  Serial.print("Sensor # ");
+  Serial.println(data.id);
+  Serial.print("  timestamp =   ");
+  Serial.println(data.timestamp);
+  Serial.print("  age_A (min) = ");
+  Serial.println(data.age_A);
+  Serial.print("  age_B (min) = ");
+  Serial.println(data.age_B);
+  Serial.print("  pm_2_5_A =    ");
+  Serial.println(data.pm_2_5_A);
+  Serial.print("  pm_2_5_B =    ");
+  Serial.println(data.pm_2_5_B);
+  Serial.print("  temperature = ");
+  Serial.println(data.temperature);
+  Serial.print("  humidity =    ");
+  Serial.println(data.humidity);
+  Serial.print("  pressure =    ");
+  Serial.println(data.pressure);
+  Serial.print("  stats = [ ");
+  for (short i = 0; i < PmAvgIndexes::PmAvgSize; i++) {
+    if ( i > 0 ) {
+      Serial.print(" | ");
+    }
+    Serial.print(data.averages[i]);
+  }
+  Serial.print(" ] v = ");
+  Serial.print(data.statsValue);
+  Serial.print(" @ ");
+  Serial.println(data.statsTimestamp);
+}
+
+#endif
@@ -4,54 +4,57 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+#include "byte_source.h"
+#include "purple_air_parser.h"
+#include "sensor_data.h"
+
 class WiFiClient;
 class HTTPClient;
+class SensorsProvider;
 
-const size_t kMaxSensors = 8;
+// The ArduinoJson parser is built where the library is available: always on
+// the target, and on native when AAQIM_ARDUINOJSON is defined (see the native
+// env of platformio.ini)
+#if defined(ARDUINO) && !defined(AAQIM_ARDUINOJSON)
+#define AAQIM_ARDUINOJSON
+#endif
 
 // Purple air sensors ID by priority.
 static const size_t kSensorIds[] = {59927, 65489, 67415, 25301, 54857, 36667};
 
-enum PmAvgIndexes {
-  TenMinutes,
-  ThirtyMinutes,
-  OneHour,
-  SixHours,
-  TwentyFourHours,
-  OneWeek,
-  PmAvgSize
-};
+/** Readings of a group of PurpleAir sensors, with the storage provided by
+ * AirSensorsGroup (capacity set at compile time).
+ *
+ * The data is in the order of AddSensor (the priority), and the records of the
+ * response are matched to their sensor by a binary search of the sorted ids.
+ */
+class AirSensorsBase {
+ public:
+  AirSensorsBase(const AirSensorsBase &) = delete;
+  AirSensorsBase &operator=(const AirSensorsBase &) = delete;
 
-struct SensorData {
-  size_t id;
-  uint32_t timestamp;
-  float pm_2_5_A;
-  float pm_2_5_B;
-  float pressure;
-  float averages[PmAvgIndexes::PmAvgSize];
-  int16_t age_A;
-  int16_t age_B;
-  int16_t temperature;
-  int16_t humidity;
-};
+  /** Add a sensor (its data is reset)
+   * @return false if the group is full, or the sensor already in it */
+  bool AddSensor(size_t sid);
 
-class AirSensors {
- public:
-  AirSensors() : sensorsCount_(0) {
-    noData_.id = 0;
-    noData_.timestamp = 0;
-  }
+  /** Leave a sensor out of the requests (see SensorReliability), its data
+   * is then empty. All the sensors are requested if they are all skipped.
+   * @return false for an unknown sensor */
+  bool SetSkipped(size_t sid, bool skipped);
 
-  bool AddSensor(size_t sid) {
-    if (sensorsCount_ < kMaxSensors) {
-      sensorIds_[sensorsCount_++] = sid;
-      return true;
-    }
-    return false;
-  }
+  bool IsSkipped(size_t sid) const;
 
+  /** Number of sensors not skipped */
+  size_t RequestedCount() const;
+
+  /** Request and parse the data of all the sensors (legacy PurpleAir API) */
   bool UpdateData(WiFiClient &client, HTTPClient &http);
 
+  /** Request and parse the data of all the sensors from a provider (the
+   * client has to support https if the provider requires it) */
+  bool UpdateData(WiFiClient &client, HTTPClient &http,
+                  const SensorsProvider &provider);
+
   void PrintAllData() {
     for (size_t index = 0; index < sensorsCount_; index++) {
       PrintSensorData(sensorsData_[index]);
@@ -70,24 +73,107 @@ class AirSensors {
 
   size_t Count() const { return sensorsCount_; }
 
- protected:
-  size_t GetSensorIndex(size_t sid) {
-    size_t index = SIZE_MAX;
-    for (size_t i = 0; i < sensorsCount_; i++) {
-      if (sensorIds_[i] == sid) {
-        index = i;
-        break;
-      }
-    }
-    return index;
+  size_t Capacity() const { return capacity_; }
+
+  /** Id of the sensor of the data at index (the data only has an id once
+   * a record of the sensor was received) */
+  size_t Id(size_t index) const;
+
+  /** Ids of the sensors, in increasing order (rank < Count()) */
+  size_t SortedId(size_t rank) const { return sortedIds_[rank]; }
+
+  /** Index of the data of a sensor
+   * @return SIZE_MAX for an unknown sensor */
+  size_t GetSensorIndex(size_t sid) const;
+
+  /** Store the data of a record of the response, if it belongs to one of
+   * the sensors (or to their B channel)
+   * @return false for an unknown or skipped sensor */
+  bool StoreRecord(const PurpleAirRecord &record);
+
+  /** Streaming parse of the response (see PurpleAirParser), read by chunks
+   * of kParseChunkSize bytes
+   * @return number of primary sensors updated */
+  size_t ParseSensors(ByteSource &source);
+
+  /** Streaming parse of a response of the PurpleAir API with selected
+   * fields (see PurpleAirFieldsParser)
+   * @return number of primary sensors updated */
+  size_t ParseSensorsFields(ByteSource &source);
+
+  /** Parse a complete response in memory */
+  size_t ParseSensors(const char *data, size_t size) {
+    MemorySource source(data, size);
+    return ParseSensors(source);
   }
 
-  size_t ParseSensors(HTTPClient &http);
+#if defined(AAQIM_ARDUINOJSON)
+  /** Parse of the response with ArduinoJson (20KB document)
+   * @return number of primary sensors updated */
+  size_t ParseSensorsDocument(ByteSource &source);
+#endif
+
+  /** Memory used by the last parse: parser and chunk buffer, or JSON
+   * documents */
+  size_t ParseMemory() const { return parseMemory_; }
+
+  /** Size of the last response parsed */
+  size_t ParseBytes() const { return parseBytes_; }
+
+  static const size_t kParseChunkSize = 64;
+
+ protected:
+  AirSensorsBase(size_t capacity, uint32_t *sortedIds, uint8_t *sortedIndexes,
+                 bool *skipped, SensorData *sensorsData)
+      : capacity_(capacity),
+        sensorsCount_(0),
+        sortedIds_(sortedIds),
+        sortedIndexes_(sortedIndexes),
+        skipped_(skipped),
+        sensorsData_(sensorsData),
+        parseMemory_(0),
+        parseBytes_(0) {
+    noData_.id = 0;
+    noData_.timestamp = 0;
+  }
 
+  const size_t capacity_;
   size_t sensorsCount_;
-  size_t sensorIds_[kMaxSensors];
+  uint32_t *sortedIds_;     /** ids of the sensors, in increasing order */
+  uint8_t *sortedIndexes_;  /** index of the data of each sorted id */
+  bool *skipped_;           /** by index of the data */
+  SensorData *sensorsData_;
   SensorData noData_;
-  SensorData sensorsData_[kMaxSensors];
+  template <typename PARSER>
+  size_t Parse(ByteSource &source);
+
+  /** Is the sensor of the data at index left out of the request? */
+  bool IsSkippedIndex(size_t index) const {
+    return skipped_[index] && RequestedCount() > 0;
+  }
+
+  size_t parseMemory_;
+  size_t parseBytes_;
+};
+
+/** Sensors group of up to CAPACITY sensors (255 at most) */
+template <size_t CAPACITY>
+class AirSensorsGroup : public AirSensorsBase {
+ public:
+  static_assert(CAPACITY > 0 && CAPACITY <= UINT8_MAX,
+                "The sensors are indexed with a byte");
+  static const size_t kCapacity = CAPACITY;
+
+  AirSensorsGroup()
+      : AirSensorsBase(CAPACITY, ids_, indexes_, skipped_, data_) {}
+
+ protected:
+  uint32_t ids_[CAPACITY];
+  uint8_t indexes_[CAPACITY];
+  bool skipped_[CAPACITY];
+  SensorData data_[CAPACITY];
 };
 
+typedef AirSensorsGroup<kMaxSensors> AirSensors;
+
 #endif
@@ -0,0 +1,82 @@
+#include "sensors_provider.h"
+
+#include <stdio.h>
+
+#include "purple_air_fields_parser.h"
+#include "sensors.h"
+
+// Uncomment to parse the legacy response with ArduinoJson (20KB document)
+// rather than PurpleAirParser
+// #define USE_ARDUINOJSON_PARSER
+
+static const char *kPurpleAirJsonUrl = "http://www.purpleair.com/json?show=";
+static const char *kPurpleAirApiUrl =
+    "https://api.purpleair.com/v1/sensors?fields=";
+
+/** Append text to the url
+ * @return false if it does not fit */
+static bool append(const char *text, char *url, size_t capacity,
+                   size_t &length) {
+  int written = snprintf(url + length, capacity - length, "%s", text);
+  if (written < 0 || (size_t)(written) >= capacity - length) {
+    return false;
+  }
+  length += written;
+  return true;
+}
+
+/** Append the ids of the sensors to the url (but the skipped ones) */
+static bool append_ids(const AirSensorsBase &sensors, const char *separator,
+                       char *url, size_t capacity, size_t &length) {
+  bool first = true;
+  for (size_t rank = 0; rank < sensors.Count(); rank++) {
+    if (sensors.IsSkipped(sensors.SortedId(rank))) {
+      continue;
+    }
+    char id[16];
+    snprintf(id, sizeof(id), "%u", (unsigned)(sensors.SortedId(rank)));
+    if ((!first && !append(separator, url, capacity, length)) ||
+        !append(id, url, capacity, length)) {
+      return false;
+    }
+    first = false;
+  }
+  return true;
+}
+
+bool PurpleAirJsonProvider::RequestUrl(const AirSensorsBase &sensors,
+                                       char *url, size_t capacity) const {
+  size_t length = 0;
+  return append(kPurpleAirJsonUrl, url, capacity, length) &&
+         append_ids(sensors, "|", url, capacity, length);
+}
+
+size_t PurpleAirJsonProvider::Parse(ByteSource &source,
+                                    AirSensorsBase &sensors) const {
+#if defined(USE_ARDUINOJSON_PARSER)
+  return sensors.ParseSensorsDocument(source);
+#else
+  return sensors.ParseSensors(source);
+#endif
+}
+
+bool PurpleAirApiProvider::RequestUrl(const AirSensorsBase &sensors,
+                                      char *url, size_t capacity) const {
+  size_t length = 0;
+  if (!append(kPurpleAirApiUrl, url, capacity, length)) {
+    return false;
+  }
+  for (uint8_t f = 0; f < static_cast<uint8_t>(ApiField::Count); f++) {
+    if ((f > 0 && !append(",", url, capacity, length)) ||
+        !append(ApiFieldNames[f], url, capacity, length)) {
+      return false;
+    }
+  }
+  return append("&show_only=", url, capacity, length) &&
+         append_ids(sensors, ",", url, capacity, length);
+}
+
+size_t PurpleAirApiProvider::Parse(ByteSource &source,
+                                   AirSensorsBase &sensors) const {
+  return sensors.ParseSensorsFields(source);
+}
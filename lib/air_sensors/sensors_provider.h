@@ -0,0 +1,60 @@
+#ifndef AAQIM_SENSORS_PROVIDER_H
+#define AAQIM_SENSORS_PROVIDER_H
+
+#include <stddef.h>
+
+#include "byte_source.h"
+
+class AirSensorsBase;
+
+/** Room for the ids of ~60 sensors in a request */
+const size_t kMaxUrlLength = 640;
+
+/** Web service providing the data of the sensors: builds the request of all
+ * the sensors of a group, and parses the response.
+ */
+class SensorsProvider {
+ public:
+  virtual const char *Name() const = 0;
+
+  /** URL of the request of the sensors of the group (but the skipped ones)
+   * @return false if it does not fit in capacity */
+  virtual bool RequestUrl(const AirSensorsBase &sensors, char *url,
+                          size_t capacity) const = 0;
+
+  /** Key of the API, sent in the X-API-Key header (nullptr if none) */
+  virtual const char *ApiKey() const { return nullptr; }
+
+  /** Parse the response into the data of the sensors
+   * @return number of primary sensors updated */
+  virtual size_t Parse(ByteSource &source, AirSensorsBase &sensors) const = 0;
+};
+
+/** Legacy PurpleAir API (`json?show=`): the ~60 fields of each channel of
+ * each sensor (~19KB for 8 sensors) */
+class PurpleAirJsonProvider : public SensorsProvider {
+ public:
+  const char *Name() const override { return "PurpleAir json"; }
+  bool RequestUrl(const AirSensorsBase &sensors, char *url,
+                  size_t capacity) const override;
+  size_t Parse(ByteSource &source, AirSensorsBase &sensors) const override;
+};
+
+/** PurpleAir API (`v1/sensors`) requesting only the fields used by the
+ * monitor (see ApiField), one array of values per sensor (~1KB for 8
+ * sensors). It requires an API key, and https. */
+class PurpleAirApiProvider : public SensorsProvider {
+ public:
+  explicit PurpleAirApiProvider(const char *apiKey) : apiKey_(apiKey) {}
+
+  const char *Name() const override { return "PurpleAir API"; }
+  bool RequestUrl(const AirSensorsBase &sensors, char *url,
+                  size_t capacity) const override;
+  const char *ApiKey() const override { return apiKey_; }
+  size_t Parse(ByteSource &source, AirSensorsBase &sensors) const override;
+
+ protected:
+  const char *apiKey_;
+};
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef AAQIM_SITES_PARSER_H
+#define AAQIM_SITES_PARSER_H
+
+#include "purple_air_parser.h"
+#include "sensors_grid.h"
+
+/**
+ * Collects the location of the outdoor sensors of a legacy PurpleAir response
+ * (the primary records), to build a SensorsGrid. The child records (channel B)
+ * share the location of their parent, and are skipped.
+ */
+class SitesParser : public PurpleAirParser {
+ public:
+  SitesParser(SensorSite sites[], size_t capacity)
+      : sites_(sites), capacity_(capacity), count_(0) {}
+
+  void Reset() override {
+    PurpleAirParser::Reset();
+    count_ = 0;
+  }
+
+  /** Number of outdoor sites collected */
+  size_t Count() const { return count_; }
+
+ protected:
+  void OnRecord(const PurpleAirRecord &record) override {
+    if (record.parentId != 0 || !record.outside || count_ >= capacity_) {
+      return;
+    }
+    SensorSite &site = sites_[count_++];
+    site.id = (uint32_t)(record.id);
+    site.latitude = record.latitude;
+    site.longitude = record.longitude;
+  }
+
+  SensorSite *sites_;
+  size_t capacity_;
+  size_t count_;
+};
+
+#endif
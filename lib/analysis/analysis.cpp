@@ -0,0 +1,94 @@
+#include "analysis.h"
+
+const char *RejectionNames[] = {"None", "Age", "Consistency", "Outlier",
+                                "Distance"};
+
+Rejection AgeFilter::Check(const SensorData &data, float &weight) const {
+  if (data.timestamp == 0) {
+    // not in the response
+    return Rejection::Age;
+  }
+  int16_t age = (data.age_A > data.age_B) ? data.age_A : data.age_B;
+  if (age > maxAgeMinutes_) {
+    return Rejection::Age;
+  }
+  if (halfWeightMinutes_ > 0.0f) {
+    weight *= halfWeightMinutes_ / (halfWeightMinutes_ + (float)(age));
+  }
+  return Rejection::None;
+}
+
+Rejection ConsistencyFilter::Check(const SensorData &data,
+                                   float &weight) const {
+  float diff = fabsf(data.pm_2_5_A - data.pm_2_5_B);
+  float sum = data.pm_2_5_A + data.pm_2_5_B;
+  float maxDiff = maxDiscrepancy_;
+  if (sum >= 2.0f * threshold_) {
+    maxDiff = 2.0f * maxPercent_ * sum;
+  }
+  if (diff > maxDiff) {
+    return Rejection::Consistency;
+  }
+  if (weighted_) {
+    weight *= 1.0f - 0.5f * diff / maxDiff;
+  }
+  return Rejection::None;
+}
+
+Rejection DistanceFilter::Check(const SensorData &data, float &weight) const {
+  for (size_t i = 0; i < count_; i++) {
+    if (neighbors_[i].id == data.id) {
+      float distance = neighbors_[i].distance;
+      if (distance > minDistance_) {
+        weight *= powf(minDistance_ / distance, power_);
+      }
+      return Rejection::None;
+    }
+  }
+  return Rejection::Distance;
+}
+
+bool SensorAnalysis::AddFilter(const SensorFilter &filter) {
+  if (filtersCount_ >= kMaxFilters) {
+    return false;
+  }
+  filters_[filtersCount_++] = &filter;
+  return true;
+}
+
+Rejection SensorAnalysis::Filter(const SensorData &data,
+                                 float &weight) const {
+  Rejection rejection = Rejection::None;
+  for (size_t f = 0; f < filtersCount_ && rejection == Rejection::None; f++) {
+    rejection = filters_[f]->Check(data, weight);
+  }
+  return rejection;
+}
+
+size_t SensorAnalysis::Conclude(const SensorData sensors[], const bool kept[],
+                                AirSample &sample,
+                                AnalysisDiagnostics &diagnostics) const {
+  for (size_t i = 0; i < diagnostics.sensorsCount; i++) {
+    if (kept[i]) {
+      if (diagnostics.primaryIndex < 0) {
+        diagnostics.primaryIndex = i;
+      }
+      diagnostics.keptCount++;
+    } else if (diagnostics.rejections[i] == Rejection::None) {
+      diagnostics.rejections[i] = Rejection::Outlier;
+    }
+  }
+
+  if (diagnostics.primaryIndex < 0) {
+    // only with a rejection threshold below the MAD
+    sample.Set(0, 0.0f, 0.0f, 0.0f, 0.0f, 0, 0, 0, 0);
+    return 0;
+  }
+  const SensorData &primary = sensors[diagnostics.primaryIndex];
+  const FusionResult &fused = diagnostics.fusion;
+  // Just forget about pm_1_0 and pm_10_0 for now
+  sample.Set(primary.timestamp, 0.0, fused.mean, 0.0, primary.pressure,
+             primary.temperature, primary.humidity, diagnostics.keptCount,
+             fused.mae);
+  return diagnostics.keptCount;
+}
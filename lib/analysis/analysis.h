@@ -0,0 +1,282 @@
+#ifndef AAQIM_ANALYSIS_H
+#define AAQIM_ANALYSIS_H
+
+#include <stdio.h>
+
+#include "aaqim_debug.h"
+#include "air_sample.h"
+#include "robust_stats.h"
+#include "sensor_data.h"
+#include "sensors_grid.h"
+#include "stats.h"
+
+// PA sensors seem to be updated every two minutes.
+// We consider the sensor valid even if we miss three beats
+const int16_t kMaxReadingAgeMinutes = 7;
+
+const float kMaxPercentDiscrepancy = 0.08f;
+const float kMaxConcentrationDiscrepancy = 8.0f;
+const float kConcentrationConsistencyThreshold = 100.0f;
+
+// Sensors further than 3 sigmas (estimated from the MAD) from the median are
+// rejected, sigma being at least 1 ug/m3 (sensors reading the same values)
+const float kFusionRejectionSigmas = 3.0f;
+const float kFusionMinSigma = 1.0f;
+// Weight of a reading kAgeHalfWeightMinutes old, relative to a fresh one
+const float kAgeHalfWeightMinutes = 5.0f;
+// Inverse distance weighting: 1 / d^2, the sensors closer than 500m having
+// the full weight
+const float kIdwPower = 2.0f;
+const float kIdwMinDistanceMeters = 500.0f;
+
+/** Why a sensor was left out of the sample */
+enum class Rejection : uint8_t {
+  None = 0,
+  Age,
+  Consistency,
+  Outlier,
+  Distance
+};
+
+extern const char *RejectionNames[];
+
+/**
+ * Stage of the analysis checking each sensor on its own: it rejects the
+ * sensor, or adjusts its weight in the fusion.
+ */
+class SensorFilter {
+ public:
+  virtual ~SensorFilter() {}
+
+  /**
+   * @param weight of the sensor in the fusion (1 before the first filter),
+   *               to scale by the filter if needed
+   * @return Rejection::None to keep the sensor
+   */
+  virtual Rejection Check(const SensorData &data, float &weight) const = 0;
+};
+
+/** Rejects the readings too old (missed beats) */
+class AgeFilter : public SensorFilter {
+ public:
+  /** @param halfWeightMinutes age at which the weight is halved, 0 to not
+   * weight the sensors by age */
+  explicit AgeFilter(int16_t maxAgeMinutes = kMaxReadingAgeMinutes,
+                     float halfWeightMinutes = 0.0f)
+      : maxAgeMinutes_(maxAgeMinutes), halfWeightMinutes_(halfWeightMinutes) {}
+
+  Rejection Check(const SensorData &data, float &weight) const override;
+
+ protected:
+  int16_t maxAgeMinutes_;
+  float halfWeightMinutes_;
+};
+
+/** Rejects the sensors whose A and B channels disagree: by more than an
+ * absolute discrepancy below the threshold concentration, by more than a
+ * percentage above. */
+class ConsistencyFilter : public SensorFilter {
+ public:
+  /** @param weighted weight the sensors from 1 (A = B) to 0.5 (at the limit
+   * of the discrepancy) */
+  explicit ConsistencyFilter(bool weighted = false,
+                             float maxDiscrepancy = kMaxConcentrationDiscrepancy,
+                             float maxPercent = kMaxPercentDiscrepancy,
+                             float threshold = kConcentrationConsistencyThreshold)
+      : weighted_(weighted),
+        maxDiscrepancy_(maxDiscrepancy),
+        maxPercent_(maxPercent),
+        threshold_(threshold) {}
+
+  Rejection Check(const SensorData &data, float &weight) const override;
+
+ protected:
+  bool weighted_;
+  float maxDiscrepancy_;
+  float maxPercent_;
+  float threshold_;
+};
+
+/** Weights the sensors by the inverse of their distance to the monitor, and
+ * rejects the sensors which are not among its neighbors (too far, or not
+ * outdoor). */
+class DistanceFilter : public SensorFilter {
+ public:
+  /** @param neighbors sensors around the monitor (see SensorsGrid::Nearest),
+   *                  not copied */
+  DistanceFilter(const Neighbor neighbors[], size_t count,
+                 float power = kIdwPower,
+                 float minDistance = kIdwMinDistanceMeters)
+      : neighbors_(neighbors),
+        count_(count),
+        power_(power),
+        minDistance_(minDistance) {}
+
+  Rejection Check(const SensorData &data, float &weight) const override;
+
+ protected:
+  const Neighbor *neighbors_;
+  size_t count_;
+  float power_;
+  float minDistance_;
+};
+
+/** Details of an analysis, for the logs and the tests: the rejections are
+ * stored by GroupDiagnostics */
+struct AnalysisDiagnostics {
+  AnalysisDiagnostics(const AnalysisDiagnostics &) = delete;
+  AnalysisDiagnostics &operator=(const AnalysisDiagnostics &) = delete;
+
+  size_t sensorsCount;   // sensors analyzed
+  size_t keptCount;      // sensors used in the sample
+  int32_t primaryIndex;  // first sensor kept, -1 if none
+  Rejection *rejections; // of each sensor analyzed
+  FusionResult fusion;
+  float stdDev;  // spread of the values left by the filters (before the
+  float min;     // outliers rejection)
+  float max;
+
+ protected:
+  explicit AnalysisDiagnostics(Rejection *rejections)
+      : sensorsCount(0),
+        keptCount(0),
+        primaryIndex(-1),
+        rejections(rejections),
+        fusion(),
+        stdDev(0.0f),
+        min(0.0f),
+        max(0.0f) {}
+};
+
+/** Diagnostics of the analysis of up to CAPACITY sensors */
+template <size_t CAPACITY>
+struct GroupDiagnostics : public AnalysisDiagnostics {
+  static const size_t kCapacity = CAPACITY;
+
+  GroupDiagnostics() : AnalysisDiagnostics(rejections_) {}
+
+ protected:
+  Rejection rejections_[CAPACITY] = {};
+};
+
+/**
+ * Fusion of the readings of a group of sensors into an AirSample: each sensor
+ * goes through the filters (in the order they were added), then the values
+ * of the sensors left are fused by SensorFusion, which rejects the outliers.
+ *
+ * The filters are not copied, they have to outlive the analysis.
+ */
+class SensorAnalysis {
+ public:
+  static const size_t kMaxFilters = 4;
+
+  SensorAnalysis()
+      : filtersCount_(0),
+        sigmas_(kFusionRejectionSigmas),
+        minSigma_(kFusionMinSigma),
+        realTime_(false) {}
+
+  /** @return false if there are already kMaxFilters filters */
+  bool AddFilter(const SensorFilter &filter);
+
+  /** @param sigmas rejection threshold, 0 to average all the sensors left by
+   * the filters (see SensorFusion::Fuse) */
+  void SetOutlierRejection(float sigmas, float minSigma = kFusionMinSigma) {
+    sigmas_ = sigmas;
+    minSigma_ = minSigma;
+  }
+
+  /** Use the real time A and B concentrations, rather than the 10 minutes
+   * averages computed by the sensors */
+  void UseRealTime(bool realTime) { realTime_ = realTime; }
+
+  /**
+   * @param sensors readings of the sensors, by priority (the first sensor
+   *                kept provides the timestamp, temperature...)
+   * @param count at most CAPACITY, nothing is analyzed beyond
+   * @param sample pm2.5 concentration and MAE of the sensors kept, timestamp
+   *               and weather of the primary sensor
+   * @return number of sensors used in the sample (0 if none, and the sample
+   *         is reset)
+   */
+  template <size_t CAPACITY>
+  size_t Analyze(const SensorData sensors[], size_t count, AirSample &sample,
+                 GroupDiagnostics<CAPACITY> &diagnostics) const;
+
+ protected:
+  /** Run the filters on a sensor
+   * @param weight of the sensor in the fusion, set by the filters */
+  Rejection Filter(const SensorData &data, float &weight) const;
+
+  /** Set the sample from the sensors kept by the fusion, and the sensors
+   * rejected as outliers in the diagnostics
+   * @param kept of each sensor analyzed */
+  size_t Conclude(const SensorData sensors[], const bool kept[],
+                  AirSample &sample, AnalysisDiagnostics &diagnostics) const;
+
+  const SensorFilter *filters_[kMaxFilters];
+  size_t filtersCount_;
+  float sigmas_;
+  float minSigma_;
+  bool realTime_;
+};
+
+template <size_t CAPACITY>
+size_t SensorAnalysis::Analyze(const SensorData sensors[], size_t count,
+                               AirSample &sample,
+                               GroupDiagnostics<CAPACITY> &diagnostics) const {
+  diagnostics.sensorsCount = count;
+  diagnostics.keptCount = 0;
+  diagnostics.primaryIndex = -1;
+  if (count > CAPACITY) {
+    dbg_printf("Cannot analyze %u sensors (%u at most)\n", (unsigned)count,
+               (unsigned)CAPACITY);
+    diagnostics.sensorsCount = 0;
+    sample.Set(0, 0.0f, 0.0f, 0.0f, 0.0f, 0, 0, 0, 0);
+    return 0;
+  }
+
+  // two values per sensor with the real time A and B channels
+  const size_t valuesPerSensor = realTime_ ? 2 : 1;
+  SensorFusion<2 * CAPACITY> fusion;
+  size_t sensorIndexes[2 * CAPACITY];
+  StatsAccumulator<float> stats;
+  for (size_t i = 0; i < count; i++) {
+    const SensorData &data = sensors[i];
+    float weight = 1.0f;
+    Rejection rejection = Filter(data, weight);
+    diagnostics.rejections[i] = rejection;
+    if (rejection != Rejection::None) {
+      continue;
+    }
+
+    const float realTime[] = {data.pm_2_5_A, data.pm_2_5_B};
+    const float *values =
+        realTime_ ? realTime
+                  : &data.averages[static_cast<int>(PmAvgIndexes::TenMinutes)];
+    for (size_t v = 0; v < valuesPerSensor; v++) {
+      sensorIndexes[fusion.Count()] = i;
+      fusion.Add(values[v], weight);
+      stats.Add(values[v]);
+    }
+  }
+  diagnostics.stdDev = stats.StdDev();
+  diagnostics.min = stats.Min();
+  diagnostics.max = stats.Max();
+
+  bool keptValues[2 * CAPACITY];
+  if (!fusion.Fuse(sigmas_, minSigma_, diagnostics.fusion, keptValues)) {
+    sample.Set(0, 0.0f, 0.0f, 0.0f, 0.0f, 0, 0, 0, 0);
+    return 0;
+  }
+  // with the real time values, a sensor is kept if A or B is kept
+  bool kept[CAPACITY] = {};
+  for (size_t v = 0; v < fusion.Count(); v++) {
+    if (keptValues[v]) {
+      kept[sensorIndexes[v]] = true;
+    }
+  }
+  return Conclude(sensors, kept, sample, diagnostics);
+}
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef AAQIM_SENSOR_DATA_H
+#define AAQIM_SENSOR_DATA_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+const size_t kMaxSensors = 8;
+
+enum PmAvgIndexes {
+  TenMinutes,
+  ThirtyMinutes,
+  OneHour,
+  SixHours,
+  TwentyFourHours,
+  OneWeek,
+  PmAvgSize
+};
+
+/** Readings of a PurpleAir sensor (A and B channels) */
+struct SensorData {
+  size_t id;
+  uint32_t timestamp;
+  float pm_2_5_A;
+  float pm_2_5_B;
+  float pressure;
+  float averages[PmAvgIndexes::PmAvgSize];  // Stats v1 to v6
+  float statsValue;         // Stats v: real time value when computed
+  uint32_t statsTimestamp;  // Stats lastModified (seconds)
+  int16_t age_A;
+  int16_t age_B;
+  int16_t temperature;
+  int16_t humidity;
+};
+
+#endif
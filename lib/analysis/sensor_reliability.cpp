@@ -0,0 +1,152 @@
+#include "sensor_reliability.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "aaqim_debug.h"
+#include "crc8_functions.h"
+
+bool SensorReliability::IsReliable(const SensorScore &score) const {
+  return score.rejections < kUnreliableRejections &&
+         score.error <= kUnreliableScore;
+}
+
+bool SensorReliability::ShouldRequest(uint32_t id) {
+  SensorScore &score = Get(id);
+  if (IsReliable(score) || score.skipped + 1 >= kUnreliableProbeWakes) {
+    score.skipped = 0;
+    return true;
+  }
+  score.skipped++;
+  return false;
+}
+
+void SensorReliability::SetRequested(uint32_t id) {
+  SensorScore *score = Find(id);
+  if (score != nullptr) {
+    score->skipped = 0;
+  }
+}
+
+void SensorReliability::Update(const uint32_t ids[],
+                               const SensorData sensors[], size_t count,
+                               const AnalysisDiagnostics &diagnostics,
+                               uint32_t now) {
+  if (count > diagnostics.sensorsCount) {
+    count = diagnostics.sensorsCount;
+  }
+  const float consensus = diagnostics.fusion.mean;
+  const float limit = (consensus >= kConcentrationConsistencyThreshold)
+                          ? kUnreliablePercent * consensus
+                          : kUnreliableError;
+  for (size_t i = 0; i < count; i++) {
+    SensorScore *score = Find(ids[i]);
+    if (score == nullptr || score->skipped != 0) {
+      continue;
+    }
+    Rejection rejection = diagnostics.rejections[i];
+    const bool recovering = !IsReliable(*score);
+    if (rejection == Rejection::None) {
+      score->rejections = 0;
+      score->lastGood = now;
+    } else if (score->rejections < UINT8_MAX) {
+      score->rejections++;
+    }
+    // the distance to the consensus, when the sensor has a recent reading
+    if (diagnostics.keptCount > 0 && sensors[i].timestamp != 0 &&
+        rejection != Rejection::Age) {
+      float distance = fabsf(
+          sensors[i].averages[static_cast<int>(PmAvgIndexes::TenMinutes)] -
+          consensus);
+      float relative = kUnreliableScore * distance / limit;
+      int32_t error = (relative < UINT16_MAX) ? (int32_t)(relative)
+                                              : UINT16_MAX;
+      if (recovering && rejection == Rejection::None) {
+        // a probe kept: the history of the sensor no longer matters
+        score->error = (uint16_t)(error);
+      } else {
+        // exponential moving average, 1/8 of the new distance: a single
+        // reading 8 times the limit away is not enough to skip a sensor
+        score->error = (uint16_t)(score->error +
+                                  (error - (int32_t)(score->error)) / 8);
+      }
+    }
+  }
+}
+
+const SensorScore *SensorReliability::Score(uint32_t id) const {
+  for (size_t i = 0; i < count_; i++) {
+    if (scores_[i].id == id) {
+      return &scores_[i];
+    }
+  }
+  return nullptr;
+}
+
+SensorScore *SensorReliability::Find(uint32_t id) {
+  return const_cast<SensorScore *>(
+      static_cast<const SensorReliability *>(this)->Score(id));
+}
+
+SensorScore &SensorReliability::Get(uint32_t id) {
+  SensorScore *score = Find(id);
+  if (score != nullptr) {
+    return *score;
+  }
+  size_t index = count_;
+  if (count_ < capacity_) {
+    count_++;
+  } else {
+    index = 0;
+    for (size_t i = 1; i < count_; i++) {
+      if (scores_[i].lastGood < scores_[index].lastGood) {
+        index = i;
+      }
+    }
+  }
+  memset(&scores_[index], 0, sizeof(SensorScore));
+  scores_[index].id = id;
+  return scores_[index];
+}
+
+void SensorReliability::Reset() {
+  memset(state_, 0, StateWords(capacity_) * 4);
+  count_ = 0;
+}
+
+bool SensorReliability::Load(AbstractStore &store, uint32_t offset) {
+  const size_t size = StateWords(capacity_) * 4;
+  if (store.Capacity() < offset + size || !store.Read(offset, state_, size)) {
+    Reset();
+    return false;
+  }
+  ReliabilityState *state = (ReliabilityState *)(state_);
+  uint8_t crc = state->crc;
+  state->crc = 0;
+  if (state->magic != kReliabilityStateMagic ||
+      state->version != kReliabilityStateVersion ||
+      crc != crc8_maxim((const uint8_t *)(state_), size)) {
+    Reset();
+    return false;
+  }
+  count_ = 0;
+  while (count_ < capacity_ && scores_[count_].id != 0) {
+    count_++;
+  }
+  return true;
+}
+
+bool SensorReliability::Save(AbstractStore &store, uint32_t offset) {
+  const size_t size = StateWords(capacity_) * 4;
+  ReliabilityState *state = (ReliabilityState *)(state_);
+  state->magic = kReliabilityStateMagic;
+  state->version = kReliabilityStateVersion;
+  state->crc = 0;
+  state->crc = crc8_maxim((const uint8_t *)(state_), size);
+  if (store.Capacity() < offset + size || !store.Write(offset, state_, size)) {
+    dbg_printf("Cannot save the sensors reliability\n");
+    return false;
+  }
+  return true;
+}
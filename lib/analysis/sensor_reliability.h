@@ -0,0 +1,129 @@
+#ifndef AAQIM_SENSOR_RELIABILITY_H
+#define AAQIM_SENSOR_RELIABILITY_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "abstract_store.h"
+#include "analysis.h"
+
+const uint16_t kReliabilityStateMagic = 0x5E11;
+const uint8_t kReliabilityStateVersion = 2;
+
+// A sensor rejected at 6 consecutive wake ups (30 minutes), or further from
+// the consensus on average than 10 ug/m3 below the consistency threshold, or
+// than 10% of the consensus above (like ConsistencyFilter), is no longer
+// requested...
+const uint8_t kUnreliableRejections = 6;
+const float kUnreliableError = 10.0f;
+const float kUnreliablePercent = 0.10f;
+// ...but for a probe every 12 wake ups (every hour)
+const uint8_t kUnreliableProbeWakes = 12;
+// SensorScore::error of a sensor at the limit distance on average
+const uint16_t kUnreliableScore = 256;
+
+/** History of a sensor, kept between two wake ups (12 bytes) */
+struct SensorScore {
+  uint32_t id;
+  uint32_t lastGood;   /** timestamp of the last sample the sensor was kept */
+  uint16_t error;      /** moving average of the distance to the consensus,
+                           relative to the limit (kUnreliableScore) */
+  uint8_t rejections;  /** consecutive rejections */
+  uint8_t skipped;     /** wake ups since the sensor was last requested */
+};
+
+/**
+ * Reliability of the sensors across wake ups: the sensors chronically
+ * rejected by the analysis, or away from the consensus, are left out of the
+ * requests (see AirSensorsBase::SetSkipped), which saves the bytes of their
+ * response and their parse. They are requested again every
+ * kUnreliableProbeWakes wake ups, and recover as soon as a probe is kept
+ * close enough to the consensus.
+ *
+ * The table is provided by SensorReliabilityTable, sized like the group of
+ * sensors. Its state is kept as is in persistent memory (see Load and Save).
+ */
+class SensorReliability {
+ public:
+  /** Decide if a sensor is requested at this wake up (to call once per wake
+   * up and sensor, before Update) */
+  bool ShouldRequest(uint32_t id);
+
+  /** The sensor is requested at this wake up even though ShouldRequest
+   * returned false (all the sensors of the group were left out, see
+   * AirSensorsBase::SetSkipped): it is scored by Update like the others */
+  void SetRequested(uint32_t id);
+
+  /** Score the sensors from an analysis (the sensors which were not
+   * requested are left unchanged)
+   * @param ids of the analyzed sensors (their data has no id when they were
+   *            not in the response)
+   * @param now timestamp of the sample */
+  void Update(const uint32_t ids[], const SensorData sensors[], size_t count,
+              const AnalysisDiagnostics &diagnostics, uint32_t now);
+
+  bool IsReliable(const SensorScore &score) const;
+
+  /** Score of a sensor, nullptr if unknown */
+  const SensorScore *Score(uint32_t id) const;
+
+  size_t Count() const { return count_; }
+
+  size_t Capacity() const { return capacity_; }
+
+  /** Forget all the scores */
+  void Reset();
+
+  /** @return false if there is no valid state at offset (the scores are
+   * reset) */
+  bool Load(AbstractStore &store, uint32_t offset);
+  bool Save(AbstractStore &store, uint32_t offset);
+
+ protected:
+  struct ReliabilityState {
+    uint16_t magic;
+    uint8_t version;
+    uint8_t crc; /** crc8 of the state and scores, computed with crc = 0 */
+  };
+
+  static constexpr size_t StateWords(size_t capacity) {
+    return (sizeof(ReliabilityState) + capacity * sizeof(SensorScore) + 3) /
+           4;
+  }
+
+  /** @param state buffer of StateWords(capacity) words, the state followed
+   *              by the scores */
+  SensorReliability(size_t capacity, uint32_t *state)
+      : capacity_(capacity),
+        state_(state),
+        scores_((SensorScore *)(state + sizeof(ReliabilityState) / 4)),
+        count_(0) {}
+
+  SensorScore *Find(uint32_t id);
+
+  /** Score of a sensor, a new one replacing the least recently kept sensor
+   * if the table is full */
+  SensorScore &Get(uint32_t id);
+
+  const size_t capacity_;
+  uint32_t *state_;
+  SensorScore *scores_;
+  size_t count_;
+};
+
+/** Scores of up to CAPACITY sensors (12 bytes each, plus 4 bytes of state) */
+template <size_t CAPACITY>
+class SensorReliabilityTable : public SensorReliability {
+ public:
+  static_assert(CAPACITY > 0, "The table holds at least one sensor");
+
+  SensorReliabilityTable() : SensorReliability(CAPACITY, words_) { Reset(); }
+
+  /** Bytes used in the persistent memory */
+  static constexpr size_t StateSize() { return sizeof(words_); }
+
+ protected:
+  uint32_t words_[StateWords(CAPACITY)];
+};
+
+#endif
@@ -0,0 +1,243 @@
+#ifndef AAQIM_SENSORS_GRID_H
+#define AAQIM_SENSORS_GRID_H
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "abstract_flash.h"
+
+#if defined(ARDUINO)
+#include <spi_flash.h>
+#else
+#include "sim_flash.h"
+#endif
+
+/** Location of an (outdoor) sensor */
+struct SensorSite {
+  uint32_t id;
+  float latitude;  // degrees
+  float longitude;
+};
+
+/** Result of a nearest sensors query */
+struct Neighbor {
+  uint32_t id;
+  float distance;  // meters
+};
+
+const float kEarthRadiusMeters = 6371000.0f;
+
+/** Distance in meters with the equirectangular approximation (less than 0.1%
+ * of error up to ~100km, which is far beyond the range of the sensors) */
+inline float site_distance(float latitude1, float longitude1, float latitude2,
+                           float longitude2) {
+  const float kRadians = (float)(M_PI) / 180.0f;
+  float x = (longitude2 - longitude1) * kRadians *
+            cosf((latitude1 + latitude2) * 0.5f * kRadians);
+  float y = (latitude2 - latitude1) * kRadians;
+  return kEarthRadiusMeters * sqrtf(x * x + y * y);
+}
+
+/**
+ * Grid index of the sites of up to CAPACITY sensors: the bounding box of the
+ * sites is divided in GRID_SIZE x GRID_SIZE cells, and the sites are sorted
+ * by cell, each cell being a range of the sites array (CSR layout). A query
+ * only visits the cells overlapping the search radius.
+ *
+ * The index is plain data in two flat arrays, without pointers: it can be
+ * written to flash and read back as is (see Save and Load).
+ */
+template <size_t CAPACITY, size_t GRID_SIZE = 32>
+class SensorsGrid {
+ public:
+  static_assert(CAPACITY < UINT16_MAX, "The cells ranges are 16 bits");
+
+  static const size_t kCells = GRID_SIZE * GRID_SIZE;
+
+  SensorsGrid() : magic_(0), count_(0) {}
+
+  /** Build the index (the sites beyond the capacity are ignored) */
+  void Build(const SensorSite sites[], size_t count);
+
+  bool IsValid() const { return magic_ == kMagic && count_ <= CAPACITY; }
+
+  size_t Count() const { return count_; }
+
+  /**
+   * The k nearest sensors within a radius
+   * @param neighbors filled by increasing distance (k entries)
+   * @param examined optional, incremented by the number of sites whose
+   *                 distance was computed (the cost of the query)
+   * @return number of neighbors found (up to k)
+   */
+  size_t Nearest(float latitude, float longitude, float radiusMeters, size_t k,
+                 Neighbor neighbors[], size_t *examined = nullptr) const;
+
+  /** Write the index in flash, from the start of a sector (the sectors are
+   * erased first) */
+  bool Save(AbstractFlash &flash, uint32_t offset) const;
+
+  /** Read an index written by Save
+   * @return false if there is no valid index at offset */
+  bool Load(AbstractFlash &flash, uint32_t offset);
+
+ protected:
+  static const uint32_t kMagic = 0x47524431;  // "GRD1"
+
+  size_t CellIndex(float latitude, float longitude) const {
+    return Row(latitude) * GRID_SIZE + Column(longitude);
+  }
+
+  size_t Row(float latitude) const {
+    return Clamp((latitude - minLatitude_) / cellLatitude_);
+  }
+
+  size_t Column(float longitude) const {
+    return Clamp((longitude - minLongitude_) / cellLongitude_);
+  }
+
+  static size_t Clamp(float cell) {
+    if (cell < 0.0f) {
+      return 0;
+    }
+    return (cell >= (float)(GRID_SIZE)) ? GRID_SIZE - 1 : (size_t)(cell);
+  }
+
+  uint32_t magic_;
+  uint32_t count_;
+  float minLatitude_;
+  float minLongitude_;
+  float cellLatitude_;  // degrees
+  float cellLongitude_;
+  uint16_t cellStarts_[kCells + 1];  // sites of cell c: [start[c], start[c+1])
+  SensorSite sites_[CAPACITY];
+};
+
+template <size_t CAPACITY, size_t GRID_SIZE>
+void SensorsGrid<CAPACITY, GRID_SIZE>::Build(const SensorSite sites[],
+                                             size_t count) {
+  if (count > CAPACITY) {
+    count = CAPACITY;
+  }
+  count_ = count;
+  magic_ = kMagic;
+
+  float maxLatitude = 0.0f;
+  float maxLongitude = 0.0f;
+  for (size_t i = 0; i < count; i++) {
+    if (i == 0 || sites[i].latitude < minLatitude_) {
+      minLatitude_ = sites[i].latitude;
+    }
+    if (i == 0 || sites[i].latitude > maxLatitude) {
+      maxLatitude = sites[i].latitude;
+    }
+    if (i == 0 || sites[i].longitude < minLongitude_) {
+      minLongitude_ = sites[i].longitude;
+    }
+    if (i == 0 || sites[i].longitude > maxLongitude) {
+      maxLongitude = sites[i].longitude;
+    }
+  }
+  // cells of at least ~10m, whatever the spread of the sites
+  const float kMinCellDegrees = 1e-4f;
+  cellLatitude_ = (maxLatitude - minLatitude_) / GRID_SIZE;
+  cellLatitude_ = (cellLatitude_ < kMinCellDegrees) ? kMinCellDegrees
+                                                    : cellLatitude_;
+  cellLongitude_ = (maxLongitude - minLongitude_) / GRID_SIZE;
+  cellLongitude_ = (cellLongitude_ < kMinCellDegrees) ? kMinCellDegrees
+                                                      : cellLongitude_;
+
+  // counting sort: the end of each cell, then each site is placed before the
+  // end of its cell (in reverse, to keep the order of the sites in a cell),
+  // which leaves the start of each cell
+  for (size_t c = 0; c <= kCells; c++) {
+    cellStarts_[c] = 0;
+  }
+  for (size_t i = 0; i < count; i++) {
+    cellStarts_[CellIndex(sites[i].latitude, sites[i].longitude)]++;
+  }
+  for (size_t c = 1; c <= kCells; c++) {
+    cellStarts_[c] += cellStarts_[c - 1];
+  }
+  for (size_t i = count; i > 0; i--) {
+    const SensorSite &site = sites[i - 1];
+    sites_[--cellStarts_[CellIndex(site.latitude, site.longitude)]] = site;
+  }
+}
+
+template <size_t CAPACITY, size_t GRID_SIZE>
+size_t SensorsGrid<CAPACITY, GRID_SIZE>::Nearest(float latitude,
+                                                 float longitude,
+                                                 float radiusMeters, size_t k,
+                                                 Neighbor neighbors[],
+                                                 size_t *examined) const {
+  if (!IsValid() || count_ == 0 || k == 0) {
+    return 0;
+  }
+  // cells overlapping the bounding box of the search circle
+  const float kDegrees = 180.0f / (float)(M_PI);
+  float radiusLatitude = radiusMeters / kEarthRadiusMeters * kDegrees;
+  float radiusLongitude = radiusLatitude / cosf(latitude / kDegrees);
+  size_t firstRow = Row(latitude - radiusLatitude);
+  size_t lastRow = Row(latitude + radiusLatitude);
+  size_t firstColumn = Column(longitude - radiusLongitude);
+  size_t lastColumn = Column(longitude + radiusLongitude);
+
+  size_t found = 0;
+  for (size_t row = firstRow; row <= lastRow; row++) {
+    for (size_t column = firstColumn; column <= lastColumn; column++) {
+      size_t cell = row * GRID_SIZE + column;
+      if (examined != nullptr) {
+        *examined += cellStarts_[cell + 1] - cellStarts_[cell];
+      }
+      for (size_t i = cellStarts_[cell]; i < cellStarts_[cell + 1]; i++) {
+        const SensorSite &site = sites_[i];
+        float distance =
+            site_distance(latitude, longitude, site.latitude, site.longitude);
+        if (distance > radiusMeters ||
+            (found == k && distance >= neighbors[k - 1].distance)) {
+          continue;
+        }
+        // insertion in the k nearest, sorted by distance
+        size_t position = (found < k) ? found++ : k - 1;
+        while (position > 0 && neighbors[position - 1].distance > distance) {
+          neighbors[position] = neighbors[position - 1];
+          position--;
+        }
+        neighbors[position].id = site.id;
+        neighbors[position].distance = distance;
+      }
+    }
+  }
+  return found;
+}
+
+template <size_t CAPACITY, size_t GRID_SIZE>
+bool SensorsGrid<CAPACITY, GRID_SIZE>::Save(AbstractFlash &flash,
+                                            uint32_t offset) const {
+  if (offset % SPI_FLASH_SEC_SIZE != 0) {
+    return false;
+  }
+  for (uint32_t sector = offset / SPI_FLASH_SEC_SIZE;
+       sector * SPI_FLASH_SEC_SIZE < offset + sizeof(*this); sector++) {
+    if (!flash.flashEraseSector(sector)) {
+      return false;
+    }
+  }
+  return flash.flashWrite(offset, (uint32_t *)(this), sizeof(*this));
+}
+
+template <size_t CAPACITY, size_t GRID_SIZE>
+bool SensorsGrid<CAPACITY, GRID_SIZE>::Load(AbstractFlash &flash,
+                                            uint32_t offset) {
+  if (!flash.flashRead(offset, (uint32_t *)(this), sizeof(*this)) ||
+      !IsValid()) {
+    magic_ = 0;
+    count_ = 0;
+    return false;
+  }
+  return true;
+}
+
+#endif
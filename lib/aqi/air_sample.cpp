@@ -110,6 +110,36 @@ void byte_to_stats(uint8_t code, float &mae, uint8_t &count) {
   mae = (float)(0x1F & code) * 2.0;
 }
 
+uint32_t AirSampleTime::Seconds(const AirSampleData &data) {
+  return AirSampleView(data).Seconds();
+}
+
+uint8_t AirSampleView::SamplesCount() const {
+  float mae;
+  uint8_t count;
+  byte_to_stats(data_.stats_byte, mae, count);
+  return count;
+}
+
+float AirSampleView::Pm_2_5_Nmae() const {
+  float mae;
+  uint8_t count;
+  byte_to_stats(data_.stats_byte, mae, count);
+  return mae;
+}
+
+AqiLevel AirSampleView::Level() const {
+  int16_t aqi;
+  AqiLevel level;
+  pm25_short_to_aqi(data_.pm_2_5_short, aqi, level);
+  return level;
+}
+
+bool AirSampleView::IsValid() const {
+  return crc8_maxim((const uint8_t *)(&data_), kCompactedSampleSize - 1) ==
+         data_.crc;
+}
+
 void AirSample::Set(uint32_t seconds, float pm_1_0, float pm_2_5, float pm_10,
                     float pressure, int temperature, int humidity, int count,
                     float nmae) {
@@ -136,17 +166,17 @@ bool AirSample::IsValid() const {
 }
 
 void AirSample::FromData(const AirSampleData &data) {
-  timestamp_22bits_to_unix_seconds(data.timestamp24, seconds_);
-  pm_1_0_cf_ = short_to_cf(data.pm_1_0_short);
-  pm_2_5_cf_ = short_to_cf(data.pm_2_5_short);
-  pm_10_0_cf_ = short_to_cf(data.pm_10_0_short);
-  pressure_ = short_to_mbar_pressure(data.pressure_short);
-  temperature_f_ = byte_to_temperature_f(data.temperature_byte);
-  humidity_ = data.humidity_byte;
+  AirSampleView view(data);
+  seconds_ = view.Seconds();
+  pm_1_0_cf_ = view.Pm_1_0();
+  pm_2_5_cf_ = view.Pm_2_5();
+  pm_10_0_cf_ = view.Pm_10_0();
+  pressure_ = view.PressureMbar();
+  temperature_f_ = view.TemperatureF();
+  humidity_ = view.HumidityPercent();
   byte_to_stats(data.stats_byte, pm_2_5_mae_, samples_count_);
-  pm25_to_aqi(pm_2_5_cf_, aqi_pm25_, aqi_level_);
-  uint8_t crc = crc8_maxim((uint8_t *)(&data), kCompactedSampleSize - 1);
-  if (crc == data.crc) {
+  pm25_short_to_aqi(data.pm_2_5_short, aqi_pm25_, aqi_level_);
+  if (view.IsValid()) {
     set_bit(flags_, FlagsBitsPos::IsValid);
   } else {
     clear_bit(flags_, FlagsBitsPos::IsValid);
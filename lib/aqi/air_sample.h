@@ -2,6 +2,7 @@
 #define AAQIM_AIR_SAMPLE_H
 
 #include "cfaqi.h"
+#include "sample_encoding.h"
 
 const uint32_t kCompactedSampleSize = 16;
 const uint32_t kNaturalSampleSize = 32;
@@ -24,6 +25,59 @@ struct AirSampleData {
   uint8_t crc;
 };
 
+/** Timestamp accessor to use with FlashSamples<AirSampleData, AirSampleTime>
+ */
+struct AirSampleTime {
+  static const bool kTimestamped = true;
+  static uint32_t Seconds(const AirSampleData &data);
+};
+
+inline int16_t max_aqi(int16_t a, int16_t b) { return (a > b) ? a : b; }
+
+/**
+ * Read-only view of a stored sample, decoding the fields on demand.
+ *
+ * AirSample::FromData decodes all the fields, converts the AQI and checks
+ * the crc: the view is meant for the paths only needing a few fields
+ * (timestamp and pm2.5 to fill a graph, timestamp to seek...). The crc and
+ * AQI are only computed when asked for. The data has to outlive the view.
+ */
+class AirSampleView {
+ public:
+  explicit AirSampleView(const AirSampleData &data) : data_(data) {}
+
+  uint32_t Seconds() const {
+    uint32_t seconds;
+    timestamp_22bits_to_unix_seconds(data_.timestamp24, seconds);
+    return seconds;
+  }
+  float Pm_1_0() const { return short_to_cf(data_.pm_1_0_short); }
+  float Pm_2_5() const { return short_to_cf(data_.pm_2_5_short); }
+  float Pm_10_0() const { return short_to_cf(data_.pm_10_0_short); }
+  float PressureMbar() const {
+    return short_to_mbar_pressure(data_.pressure_short);
+  }
+  int16_t TemperatureF() const {
+    return byte_to_temperature_f(data_.temperature_byte);
+  }
+  uint8_t HumidityPercent() const { return data_.humidity_byte; }
+  uint8_t SamplesCount() const;
+  float Pm_2_5_Nmae() const;
+  int16_t AqiPm_2_5() const {
+    return pm25_short_to_aqi_value(data_.pm_2_5_short);
+  }
+  int16_t AqiPm_10_0() const {
+    return pm10_short_to_aqi_value(data_.pm_10_0_short);
+  }
+  /** Overall AQI: the max of the pollutants ones */
+  int16_t Aqi() const { return max_aqi(AqiPm_2_5(), AqiPm_10_0()); }
+  AqiLevel Level() const;
+  bool IsValid() const;
+
+ protected:
+  const AirSampleData &data_;
+};
+
 class AirSample {
  public:
   AirSample() { Set(k2019epoch, 0.0f, 0.0f, 0.0f, 1000.0f, 0, 0, 0, 0.0f); }
@@ -56,6 +110,10 @@ class AirSample {
   int16_t TemperatureF() const { return temperature_f_; }
   float TemperatureC() const { return ((float)temperature_f_ - 32.0f) * 5.0f / 9.0f; }
   int16_t AqiPm_2_5() const { return aqi_pm25_; }
+  /** Computed on demand (not stored to keep kNaturalSampleSize) */
+  int16_t AqiPm_10_0() const { return pm10_to_aqi_value(pm_10_0_cf_); }
+  /** Overall AQI: the max of the pollutants ones */
+  int16_t Aqi() const { return max_aqi(aqi_pm25_, AqiPm_10_0()); }
   uint8_t HumidityPercent() const { return humidity_; }
   uint8_t SamplesCount() const { return samples_count_; }
   float MaeValue() const { return pm_2_5_mae_; }
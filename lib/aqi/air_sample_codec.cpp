@@ -0,0 +1,186 @@
+#include "air_sample_codec.h"
+
+#include <string.h>
+
+#include "crc8_functions.h"
+#include "varint.h"
+
+enum class CodecFieldsBits : uint8_t {
+  Timestamp = 0,
+  Pm_1_0 = 1,
+  Pm_2_5 = 2,
+  Pm_10_0 = 3,
+  Pressure = 4,
+  TemperatureHumidity = 5,
+  Stats = 6
+};
+
+static uint8_t field_bit(CodecFieldsBits field) {
+  return 0x01 << static_cast<uint8_t>(field);
+}
+
+static int32_t timestamp_minutes(const AirSampleData &data) {
+  return ((int32_t)(data.timestamp24[0]) << 16) |
+         ((int32_t)(data.timestamp24[1]) << 8) | data.timestamp24[2];
+}
+
+static uint8_t compute_crc(const AirSampleData &data) {
+  return crc8_maxim((uint8_t *)(&data), kCompactedSampleSize - 1);
+}
+
+static size_t write_difference(uint16_t value, uint16_t previous,
+                               uint8_t *out) {
+  return varint_write(zigzag_encode((int32_t)(value) - (int32_t)(previous)),
+                      out);
+}
+
+static size_t read_difference(const uint8_t *in, size_t available,
+                              uint16_t previous, uint16_t &value) {
+  uint32_t zigzag;
+  size_t size = varint_read(in, available, zigzag);
+  value = (uint16_t)((int32_t)(previous) + zigzag_decode(zigzag));
+  return size;
+}
+
+void AirSampleCodec::Reset(State &state, const AirSampleData &base) {
+  state.previous = base;
+  state.previousDelta = 0;
+}
+
+size_t AirSampleCodec::Encode(State &state, const AirSampleData &data,
+                              uint8_t *out) {
+  const AirSampleData &previous = state.previous;
+  int32_t delta = timestamp_minutes(data) - timestamp_minutes(previous);
+
+  if (data.reserved != 0x00 || data.crc != compute_crc(data)) {
+    out[0] = kEscape;
+    memcpy(out + 1, &data, sizeof(AirSampleData));
+    state.previous = data;
+    state.previousDelta = delta;
+    return 1 + sizeof(AirSampleData);
+  }
+
+  uint8_t mask = 0;
+  size_t size = 1;
+  if (delta != state.previousDelta) {
+    mask |= field_bit(CodecFieldsBits::Timestamp);
+    size += varint_write(zigzag_encode(delta - state.previousDelta),
+                         out + size);
+  }
+  if (data.pm_1_0_short != previous.pm_1_0_short) {
+    mask |= field_bit(CodecFieldsBits::Pm_1_0);
+    size += write_difference(data.pm_1_0_short, previous.pm_1_0_short,
+                             out + size);
+  }
+  if (data.pm_2_5_short != previous.pm_2_5_short) {
+    mask |= field_bit(CodecFieldsBits::Pm_2_5);
+    size += write_difference(data.pm_2_5_short, previous.pm_2_5_short,
+                             out + size);
+  }
+  if (data.pm_10_0_short != previous.pm_10_0_short) {
+    mask |= field_bit(CodecFieldsBits::Pm_10_0);
+    size += write_difference(data.pm_10_0_short, previous.pm_10_0_short,
+                             out + size);
+  }
+  if (data.pressure_short != previous.pressure_short) {
+    mask |= field_bit(CodecFieldsBits::Pressure);
+    size += write_difference(data.pressure_short, previous.pressure_short,
+                             out + size);
+  }
+  if (data.temperature_byte != previous.temperature_byte ||
+      data.humidity_byte != previous.humidity_byte) {
+    mask |= field_bit(CodecFieldsBits::TemperatureHumidity);
+    out[size++] = data.temperature_byte;
+    out[size++] = data.humidity_byte;
+  }
+  if (data.stats_byte != previous.stats_byte) {
+    mask |= field_bit(CodecFieldsBits::Stats);
+    out[size++] = data.stats_byte;
+  }
+  out[0] = mask;
+
+  state.previous = data;
+  state.previousDelta = delta;
+  return size;
+}
+
+size_t AirSampleCodec::Decode(State &state, const uint8_t *in,
+                              size_t available, AirSampleData &data) {
+  if (available == 0 || in[0] == 0xFF) {
+    return 0;
+  }
+  const uint8_t mask = in[0];
+  const AirSampleData &previous = state.previous;
+
+  if (mask == kEscape) {
+    if (available < 1 + sizeof(AirSampleData)) {
+      return 0;
+    }
+    memcpy(&data, in + 1, sizeof(AirSampleData));
+    state.previousDelta =
+        timestamp_minutes(data) - timestamp_minutes(previous);
+    state.previous = data;
+    return 1 + sizeof(AirSampleData);
+  }
+
+  size_t size = 1;
+  size_t read;
+  int32_t delta = state.previousDelta;
+  if (mask & field_bit(CodecFieldsBits::Timestamp)) {
+    uint32_t zigzag;
+    read = varint_read(in + size, available - size, zigzag);
+    if (read == 0) {
+      return 0;
+    }
+    size += read;
+    delta += zigzag_decode(zigzag);
+  }
+  int32_t minutes = timestamp_minutes(previous) + delta;
+  data.timestamp24[0] = (uint8_t)(minutes >> 16);
+  data.timestamp24[1] = (uint8_t)(minutes >> 8);
+  data.timestamp24[2] = (uint8_t)(minutes);
+  data.reserved = 0x00;
+
+  uint16_t *fields[] = {&data.pm_1_0_short, &data.pm_2_5_short,
+                        &data.pm_10_0_short, &data.pressure_short};
+  const uint16_t previousFields[] = {
+      previous.pm_1_0_short, previous.pm_2_5_short, previous.pm_10_0_short,
+      previous.pressure_short};
+  const CodecFieldsBits bits[] = {
+      CodecFieldsBits::Pm_1_0, CodecFieldsBits::Pm_2_5,
+      CodecFieldsBits::Pm_10_0, CodecFieldsBits::Pressure};
+  for (size_t f = 0; f < 4; f++) {
+    if (mask & field_bit(bits[f])) {
+      read = read_difference(in + size, available - size, previousFields[f],
+                             *fields[f]);
+      if (read == 0) {
+        return 0;
+      }
+      size += read;
+    } else {
+      *fields[f] = previousFields[f];
+    }
+  }
+
+  data.temperature_byte = previous.temperature_byte;
+  data.humidity_byte = previous.humidity_byte;
+  if (mask & field_bit(CodecFieldsBits::TemperatureHumidity)) {
+    if (available < size + 2) {
+      return 0;
+    }
+    data.temperature_byte = in[size++];
+    data.humidity_byte = in[size++];
+  }
+  data.stats_byte = previous.stats_byte;
+  if (mask & field_bit(CodecFieldsBits::Stats)) {
+    if (available < size + 1) {
+      return 0;
+    }
+    data.stats_byte = in[size++];
+  }
+  data.crc = compute_crc(data);
+
+  state.previous = data;
+  state.previousDelta = delta;
+  return size;
+}
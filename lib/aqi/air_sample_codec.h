@@ -0,0 +1,51 @@
+#ifndef AAQIM_AIR_SAMPLE_CODEC_H
+#define AAQIM_AIR_SAMPLE_CODEC_H
+
+#include <stddef.h>
+
+#include "air_sample.h"
+
+/** Delta encoding of AirSampleData, to be used with BlockSamples.
+ *
+ * Each record is encoded against the previous sample of the block:
+ *   - one mask byte telling which fields changed (the most significant bit
+ *     is never set for a delta record, so a record never starts with 0xFF
+ *     like erased flash)
+ *   - timestamp: zigzag varint of the delta of delta, in minutes (samples are
+ *     usually evenly spaced, so most of the time nothing is stored)
+ *   - pm1.0 / pm2.5 / pm10 / pressure: zigzag varint of the difference
+ *   - temperature and humidity: raw bytes (when one of them changed)
+ *   - stats: raw byte
+ * The crc is not stored but recomputed by the decoder. Samples that cannot be
+ * rebuilt exactly this way (reserved byte used, invalid crc) are stored
+ * verbatim after a kEscape mask.
+ */
+struct AirSampleCodec {
+  typedef AirSampleData SampleType;
+
+  static const uint8_t kEscape = 0x80;
+  static const size_t kMaxEncodedSize = 1 + 5 + 4 * 3 + 2 + 1;
+
+  struct State {
+    AirSampleData previous;
+    int32_t previousDelta;
+  };
+
+  /** Start a block with this (verbatim stored) sample */
+  static void Reset(State &state, const AirSampleData &base);
+
+  /** Encode data after the previous sample of the state
+   * @param out at least kMaxEncodedSize bytes
+   * @return size of the record
+   */
+  static size_t Encode(State &state, const AirSampleData &data, uint8_t *out);
+
+  /** Decode a record
+   * @return size of the record, or 0 at the end of the block (erased flash)
+   *         or if the record is truncated
+   */
+  static size_t Decode(State &state, const uint8_t *in, size_t available,
+                       AirSampleData &data);
+};
+
+#endif
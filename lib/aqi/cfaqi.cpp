@@ -2,54 +2,186 @@
 
 #include <math.h>
 
+#if defined(ARDUINO)
+#include <pgmspace.h>
+#else
+#define PROGMEM
+#define pgm_read_word(address) (*(const uint16_t *)(address))
+#endif
+
 const char *AqiNames[] = {
     "Good", "Moderate", "UnhealthySG", "Unhealthy", "VeryUnheal.", "Hazardous"};
 
 const char *AqiColors[] = {"Green", "Yellow", "Orange",
                                           "Red",   "Purple", "Marron"};
 
-// From page 11 of:
-// https://www.airnow.gov/sites/default/files/2018-05/aqi-technical-assistance-document-may2016.pdf
-
-const float ConcentrationBreakpoints[kAqiLevelsCount + 2] = {
-    -0.1f, 12.0f, 35.4f, 55.4f, 150.4f, 250.4f, 350.4f, 500.4f};
+constexpr float Pm25Breakpoints::kConcentrations[];
+constexpr float Pm10Breakpoints::kConcentrations[];
 
-const int16_t AqiBreakpoints[kAqiLevelsCount + 2] = {-1,  50,  100, 150,
-                                                     200, 300, 400, 500};
+constexpr int16_t AqiBreakpoints[kAqiLevelsCount + 2] = {-1,  50,  100, 150,
+                                                         200, 300, 400, 500};
 
-bool pm25_to_aqi(float pm, int16_t &aqiValue, AqiLevel &aqiLevel) {
-  bool valid = false;
-  aqiValue = -1;
-  aqiLevel = AqiLevel::OutOfRange;
-  int bracket = 0;
-  if (pm >= 0.0) {
+/** Bracket of the concentration (1 to kAqiLevelsCount + 1), or 0 if out of
+ * range */
+template <typename BREAKPOINTS>
+constexpr size_t aqi_bracket(float c) {
+  if (c >= 0.0) {
     for (size_t i = 1; i < kAqiLevelsCount + 2; i++) {
-      if (pm <= ConcentrationBreakpoints[i]) {
-        valid = true;
-        bracket = i;
-        break;
+      if (c <= BREAKPOINTS::kConcentrations[i]) {
+        return i;
       }
     }
   }
-  if (pm > ConcentrationBreakpoints[kAqiLevelsCount + 1]) {
+  return 0;
+}
+
+/** Linear interpolation of the AQI within the bracket (before rounding).
+ * Shared by ToAqi and the lookup table, so both do exactly the same float
+ * operations.
+ * The concentrations between two brackets (within the resolution) get the
+ * lower AQI of the bracket. */
+template <typename BREAKPOINTS>
+constexpr float aqi_interpolation(float c, size_t bracket) {
+  const int lowI = AqiBreakpoints[bracket - 1] + 1;
+  const int highI = AqiBreakpoints[bracket];
+  const float lowC =
+      BREAKPOINTS::kConcentrations[bracket - 1] + BREAKPOINTS::kResolution;
+  const float highC = BREAKPOINTS::kConcentrations[bracket];
+  const float aqi = lowI + (highI - lowI) / (highC - lowC) * (c - lowC);
+  return (aqi < lowI) ? lowI : aqi;
+}
+
+template <typename BREAKPOINTS>
+bool AqiCalculator<BREAKPOINTS>::ToAqi(float concentration, int16_t &aqiValue,
+                                       AqiLevel &aqiLevel) {
+  aqiValue = -1;
+  aqiLevel = AqiLevel::OutOfRange;
+  size_t bracket = aqi_bracket<BREAKPOINTS>(concentration);
+  if (concentration > BREAKPOINTS::kConcentrations[kAqiLevelsCount + 1]) {
     // case completely out of range -> we saturate the value
     aqiValue = 500;
   }
-  if (valid) {
+  if (bracket > 0) {
     aqiLevel = static_cast<AqiLevel>(bracket - 1);
-    int lowI = AqiBreakpoints[bracket - 1] + 1;
-    int highI = AqiBreakpoints[bracket];
-    float lowC = ConcentrationBreakpoints[bracket - 1] + 0.1f;
-    float highC = ConcentrationBreakpoints[bracket];
-    aqiValue = roundf(lowI + (highI - lowI) / (highC - lowC) * (pm - lowC));
+    aqiValue = roundf(aqi_interpolation<BREAKPOINTS>(concentration, bracket));
   }
+  return bracket > 0;
+}
+
+// Lookup tables for the concentration codes (1/128 ug/m3): the AQI increases
+// by at most 1 from one code to the next, so only the first code of each AQI
+// value is stored (1KB instead of 128KB for all the codes), with the last
+// code of each bracket and its AQI (less than the upper AQI of the bracket
+// if the codes do not cover it).
+
+constexpr int16_t kMaxAqi = 500;
+
+struct AqiCodeTable {
+  uint16_t firstCode[kMaxAqi + 1];
+  uint16_t lastCode[kAqiLevelsCount + 2];  // of each bracket
+  uint16_t lastAqi[kAqiLevelsCount + 2];
+};
+
+/** Same as roundf, for the positive values */
+constexpr int16_t round_positive(float value) {
+  return (value - (int16_t)(value) >= 0.5f) ? (int16_t)(value) + 1
+                                            : (int16_t)(value);
+}
 
-  return valid;
+template <typename BREAKPOINTS>
+constexpr AqiCodeTable make_aqi_code_table() {
+  AqiCodeTable table = {};
+  int16_t aqi = -1;
+  for (uint32_t code = 0; code <= 0xFFFF; code++) {
+    float c = (float)(code) / 128.0f;
+    size_t bracket = aqi_bracket<BREAKPOINTS>(c);
+    if (bracket == 0) {
+      break;
+    }
+    int16_t value = round_positive(aqi_interpolation<BREAKPOINTS>(c, bracket));
+    while (aqi < value) {
+      aqi++;
+      table.firstCode[aqi] = (uint16_t)(code);
+    }
+    table.lastCode[bracket] = (uint16_t)(code);
+    table.lastAqi[bracket] = (uint16_t)(value);
+  }
+  return table;
 }
 
-int16_t pm25_to_aqi_value(float pm) {
+static constexpr AqiCodeTable kPm25CodeTable PROGMEM =
+    make_aqi_code_table<Pm25Breakpoints>();
+static constexpr AqiCodeTable kPm10CodeTable PROGMEM =
+    make_aqi_code_table<Pm10Breakpoints>();
+
+template <typename BREAKPOINTS>
+const AqiCodeTable &aqi_code_table();
+
+template <>
+const AqiCodeTable &aqi_code_table<Pm25Breakpoints>() {
+  return kPm25CodeTable;
+}
+
+template <>
+const AqiCodeTable &aqi_code_table<Pm10Breakpoints>() {
+  return kPm10CodeTable;
+}
+
+template <typename BREAKPOINTS>
+bool AqiCalculator<BREAKPOINTS>::CodeToAqi(uint16_t code, int16_t &aqiValue,
+                                           AqiLevel &aqiLevel) {
+  const AqiCodeTable &table = aqi_code_table<BREAKPOINTS>();
+  size_t bracket = 1;
+  while (code > pgm_read_word(&table.lastCode[bracket])) {
+    bracket++;
+    if (bracket == kAqiLevelsCount + 2) {
+      // case completely out of range -> we saturate the value
+      aqiValue = kMaxAqi;
+      aqiLevel = AqiLevel::OutOfRange;
+      return false;
+    }
+  }
+  aqiLevel = static_cast<AqiLevel>(bracket - 1);
+
+  // The AQI is linear in the bracket: estimate it, then look for the last
+  // AQI value whose first code is <= code (at most one step away)
+  int32_t lowI = AqiBreakpoints[bracket - 1] + 1;
+  int32_t highI = pgm_read_word(&table.lastAqi[bracket]);
+  int32_t lowCode = pgm_read_word(&table.firstCode[lowI]);
+  int32_t highCode = pgm_read_word(&table.lastCode[bracket]);
+  int16_t aqi = (int16_t)(lowI + (highI - lowI) * (code - lowCode) /
+                                     (highCode - lowCode + 1));
+  while (aqi > lowI && pgm_read_word(&table.firstCode[aqi]) > code) {
+    aqi--;
+  }
+  while (aqi < highI && pgm_read_word(&table.firstCode[aqi + 1]) <= code) {
+    aqi++;
+  }
+  aqiValue = aqi;
+  return true;
+}
+
+template <typename BREAKPOINTS>
+int16_t AqiCalculator<BREAKPOINTS>::CodeToAqiValue(uint16_t code) {
   AqiLevel level;
   int16_t value;
-  pm25_to_aqi(pm, value, level);
+  CodeToAqi(code, value, level);
   return value;
 }
+
+template <typename BREAKPOINTS>
+int16_t AqiCalculator<BREAKPOINTS>::ToAqiValue(float concentration) {
+  // decoded concentrations are quantized (see cf_to_short): use the table
+  float scaled = concentration * 128.0f;
+  if (scaled >= 0.0f && scaled <= 65535.0f &&
+      (float)((uint16_t)(scaled)) == scaled) {
+    return CodeToAqiValue((uint16_t)(scaled));
+  }
+  AqiLevel level;
+  int16_t value;
+  ToAqi(concentration, value, level);
+  return value;
+}
+
+template struct AqiCalculator<Pm25Breakpoints>;
+template struct AqiCalculator<Pm10Breakpoints>;
@@ -18,8 +18,68 @@ constexpr size_t kAqiLevelsCount = 6;
 extern const char *AqiNames[];
 extern const char *AqiColors[];
 
-bool pm25_to_aqi(float pm, int16_t &aqiValue, AqiLevel &aqiLevel);
+// Concentration breakpoints of the pollutants, from page 11 of:
+// https://www.airnow.gov/sites/default/files/2018-05/aqi-technical-assistance-document-may2016.pdf
+// The first one is the lower concentration minus the resolution (the
+// concentrations are truncated to the resolution in the table).
 
-int16_t pm25_to_aqi_value(float pm);
+struct Pm25Breakpoints {
+  static constexpr float kConcentrations[kAqiLevelsCount + 2] = {
+      -0.1f, 12.0f, 35.4f, 55.4f, 150.4f, 250.4f, 350.4f, 500.4f};
+  static constexpr float kResolution = 0.1f;
+};
+
+struct Pm10Breakpoints {
+  static constexpr float kConcentrations[kAqiLevelsCount + 2] = {
+      -1.0f, 54.0f, 154.0f, 254.0f, 354.0f, 424.0f, 504.0f, 604.0f};
+  static constexpr float kResolution = 1.0f;
+};
+
+/**
+ * AQI of a pollutant, specialized at compile time for its breakpoints (see
+ * Pm25Breakpoints). The conversion of the concentration codes stored in the
+ * samples (1/128 ug/m3 units, see cf_to_short) uses a lookup table generated
+ * at compile time (in flash on the ESP8266), and gives exactly the same result
+ * as the float conversion of the decoded concentration.
+ *
+ * Instantiated in cfaqi.cpp for Pm25Breakpoints and Pm10Breakpoints.
+ */
+template <typename BREAKPOINTS>
+struct AqiCalculator {
+  static bool ToAqi(float concentration, int16_t &aqiValue,
+                    AqiLevel &aqiLevel);
+
+  /** Same as ToAqi, with a table lookup when the concentration is quantized
+   * like the stored ones */
+  static int16_t ToAqiValue(float concentration);
+
+  static bool CodeToAqi(uint16_t code, int16_t &aqiValue, AqiLevel &aqiLevel);
+
+  static int16_t CodeToAqiValue(uint16_t code);
+};
+
+typedef AqiCalculator<Pm25Breakpoints> Pm25Aqi;
+typedef AqiCalculator<Pm10Breakpoints> Pm10Aqi;
+
+inline bool pm25_to_aqi(float pm, int16_t &aqiValue, AqiLevel &aqiLevel) {
+  return Pm25Aqi::ToAqi(pm, aqiValue, aqiLevel);
+}
+
+inline int16_t pm25_to_aqi_value(float pm) { return Pm25Aqi::ToAqiValue(pm); }
+
+inline bool pm25_short_to_aqi(uint16_t pmCode, int16_t &aqiValue,
+                              AqiLevel &aqiLevel) {
+  return Pm25Aqi::CodeToAqi(pmCode, aqiValue, aqiLevel);
+}
+
+inline int16_t pm25_short_to_aqi_value(uint16_t pmCode) {
+  return Pm25Aqi::CodeToAqiValue(pmCode);
+}
+
+inline int16_t pm10_to_aqi_value(float pm) { return Pm10Aqi::ToAqiValue(pm); }
+
+inline int16_t pm10_short_to_aqi_value(uint16_t pmCode) {
+  return Pm10Aqi::CodeToAqiValue(pmCode);
+}
 
 #endif
@@ -0,0 +1,43 @@
+#include "nowcast.h"
+
+bool pm_nowcast(const float hourly[kNowCastHours], float &nowcast) {
+  size_t recent = 0;
+  for (size_t i = 0; i < 3; i++) {
+    if (hourly[i] >= 0.0f) {
+      recent++;
+    }
+  }
+  if (recent < 2) {
+    return false;
+  }
+
+  float cmin = -1.0f;
+  float cmax = -1.0f;
+  for (size_t i = 0; i < kNowCastHours; i++) {
+    if (hourly[i] >= 0.0f) {
+      if (cmin < 0.0f || hourly[i] < cmin) {
+        cmin = hourly[i];
+      }
+      if (hourly[i] > cmax) {
+        cmax = hourly[i];
+      }
+    }
+  }
+  float weight = (cmax > 0.0f) ? cmin / cmax : 1.0f;
+  if (weight < 0.5f) {
+    weight = 0.5f;
+  }
+
+  float sum = 0.0f;
+  float weights = 0.0f;
+  float factor = 1.0f;
+  for (size_t i = 0; i < kNowCastHours; i++) {
+    if (hourly[i] >= 0.0f) {
+      sum += factor * hourly[i];
+      weights += factor;
+    }
+    factor *= weight;
+  }
+  nowcast = sum / weights;
+  return true;
+}
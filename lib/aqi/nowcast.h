@@ -0,0 +1,22 @@
+#ifndef AAQIM_NOWCAST_H
+#define AAQIM_NOWCAST_H
+
+#include <stddef.h>
+
+const size_t kNowCastHours = 12;
+
+/** EPA NowCast of the particulate matter concentration, from the hourly
+ * averages of the last 12 hours (see "Technical information about the
+ * NowCast", AirNow):
+ *   w = max(cmin / cmax, 0.5)
+ *   NowCast = sum(w^i * c[i]) / sum(w^i) over the available hours
+ *
+ * @param hourly hourly averages: hourly[0] = most recent complete hour, a
+ *               negative value marks a missing hour
+ * @param nowcast the NowCast concentration
+ * @return false if there is not enough data (two of the three most recent
+ *         hours are required)
+ */
+bool pm_nowcast(const float hourly[kNowCastHours], float &nowcast);
+
+#endif
@@ -0,0 +1,65 @@
+#include "rollup_data.h"
+
+#include "crc8_functions.h"
+#include "sample_encoding.h"
+
+uint32_t RollupTime::Seconds(const RollupData &data) {
+  uint32_t seconds;
+  timestamp_22bits_to_unix_seconds(data.timestamp24, seconds);
+  return seconds;
+}
+
+void rollup_init(RollupData &rollup, const AirSampleData &data) {
+  for (int i = 0; i < 3; i++) {
+    rollup.timestamp24[i] = data.timestamp24[i];
+  }
+  rollup.reserved = 0x00;
+  rollup.pm_2_5_sum = data.pm_2_5_short;
+  rollup.count = 1;
+  rollup.pm_2_5_min = data.pm_2_5_short;
+  rollup.pm_2_5_max = data.pm_2_5_short;
+  rollup.reserved2 = 0x00;
+  rollup.crc = 0;
+}
+
+void rollup_init(RollupData &rollup, const RollupData &data) {
+  rollup = data;
+}
+
+void rollup_add(RollupData &rollup, const AirSampleData &data) {
+  rollup.pm_2_5_sum += data.pm_2_5_short;
+  rollup.count++;
+  if (data.pm_2_5_short < rollup.pm_2_5_min) {
+    rollup.pm_2_5_min = data.pm_2_5_short;
+  }
+  if (data.pm_2_5_short > rollup.pm_2_5_max) {
+    rollup.pm_2_5_max = data.pm_2_5_short;
+  }
+}
+
+void rollup_add(RollupData &rollup, const RollupData &data) {
+  rollup.pm_2_5_sum += data.pm_2_5_sum;
+  rollup.count += data.count;
+  if (data.pm_2_5_min < rollup.pm_2_5_min) {
+    rollup.pm_2_5_min = data.pm_2_5_min;
+  }
+  if (data.pm_2_5_max > rollup.pm_2_5_max) {
+    rollup.pm_2_5_max = data.pm_2_5_max;
+  }
+}
+
+void rollup_seal(RollupData &rollup) {
+  rollup.crc = crc8_maxim((uint8_t *)(&rollup), sizeof(RollupData) - 1);
+}
+
+float rollup_mean(const RollupData &rollup) {
+  if (rollup.count == 0) {
+    return 0.0f;
+  }
+  return (float)rollup.pm_2_5_sum / (128.0f * (float)rollup.count);
+}
+
+bool rollup_is_valid(const RollupData &rollup) {
+  return (rollup.crc ==
+          crc8_maxim((uint8_t *)(&rollup), sizeof(RollupData) - 1));
+}
@@ -0,0 +1,48 @@
+#ifndef AAQIM_ROLLUP_DATA_H
+#define AAQIM_ROLLUP_DATA_H
+
+#include "air_sample.h"
+
+/** Aggregate of the pm2.5 concentration over a time period (hour, day...).
+ *
+ * The concentrations are kept with the same coding as in AirSampleData (see
+ * cf_to_short) so the aggregates are exact sums of the stored samples.
+ */
+struct RollupData {
+  uint8_t timestamp24[3];  // time of the most recent aggregated sample
+  uint8_t reserved;
+  uint32_t pm_2_5_sum;  // sum of the coded concentrations
+  uint16_t count;       // number of raw samples aggregated
+  uint16_t pm_2_5_min;  // coded concentrations
+  uint16_t pm_2_5_max;
+  uint8_t reserved2;
+  uint8_t crc;
+};
+
+/** Timestamp accessor to use with FlashSamples<RollupData, RollupTime> */
+struct RollupTime {
+  static const bool kTimestamped = true;
+  static uint32_t Seconds(const RollupData &data);
+};
+
+/** Start an aggregate with a first raw sample */
+void rollup_init(RollupData &rollup, const AirSampleData &data);
+
+/** Start an aggregate with a first aggregate of a shorter period */
+void rollup_init(RollupData &rollup, const RollupData &data);
+
+/** Add a sample older than the ones already aggregated */
+void rollup_add(RollupData &rollup, const AirSampleData &data);
+
+/** Add an aggregate older than the ones already aggregated */
+void rollup_add(RollupData &rollup, const RollupData &data);
+
+/** Compute the crc once the aggregate is complete */
+void rollup_seal(RollupData &rollup);
+
+/** Mean pm2.5 concentration of the aggregate */
+float rollup_mean(const RollupData &rollup);
+
+bool rollup_is_valid(const RollupData &rollup);
+
+#endif
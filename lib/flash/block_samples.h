@@ -0,0 +1,522 @@
+#ifndef AAQIM_BLOCK_SAMPLES_H
+#define AAQIM_BLOCK_SAMPLES_H
+
+#include <string.h>
+
+#include "flash_samples.h"
+
+const uint16_t kBlockHeaderMagic = 0xB10C;
+const uint8_t kBlockLayoutVersion = 1;
+
+/**
+ * Save or read compressed samples on flash.
+ *
+ * Alternative to FlashSamples when more history is desired in the same
+ * flash space: each sector is a block starting with a SectorHeader (the
+ * count is programmed when the block is closed), followed by the first sample
+ * of the block stored verbatim, then by the following samples encoded by the
+ * CODEC relatively to their predecessor (see AirSampleCodec).
+ *
+ * The records are appended as a byte stream: the flash word holding the end
+ * of the previous record is programmed again, with the bytes already written
+ * left to ones (which leaves them untouched on NOR flash).
+ *
+ * Begin() reads the header of each sector and decodes the most recent block
+ * to build an index in RAM (number of samples and first timestamp of each
+ * block). Reading the sample at a given index then costs a single block
+ * decode. Since every read decodes its blocks from their first sample, it is
+ * better to read large ranges (or use a SamplesCursor with a page in the
+ * order of a block) than a few samples at a time.
+ *
+ * @param CODEC encoder/decoder of the samples (see AirSampleCodec)
+ * @param TIME_ACCESSOR retrieves the timestamp of a sample (see NoSampleTime)
+ * @param MAX_SECTORS maximum number of sectors handled (size of the index)
+ */
+template <typename CODEC, typename TIME_ACCESSOR = NoSampleTime,
+          size_t MAX_SECTORS = 160>
+class BlockSamples {
+ public:
+  typedef typename CODEC::SampleType SampleType;
+  typedef TIME_ACCESSOR TimeAccessor;
+
+  /** Declare the flash accessor.
+   *
+   * @param sectorsLength Number of sectors to use (clamped to MAX_SECTORS
+   * and to the available flash, at least 2)
+   * @param startOffset Optional offset from the nominal flash storage (bytes)
+   */
+  BlockSamples(AbstractFlash& flash, size_t sectorsLength,
+               uint32_t startOffset = 0);
+
+  /** Retrieve the blocks on the existing storage and build the index.
+   * @param erase Default false. If set to true, the flash used by this
+   * class is first erase.
+   */
+  void Begin(bool erase = false);
+
+  /** Returns the number of sample currently stored on flash, or UINT32_MAX if
+   * flash is not scanned yet. */
+  size_t NumberOfSamples() const { return scanned_ ? total_ : UINT32_MAX; }
+
+  /** Append a sample, opening a new block (and dropping the oldest one when
+   * the storage is full) if it does not fit in the current block. */
+  bool StoreSample(const SampleType& data);
+
+  /** Same semantic as FlashSamples::ReadSample (0 is the most recent) */
+  bool ReadSample(size_t index, SampleType& data) {
+    return (ReadSamples(index, 1, &data) == 1);
+  }
+
+  /** Same semantic as FlashSamples::ReadSamples (one decode per block) */
+  size_t ReadSamples(size_t index, size_t count, SampleType* data);
+
+  /** Same semantic as FlashSamples::FindIndexAtOrBefore: the block is
+   * selected with the index, then decoded. */
+  size_t FindIndexAtOrBefore(uint32_t seconds);
+
+  /** Same as FindIndexAtOrBefore, which already walks from the most recent
+   * block */
+  size_t FindRecentIndexAtOrBefore(uint32_t seconds) {
+    return FindIndexAtOrBefore(seconds);
+  }
+
+  size_t SectorsInUse() const { return sectors_; }
+
+  /** Number of sectors currently holding samples */
+  size_t BlocksInUse() const;
+
+  uint32_t FlashStorageStart() const { return flashStorageStart_; }
+
+  uint32_t FlashStorageLength() const { return sectors_ * flashSectorSize_; }
+
+  uint32_t FlashStorageEnd() const {
+    return flashStorageStart_ + FlashStorageLength();
+  }
+
+  bool IsScanned() const { return scanned_; }
+
+  bool IsEmpty() const { return empty_; }
+
+  /** Read the header of the given block
+   * @return true if the sector holds a valid block header
+   */
+  bool ReadBlockHeader(uint32_t sectorIndex, SectorHeader& header) {
+    flash_.flashRead(SectorStart(sectorIndex), (uint32_t*)(&header),
+                     sizeof(SectorHeader));
+    return (header.magic == kBlockHeaderMagic &&
+            header.version == kBlockLayoutVersion &&
+            header.sampleSize == (uint8_t)(sizeof(SampleType)));
+  }
+
+  void Info();
+
+ protected:
+  static const uint32_t kBaseOffset = sizeof(SectorHeader);
+  static const uint32_t kStreamOffset =
+      kBaseOffset + 4 * ((sizeof(SampleType) + 3) / 4);
+  static const uint32_t kReadBytes = 256;
+
+  AbstractFlash& flash_;
+
+  uint32_t SectorStart(uint32_t sectorIndex) const {
+    return flashStorageStart_ + sectorIndex * flashSectorSize_;
+  }
+
+  uint32_t PreviousSector(uint32_t sectorIndex) const {
+    return (sectorIndex == 0 ? sectors_ : sectorIndex) - 1;
+  }
+
+  /** Decode the samples of a block, from the oldest to the most recent.
+   * @param count number of samples in the block (SIZE_MAX if unknown)
+   * @param visit called with (position in the block, sample), returns false
+   *              to stop the decoding
+   * @param state codec state after the last decoded sample
+   * @param tail offset in the sector following the last decoded record
+   * @return number of samples decoded
+   */
+  template <typename VISITOR>
+  size_t DecodeBlock(uint32_t sectorIndex, size_t count, VISITOR visit,
+                     typename CODEC::State& state, uint32_t& tail);
+
+  bool OpenBlock(uint32_t sectorIndex, const SampleType& data);
+
+  bool CloseBlock(uint32_t sectorIndex);
+
+  bool Append(uint32_t offset, const uint8_t* bytes, size_t size);
+
+  const uint32_t flashSectorSize_;
+  uint32_t flashStorageStart_;
+  uint32_t sectors_;
+  uint16_t counts_[MAX_SECTORS];       /** Samples in each block */
+  uint32_t firstSeconds_[MAX_SECTORS]; /** Timestamp of each block base */
+  uint32_t head_;   /** Sector of the most recent block */
+  uint32_t oldest_; /** Sector of the oldest block */
+  uint32_t tail_;   /** Offset of the next record in the head block */
+  uint32_t nextSequence_;
+  size_t total_;
+  typename CODEC::State state_; /** Codec state after the last sample */
+  bool scanned_;
+  bool empty_;
+};
+
+template <typename CODEC, typename TIME_ACCESSOR, size_t MAX_SECTORS>
+BlockSamples<CODEC, TIME_ACCESSOR, MAX_SECTORS>::BlockSamples(
+    AbstractFlash& flash, size_t sectorsLength, uint32_t startOffset)
+    : flash_(flash),
+      flashSectorSize_(SPI_FLASH_SEC_SIZE),
+      head_(0),
+      oldest_(0),
+      tail_(0),
+      nextSequence_(0),
+      total_(0),
+      scanned_(false),
+      empty_(true) {
+  if (startOffset % flashSectorSize_ != 0) {
+    startOffset = flashSectorSize_ * (1 + startOffset / flashSectorSize_);
+  }
+  uint32_t available = (FS_PHYS_SIZE - startOffset) / flashSectorSize_;
+  if (available < 2) {
+    printf("BlockSamples request is not valid:\n");
+    printf("  less than 2 secors available from the specified offset!\n");
+    printf("Stop now\n");
+#if defined(ARDUINO)
+    while (1)
+      ;
+#else
+    exit(1);
+#endif
+  }
+  sectors_ = (sectorsLength < 2) ? 2 : sectorsLength;
+  if (sectors_ > MAX_SECTORS) {
+    sectors_ = MAX_SECTORS;
+  }
+  if (sectors_ > available) {
+    sectors_ = available;
+  }
+  flashStorageStart_ = FS_PHYS_ADDR + startOffset;
+}
+
+template <typename CODEC, typename TIME_ACCESSOR, size_t MAX_SECTORS>
+void BlockSamples<CODEC, TIME_ACCESSOR, MAX_SECTORS>::Begin(bool erase) {
+  if (erase) {
+    uint32_t sector = flashStorageStart_ / flashSectorSize_;
+    for (uint32_t s = 0; s < sectors_; s++) {
+      flash_.flashEraseSector(sector);
+      sector++;
+    }
+  }
+
+  for (uint32_t s = 0; s < sectors_; s++) {
+    counts_[s] = 0;
+    firstSeconds_[s] = 0;
+  }
+  total_ = 0;
+  nextSequence_ = 0;
+  empty_ = true;
+  scanned_ = true;
+
+  // The most recent block has the highest sequence number...
+  SectorHeader header;
+  uint32_t head = UINT32_MAX;
+  for (uint32_t s = 0; s < sectors_; s++) {
+    if (ReadBlockHeader(s, header) &&
+        (head == UINT32_MAX || header.sequence >= nextSequence_)) {
+      head = s;
+      nextSequence_ = header.sequence + 1;
+    }
+  }
+  if (head == UINT32_MAX) {
+    return;
+  }
+
+  // ...and the older blocks precede it with decreasing sequence numbers
+  uint32_t expected = nextSequence_ - 1;
+  uint32_t s = head;
+  for (uint32_t n = 0; n < sectors_; n++) {
+    if (!ReadBlockHeader(s, header) || header.sequence != expected) {
+      break;
+    }
+    size_t count = header.count;
+    uint32_t tail = flashSectorSize_;
+    if (header.count == UINT32_MAX || s == head) {
+      // Open block (or the most recent one): decode it to count the samples
+      // and retrieve the state needed to append the next ones
+      typename CODEC::State state;
+      count = DecodeBlock(
+          s, (header.count == UINT32_MAX) ? SIZE_MAX : header.count,
+          [](size_t, const SampleType&) { return true; }, state, tail);
+      if (s == head) {
+        state_ = state;
+        // a closed block cannot be appended to
+        tail_ = (header.count == UINT32_MAX) ? tail : flashSectorSize_;
+      }
+    }
+    counts_[s] = (uint16_t)(count);
+    firstSeconds_[s] = header.firstSeconds;
+    total_ += count;
+    oldest_ = s;
+    expected--;
+    s = PreviousSector(s);
+  }
+  head_ = head;
+  empty_ = (total_ == 0);
+}
+
+template <typename CODEC, typename TIME_ACCESSOR, size_t MAX_SECTORS>
+template <typename VISITOR>
+size_t BlockSamples<CODEC, TIME_ACCESSOR, MAX_SECTORS>::DecodeBlock(
+    uint32_t sectorIndex, size_t count, VISITOR visit,
+    typename CODEC::State& state, uint32_t& tail) {
+  uint32_t buffer[kReadBytes / 4];
+  const uint8_t* bytes = (const uint8_t*)(buffer);
+  const uint32_t start = SectorStart(sectorIndex);
+
+  // First chunk: header + base sample + beginning of the stream
+  uint32_t bufferStart = 0;
+  uint32_t bufferLength = kReadBytes;
+  if (!flash_.flashRead(start, buffer, bufferLength)) {
+    return 0;
+  }
+  SampleType data;
+  memcpy(&data, bytes + kBaseOffset, sizeof(SampleType));
+  CODEC::Reset(state, data);
+  tail = kStreamOffset;
+  size_t decoded = 1;
+  if (!visit(0, data)) {
+    return decoded;
+  }
+
+  while (decoded < count && tail < flashSectorSize_) {
+    if (tail + CODEC::kMaxEncodedSize > bufferStart + bufferLength &&
+        bufferStart + bufferLength < flashSectorSize_) {
+      // Not enough bytes left in the buffer for a complete record
+      bufferStart = tail & ~0x03;
+      bufferLength = flashSectorSize_ - bufferStart;
+      if (bufferLength > kReadBytes) {
+        bufferLength = kReadBytes;
+      }
+      if (!flash_.flashRead(start + bufferStart, buffer, bufferLength)) {
+        break;
+      }
+    }
+    size_t size = CODEC::Decode(state, bytes + tail - bufferStart,
+                                bufferStart + bufferLength - tail, data);
+    if (size == 0) {
+      // end of the records (erased flash)
+      break;
+    }
+    tail += size;
+    decoded++;
+    if (!visit(decoded - 1, data)) {
+      break;
+    }
+  }
+  return decoded;
+}
+
+template <typename CODEC, typename TIME_ACCESSOR, size_t MAX_SECTORS>
+size_t BlockSamples<CODEC, TIME_ACCESSOR, MAX_SECTORS>::ReadSamples(
+    size_t index, size_t count, SampleType* data) {
+  if (!scanned_ || empty_ || index >= total_) {
+    return 0;
+  }
+  if (count > total_ - index) {
+    count = total_ - index;
+  }
+  // Walk the blocks from the most recent one, and decode only the ones
+  // overlapping the requested range
+  size_t newest = 0;  // index of the most recent sample of the block
+  uint32_t s = head_;
+  size_t done = 0;
+  while (done < count) {
+    size_t blockCount = counts_[s];
+    if (index < newest + blockCount) {
+      // positions (0 = oldest of the block) of the requested samples
+      size_t low = (index + count - 1 < newest + blockCount)
+                       ? newest + blockCount - 1 - (index + count - 1)
+                       : 0;
+      size_t high = newest + blockCount - 1 - (index > newest ? index : newest);
+      typename CODEC::State state;
+      uint32_t tail;
+      DecodeBlock(s, blockCount,
+                  [&](size_t position, const SampleType& sample) {
+                    if (position >= low) {
+                      data[newest + blockCount - 1 - position - index] = sample;
+                      done++;
+                    }
+                    return (position < high);
+                  },
+                  state, tail);
+    }
+    if (s == oldest_) {
+      break;
+    }
+    newest += blockCount;
+    s = PreviousSector(s);
+  }
+  return done;
+}
+
+template <typename CODEC, typename TIME_ACCESSOR, size_t MAX_SECTORS>
+size_t BlockSamples<CODEC, TIME_ACCESSOR, MAX_SECTORS>::FindIndexAtOrBefore(
+    uint32_t seconds) {
+  static_assert(TIME_ACCESSOR::kTimestamped,
+                "FindIndexAtOrBefore requires timestamped samples");
+  if (!scanned_ || empty_) {
+    return SIZE_MAX;
+  }
+  size_t newest = 0;
+  uint32_t s = head_;
+  while (true) {
+    if (firstSeconds_[s] <= seconds) {
+      // The sample is in this block: look for the last one old enough
+      size_t found = 0;
+      typename CODEC::State state;
+      uint32_t tail;
+      DecodeBlock(s, counts_[s],
+                  [&](size_t position, const SampleType& sample) {
+                    if (TIME_ACCESSOR::Seconds(sample) > seconds) {
+                      return false;
+                    }
+                    found = position;
+                    return true;
+                  },
+                  state, tail);
+      return newest + counts_[s] - 1 - found;
+    }
+    if (s == oldest_) {
+      break;
+    }
+    newest += counts_[s];
+    s = PreviousSector(s);
+  }
+  return SIZE_MAX;
+}
+
+template <typename CODEC, typename TIME_ACCESSOR, size_t MAX_SECTORS>
+bool BlockSamples<CODEC, TIME_ACCESSOR, MAX_SECTORS>::StoreSample(
+    const SampleType& data) {
+  if (!scanned_) {
+    return false;
+  }
+  if (empty_) {
+    return OpenBlock(0, data);
+  }
+  uint8_t record[CODEC::kMaxEncodedSize];
+  typename CODEC::State state = state_;
+  size_t size = CODEC::Encode(state, data, record);
+  if (tail_ + size <= flashSectorSize_) {
+    if (!Append(tail_, record, size)) {
+      printf("Error writing to flash :-(\n");
+      printf("  block sector = %d / offset = %d\n", head_, tail_);
+      return false;
+    }
+    tail_ += size;
+    state_ = state;
+    counts_[head_]++;
+    total_++;
+    return true;
+  }
+
+  uint8_t status = 0;
+  if (!CloseBlock(head_)) {
+    printf("Error closing block :-(\n");
+    status += 1;
+  }
+  if (!OpenBlock((head_ + 1) % sectors_, data)) {
+    status += 1;
+  }
+  return (status == 0);
+}
+
+template <typename CODEC, typename TIME_ACCESSOR, size_t MAX_SECTORS>
+bool BlockSamples<CODEC, TIME_ACCESSOR, MAX_SECTORS>::OpenBlock(
+    uint32_t sectorIndex, const SampleType& data) {
+  if (!empty_ && sectorIndex == oldest_) {
+    // the storage is full: drop the oldest block
+    total_ -= counts_[oldest_];
+    counts_[oldest_] = 0;
+    oldest_ = (oldest_ + 1) % sectors_;
+  }
+  printf("Erase sector starting at addr = 0x%08X\n", SectorStart(sectorIndex));
+  if (!flash_.flashEraseSector(SectorStart(sectorIndex) / flashSectorSize_)) {
+    printf("Error erasing sector :-(\n");
+    return false;
+  }
+
+  uint32_t words[kStreamOffset / 4];
+  memset(words, 0xFF, sizeof(words));
+  SectorHeader* header = (SectorHeader*)(words);
+  header->magic = kBlockHeaderMagic;
+  header->version = kBlockLayoutVersion;
+  header->sampleSize = (uint8_t)(sizeof(SampleType));
+  header->sequence = nextSequence_++;
+  header->firstSeconds = TIME_ACCESSOR::Seconds(data);
+  header->count = UINT32_MAX;
+  memcpy((uint8_t*)(words) + kBaseOffset, &data, sizeof(SampleType));
+  if (!flash_.flashWrite(SectorStart(sectorIndex), words, kStreamOffset)) {
+    printf("Error writing block header :-(\n");
+    return false;
+  }
+
+  if (empty_) {
+    oldest_ = sectorIndex;
+    empty_ = false;
+  }
+  head_ = sectorIndex;
+  counts_[head_] = 1;
+  firstSeconds_[head_] = header->firstSeconds;
+  tail_ = kStreamOffset;
+  CODEC::Reset(state_, data);
+  total_++;
+  return true;
+}
+
+template <typename CODEC, typename TIME_ACCESSOR, size_t MAX_SECTORS>
+bool BlockSamples<CODEC, TIME_ACCESSOR, MAX_SECTORS>::CloseBlock(
+    uint32_t sectorIndex) {
+  uint32_t count = counts_[sectorIndex];
+  return flash_.flashWrite(
+      SectorStart(sectorIndex) + offsetof(SectorHeader, count), &count,
+      sizeof(count));
+}
+
+template <typename CODEC, typename TIME_ACCESSOR, size_t MAX_SECTORS>
+bool BlockSamples<CODEC, TIME_ACCESSOR, MAX_SECTORS>::Append(
+    uint32_t offset, const uint8_t* bytes, size_t size) {
+  // Writes are word aligned: the bytes preceding the record in its first word
+  // are written as ones
+  uint32_t words[(CODEC::kMaxEncodedSize + 3) / 4 + 1];
+  memset(words, 0xFF, sizeof(words));
+  uint32_t aligned = offset & ~0x03;
+  memcpy((uint8_t*)(words) + (offset - aligned), bytes, size);
+  uint32_t length = ((offset + size + 3) & ~0x03) - aligned;
+  return flash_.flashWrite(SectorStart(head_) + aligned, words, length);
+}
+
+template <typename CODEC, typename TIME_ACCESSOR, size_t MAX_SECTORS>
+size_t BlockSamples<CODEC, TIME_ACCESSOR, MAX_SECTORS>::BlocksInUse() const {
+  if (!scanned_ || empty_) {
+    return 0;
+  }
+  return (head_ + sectors_ - oldest_) % sectors_ + 1;
+}
+
+template <typename CODEC, typename TIME_ACCESSOR, size_t MAX_SECTORS>
+void BlockSamples<CODEC, TIME_ACCESSOR, MAX_SECTORS>::Info() {
+  printf("Sample Size               : %u\n", sizeof(SampleType));
+  printf("Flash Storage Start       : 0x%08X\n", flashStorageStart_);
+  printf("Flash Storage Length      : 0x%08X\n", FlashStorageLength());
+  printf("Number of Sectors in Use  : %u\n", sectors_);
+  if (scanned_) {
+    printf("Blocks in Use             : %u\n", BlocksInUse());
+    printf("Number of Samples         : %u\n", total_);
+    if (!empty_) {
+      printf("Head Block Bytes          : %u\n", tail_);
+    }
+  } else {
+    printf("Flash not scanned yet!\n");
+  }
+}
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef AAQIM_COUNTING_FLASH_H
+#define AAQIM_COUNTING_FLASH_H
+
+#include "abstract_flash.h"
+
+/** Decorator counting the accesses made to an other AbstractFlash.
+ *
+ * Usefull to measure how much a given algorithm really hit the flash, on both
+ * the ESP and native platforms:
+ *   SimFlash sim;
+ *   CountingFlash flash(sim);
+ *   FlashSamples<AirSampleData> samples(flash, 1024);
+ */
+class CountingFlash : public AbstractFlash {
+ public:
+  CountingFlash(AbstractFlash& flash) : flash_(flash) { ResetCounters(); }
+
+  bool flashEraseSector(uint32_t sector) {
+    erases_++;
+    return flash_.flashEraseSector(sector);
+  }
+
+  bool flashWrite(uint32_t offset, uint32_t* data, size_t size) {
+    writes_++;
+    bytesWritten_ += size;
+    return flash_.flashWrite(offset, data, size);
+  }
+
+  bool flashRead(uint32_t offset, uint32_t* data, size_t size) {
+    reads_++;
+    bytesRead_ += size;
+    return flash_.flashRead(offset, data, size);
+  }
+
+  void ResetCounters() {
+    reads_ = 0;
+    writes_ = 0;
+    erases_ = 0;
+    bytesRead_ = 0;
+    bytesWritten_ = 0;
+  }
+
+  uint32_t Reads() const { return reads_; }
+  uint32_t Writes() const { return writes_; }
+  uint32_t Erases() const { return erases_; }
+  uint32_t BytesRead() const { return bytesRead_; }
+  uint32_t BytesWritten() const { return bytesWritten_; }
+
+ protected:
+  AbstractFlash& flash_;
+  uint32_t reads_;
+  uint32_t writes_;
+  uint32_t erases_;
+  uint32_t bytesRead_;
+  uint32_t bytesWritten_;
+};
+
+#endif
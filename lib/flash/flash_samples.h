@@ -1,6 +1,7 @@
 #ifndef AAQIM_FLASH_SAMPLES_H
 #define AAQIM_FLASH_SAMPLES_H
 
+#include "aaqim_debug.h"
 #include "abstract_flash.h"
 
 #if defined(ARDUINO)
@@ -12,8 +13,61 @@
 #include "sim_flash.h"
 #endif
 
+#include <stddef.h>
 #include <stdlib.h>
 
+/** Strategy used by Begin() to retrieve the ring buffer boundaries.
+ *
+ *   - Linear : check every sample slot of the storage (one flash read per
+ *              slot, ~40k reads for the main ring buffer). With the sector
+ *              headers layout, read every sector header instead.
+ *   - SectorSearch : probe the last slot of each sector to locate the sector
+ *              holding the most recent sample, then binary search inside
+ *              this sector (one read per sector + ~log2(slots per sector)).
+ *              With the sector headers layout, the most recent sector is
+ *              found with a binary search on the sequence numbers.
+ */
+enum class ScanMode : uint8_t { Linear, SectorSearch };
+
+/** Organization of the samples inside each flash sector.
+ *
+ *   - Raw : the sector is filled with samples only (the first four bytes of
+ *           a sample should not be all ones)
+ *   - SectorHeaders : the first slot(s) of each sector hold a SectorHeader,
+ *           written when the first sample is stored in the sector
+ */
+enum class FlashLayout : uint8_t { Raw, SectorHeaders };
+
+const uint16_t kSectorHeaderMagic = 0xA51D;
+const uint8_t kSectorLayoutVersion = 1;
+
+/** Record at the beginning of each sector with the SectorHeaders layout.
+ *
+ * The count is left erased while the sector is being filled, and programmed
+ * when the last slot of the sector is written.
+ */
+struct SectorHeader {
+  uint16_t magic;
+  uint8_t version;
+  uint8_t sampleSize;
+  uint32_t sequence;     /** Monotonically increasing sector number */
+  uint32_t firstSeconds; /** Timestamp of the first sample of the sector */
+  uint32_t count;        /** Samples in the sector, UINT32_MAX while open */
+};
+
+/** Default timestamp accessor, for samples without any notion of time.
+ *
+ * A timestamp accessor provides a static `uint32_t Seconds(const T&)` method
+ * returning the sample Unix time in seconds.
+ */
+struct NoSampleTime {
+  static const bool kTimestamped = false;
+  template <typename T>
+  static uint32_t Seconds(const T&) {
+    return 0;
+  }
+};
+
 /**
  * Save or read samples on flash.
  *
@@ -26,16 +80,22 @@
  * System, and allow easy access to the indexed samples.
  *
  * The class is not resilient to multiple instanciantion, so use with care!
- * 
+ *
  * The class needs to be passed a concrete version of AbstractFlash.
  *   - ESP : use the EspFlash defined at the end of this file
  *   - native : use SimFlash from "sim_flash.h"
  * See the `test_flash_samples` unit test for a concrete example on how to
  * use on both ESP and native.
+ *
+ * @param T type of the samples (fixed size)
+ * @param TIME_ACCESSOR retrieves the timestamp of a sample (see NoSampleTime)
  */
-template <typename T>
+template <typename T, typename TIME_ACCESSOR = NoSampleTime>
 class FlashSamples {
  public:
+  typedef T SampleType;
+  typedef TIME_ACCESSOR TimeAccessor;
+
   /** Declare the flash accessor.
    *
    * @param sampleLength Desired total number of samples to store on flash
@@ -43,10 +103,12 @@ class FlashSamples {
    * @param startOffset Optional offset from the nominal flash storage (bytes)
    * By default, startOffset is zero, and then the samples will be start to be
    * stored at the begining of the ESP8266 filesystem flash area.
+   * @param layout Optional organization of the sectors (default Raw).
+   * Switching the layout of an existing storage discards its samples.
    */
 
   FlashSamples(AbstractFlash& flash, size_t samplesLength,
-               uint32_t startOffset = 0);
+               uint32_t startOffset = 0, FlashLayout layout = FlashLayout::Raw);
 
   /** Retrieve the first/last sample addresses on the existing storage.
    *
@@ -54,8 +116,11 @@ class FlashSamples {
    * accessing the flash when desired.
    * @param erase Default false. If set to true, the flash used by this
    * class is first erase. This is a debug scenario only.
+   * @param mode Default SectorSearch. The Linear mode is only kept as a
+   * reference (and a fallback if the flash content does not respect the
+   * layout maintained by StoreSample).
    */
-  void Begin(bool erase = false);
+  void Begin(bool erase = false, ScanMode mode = ScanMode::SectorSearch);
 
   /** Returns the number of sample currently stored on flash.
    *
@@ -81,6 +146,41 @@ class FlashSamples {
    */
   bool ReadSample(size_t index, T& data);
 
+  /** Retrieve a range of consecutive samples.
+   *
+   * The samples are read with as few flash accesses as possible: one for a
+   * contiguous range, two if the range wraps around the end of the storage
+   * (with the sector headers layout, one per sector crossed).
+   * @param index Index of the most recent sample to read (see ReadSample)
+   * @param count Number of samples to read
+   * @param data Array of at least count samples: data[i] receives the sample
+   *             at index + i (so the samples are ordered from the most
+   *             recent to the oldest)
+   * @return Number of samples actually read (less than count if the range
+   *         goes beyond the oldest sample)
+   */
+  size_t ReadSamples(size_t index, size_t count, T* data);
+
+  /** Find the most recent sample with a timestamp older or equal to the given
+   * time, with a binary search on the samples (O(log n) flash reads).
+   *
+   * The samples are expected to be stored by increasing timestamps (small
+   * disorders just lead to a slightly inaccurate index).
+   * Only available with a TIME_ACCESSOR providing the timestamps.
+   * @param seconds Unix time in seconds
+   * @return index of the sample (as defined for ReadSample), or SIZE_MAX if
+   *         all the samples are more recent than seconds (or no samples)
+   */
+  size_t FindIndexAtOrBefore(uint32_t seconds);
+
+  /** Same result as FindIndexAtOrBefore, with an exponential search from the
+   * most recent sample: O(log index) flash reads, so a single read for the
+   * most recent sample, but up to twice as many as FindIndexAtOrBefore for
+   * the oldest ones. Meant for the incremental updates, which look for
+   * samples stored since the previous wake up.
+   */
+  size_t FindRecentIndexAtOrBefore(uint32_t seconds);
+
   /** Returns the number of sectors used by the FlashSample storage
    */
   size_t SectorsInUse() { return flashStorageLength_ / flashSectorSize_; }
@@ -91,9 +191,7 @@ class FlashSamples {
    * samples, and since one sector needs to be cleared for rewrite, it will be
    * one sector less than the size requested in samples.
    */
-  size_t NominalCapacity() {
-    return (SectorsInUse() - 1) * flashSectorSize_ / sampleSize_;
-  }
+  size_t NominalCapacity() { return (SectorsInUse() - 1) * slotsPerSector_; }
 
   uint32_t SampleSize() const { return sampleSize_; }
 
@@ -111,25 +209,124 @@ class FlashSamples {
 
   uint32_t LastSampleAddr() const { return lastSampleAddr_; }
 
+  FlashLayout Layout() const { return layout_; }
+
+  /** Number of samples stored in each sector (less with sector headers) */
+  uint32_t SlotsPerSector() const { return slotsPerSector_; }
+
   bool IsScanned() const { return scanned_; }
 
   bool IsEmpty() const { return empty_; }
 
+  /** Read the header of the given sector (SectorHeaders layout only)
+   * @param sectorIndex index of the sector, relative to the storage start
+   * @return true if the sector holds a valid header for this storage
+   */
+  bool ReadSectorHeader(uint32_t sectorIndex, SectorHeader& header) {
+    flash_.flashRead(SectorStart(sectorIndex), (uint32_t*)(&header),
+                     sizeof(SectorHeader));
+    return (header.magic == kSectorHeaderMagic &&
+            header.version == kSectorLayoutVersion &&
+            header.sampleSize == (uint8_t)(sampleSize_));
+  }
+
   void Info();
 
  protected:
   AbstractFlash& flash_;
 
-  uint32_t WrapAddress(uint32_t addr) {
-    if (addr >= FlashStorageEnd()) {
-      addr -= flashStorageLength_;
+  uint32_t SectorStart(uint32_t sectorIndex) const {
+    return flashStorageStart_ + sectorIndex * flashSectorSize_;
+  }
+
+  /** Samples are addressed by their position in the ring: sectorIndex *
+   * slotsPerSector_ + slot index in the sector. */
+  uint32_t RingSlots() const {
+    return flashStorageLength_ / flashSectorSize_ * slotsPerSector_;
+  }
+
+  uint32_t SlotAddress(uint32_t position) const {
+    return SectorStart(position / slotsPerSector_) + dataOffset_ +
+           (position % slotsPerSector_) * sampleSize_;
+  }
+
+  uint32_t SlotPosition(uint32_t addr) const {
+    uint32_t sectorIndex = (addr - flashStorageStart_) / flashSectorSize_;
+    uint32_t slot =
+        (addr - SectorStart(sectorIndex) - dataOffset_) / sampleSize_;
+    return sectorIndex * slotsPerSector_ + slot;
+  }
+
+  uint32_t NextAddress(uint32_t addr) const {
+    return SlotAddress((SlotPosition(addr) + 1) % RingSlots());
+  }
+
+  uint32_t PreviousAddress(uint32_t addr) const {
+    uint32_t position = SlotPosition(addr);
+    return SlotAddress((position == 0 ? RingSlots() : position) - 1);
+  }
+
+  /** Address of the first sample slot of a sector */
+  uint32_t SectorFirstSlot(uint32_t sectorIndex) const {
+    return SlotAddress(sectorIndex * slotsPerSector_);
+  }
+
+  /** A slot is considered used if its first four bytes are not all ones */
+  bool IsSlotUsed(uint32_t addr) {
+    uint32_t word = 0xFFFFFFFF;
+    flash_.flashRead(addr, &word, 4);
+    return (word != 0xFFFFFFFF);
+  }
+
+  /** A slot is considered erased if all its bytes are ones */
+  bool IsSlotErased(uint32_t addr) {
+    T data;
+    flash_.flashRead(addr, (uint32_t*)(&data), sampleSize_);
+    const uint8_t* bytes = (const uint8_t*)(&data);
+    for (uint32_t i = 0; i < sampleSize_; i++) {
+      if (bytes[i] != 0xFF) {
+        return false;
+      }
     }
-    return addr;
+    return true;
   }
 
+  bool IsHeaderErased(uint32_t sectorIndex) {
+    SectorHeader header;
+    flash_.flashRead(SectorStart(sectorIndex), (uint32_t*)(&header),
+                     sizeof(SectorHeader));
+    const uint8_t* bytes = (const uint8_t*)(&header);
+    for (uint32_t i = 0; i < sizeof(SectorHeader); i++) {
+      if (bytes[i] != 0xFF) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool OpenSector(uint32_t addr, const T& data);
+
+  /** Binary search of FindIndexAtOrBefore within [low, high) */
+  size_t SearchIndexAtOrBefore(uint32_t seconds, size_t low, size_t high);
+
+  bool CloseSector(uint32_t addr);
+
+  void LinearScan();
+
+  void SectorSearch();
+
+  void HeaderScan();
+
+  void HeaderSearch();
+
+  void SetHeadSector(uint32_t head, uint32_t oldest, const SectorHeader& header);
+
   const uint32_t
       sampleSize_; /** Size of samples to store (fixed size for all storage) */
   const uint32_t flashSectorSize_; /** Flash sector size */
+  const FlashLayout layout_;       /** Organization of the sectors */
+  uint32_t dataOffset_;     /** Offset of the first sample in each sector */
+  uint32_t slotsPerSector_; /** Number of samples in a sector */
   uint32_t
       flashStorageStart_; /** Start of the flash to use (expressed using the
                       full flash range, typically start is around 3M) */
@@ -137,23 +334,35 @@ class FlashSamples {
   uint32_t firstSampleAddr_;    /** Address of the firt (=older) sample (not
                                    necessary   zero since this is a ring buffer */
   uint32_t lastSampleAddr_;     /** Address of the last sample recoded */
+  uint32_t nextSequence_; /** Sequence number of the next sector header */
   bool scanned_; /** Was Begin() called once to scane the flash? */
   bool empty_;   /** Is the flash area empty */
 };
 
-template <typename T>
-FlashSamples<T>::FlashSamples(AbstractFlash& flash, size_t samplesLength,
-                              uint32_t startOffset)
+template <typename T, typename TIME_ACCESSOR>
+FlashSamples<T, TIME_ACCESSOR>::FlashSamples(AbstractFlash& flash,
+                                             size_t samplesLength,
+                                             uint32_t startOffset,
+                                             FlashLayout layout)
     : flash_(flash),
       sampleSize_(sizeof(T)),
       flashSectorSize_(SPI_FLASH_SEC_SIZE),
+      layout_(layout),
+      nextSequence_(0),
       scanned_(false),
       empty_(false) {
+  // the header occupies a whole number of slots, to keep the samples aligned
+  dataOffset_ = 0;
+  if (layout_ == FlashLayout::SectorHeaders) {
+    dataOffset_ = sampleSize_ *
+                  ((sizeof(SectorHeader) + sampleSize_ - 1) / sampleSize_);
+  }
+  slotsPerSector_ = (flashSectorSize_ - dataOffset_) / sampleSize_;
+
   // startOffset needs to be aligned with a sector!
   if (startOffset % flashSectorSize_ != 0) {
     startOffset = flashSectorSize_ * (1 + startOffset / flashSectorSize_);
   }
-  uint32_t length = sampleSize_ * samplesLength;
   uint32_t available = FS_PHYS_SIZE - startOffset;
   if (available < 2 * flashSectorSize_) {
     printf("FlashSamples request is not valid:\n");
@@ -166,17 +375,18 @@ FlashSamples<T>::FlashSamples(AbstractFlash& flash, size_t samplesLength,
     exit(1);
 #endif
   }
+  // normalize the length to an entire number of sectors
+  uint32_t length = flashSectorSize_ * (samplesLength / slotsPerSector_);
+  if (samplesLength % slotsPerSector_ != 0) {
+    length += flashSectorSize_;
+  }
   // we need at the very least 2 sectors to avoid loosing data
   // when erasing a used sector
   if (length < 2 * flashSectorSize_) {
     length = 2 * flashSectorSize_;
   }
   if (length > available) {
-    length = available;
-  }
-  // normalize the length to an entire number of sectors
-  if (length % flashSectorSize_ != 0) {
-    length = flashSectorSize_ * (1 + length / flashSectorSize_);
+    length = flashSectorSize_ * (available / flashSectorSize_);
   }
   flashStorageLength_ = length;
   flashStorageStart_ = FS_PHYS_ADDR + startOffset;
@@ -184,8 +394,8 @@ FlashSamples<T>::FlashSamples(AbstractFlash& flash, size_t samplesLength,
   lastSampleAddr_ = UINT32_MAX;
 }
 
-template <typename T>
-void FlashSamples<T>::Begin(bool erase) {
+template <typename T, typename TIME_ACCESSOR>
+void FlashSamples<T, TIME_ACCESSOR>::Begin(bool erase, ScanMode mode) {
   // For some debug scenarios, we may want to clear the flash first!
   if (erase) {
     uint32_t sector = flashStorageStart_ / flashSectorSize_;
@@ -195,12 +405,44 @@ void FlashSamples<T>::Begin(bool erase) {
     }
   }
 
+  firstSampleAddr_ = UINT32_MAX;
+  lastSampleAddr_ = UINT32_MAX;
+  nextSequence_ = 0;
+  empty_ = false;
+  if (layout_ == FlashLayout::SectorHeaders) {
+    if (mode == ScanMode::Linear) {
+      HeaderScan();
+    } else {
+      HeaderSearch();
+    }
+  } else if (mode == ScanMode::Linear) {
+    LinearScan();
+  } else {
+    SectorSearch();
+  }
+  if (firstSampleAddr_ == UINT32_MAX) {
+    empty_ = true;
+  } else {
+    // there are samples, but we did not find the last one yet
+    // (when at the very end of the flash space)
+    if (lastSampleAddr_ == UINT32_MAX) {
+      lastSampleAddr_ = SlotAddress(RingSlots() - 1);
+    }
+  }
+  scanned_ = true;
+}
+
+template <typename T, typename TIME_ACCESSOR>
+void FlashSamples<T, TIME_ACCESSOR>::LinearScan() {
   uint32_t current = 0xFFFFFFFF;
   uint32_t previous = 0xFFFFFFFF;
-  uint32_t addr = flashStorageStart_;
-  for (uint32_t i = 0; i < flashStorageLength_; i += sampleSize_) {
+  // Start from the last slot of the storage since this is a ring buffer
+  // (the first slot is not the oldest sample if the head is the first sector)
+  flash_.flashRead(SlotAddress(RingSlots() - 1), &previous, 4);
+  for (uint32_t position = 0; position < RingSlots(); position++) {
     // Only check the first four byte of each sample
     // (do not write sample starting with 32 bits set to one!)
+    uint32_t addr = SlotAddress(position);
     flash_.flashRead(addr, &current, 4);
     if (firstSampleAddr_ == UINT32_MAX) {
       if (previous == 0xFFFFFFFF && current != 0xFFFFFFFF) {
@@ -209,67 +451,349 @@ void FlashSamples<T>::Begin(bool erase) {
     }
     if (lastSampleAddr_ == UINT32_MAX) {
       if (previous != 0xFFFFFFFF && current == 0xFFFFFFFF) {
-        lastSampleAddr_ = addr - sampleSize_;
+        lastSampleAddr_ = PreviousAddress(addr);
       }
     }
     previous = current;
-    addr += sampleSize_;
   }
-  if (firstSampleAddr_ == UINT32_MAX) {
-    empty_ = true;
+}
+
+template <typename T, typename TIME_ACCESSOR>
+void FlashSamples<T, TIME_ACCESSOR>::SectorSearch() {
+  // StoreSample fills the sectors sequentially, and always erases the next
+  // sector when writing the last slot of a sector. So going around the ring,
+  // all sectors are full except the "head" sector (the one that will receive
+  // the next sample), which is either partially filled or fully erased. Before
+  // the first wrap around, the sectors following the head are erased too.
+  // The head is then the first sector with an unused last slot that follows a
+  // full sector.
+  // Note: without any ordering information in the sectors, the head cannot be
+  // found with a binary search once the ring has wrapped, so every sector is
+  // probed once (a single read per sector).
+  const uint32_t sectors = SectorsInUse();
+  const uint32_t lastSlotOffset = (slotsPerSector_ - 1) * sampleSize_;
+  uint32_t head = UINT32_MAX;
+  bool firstFull = false;
+  bool previousFull = false;
+  for (uint32_t s = 0; s < sectors; s++) {
+    bool full = IsSlotUsed(SectorFirstSlot(s) + lastSlotOffset);
+    if (s == 0) {
+      firstFull = full;
+    } else if (head == UINT32_MAX && previousFull && !full) {
+      head = s;
+    }
+    previousFull = full;
+  }
+  if (head == UINT32_MAX) {
+    if (previousFull && !firstFull) {
+      // the last sector was full and the first one is the head
+      head = 0;
+    } else if (previousFull) {
+      // all the sectors are full: this layout cannot be produced by
+      // StoreSample, so just fall back to the exhaustive scan
+      dbg_printf("No head sector found, perform a linear scan\n");
+      LinearScan();
+      return;
+    } else if (IsSlotUsed(SectorFirstSlot(0))) {
+      // no full sector, but samples in the first one
+      head = 0;
+    } else {
+      // flash is empty
+      return;
+    }
+  }
+
+  // Binary search the first unused slot of the head sector. The last slot of
+  // the head sector is known to be unused.
+  const uint32_t headStart = SectorFirstSlot(head);
+  uint32_t low = 0;
+  uint32_t high = slotsPerSector_ - 1;
+  while (low < high) {
+    uint32_t mid = (low + high) / 2;
+    if (IsSlotUsed(headStart + mid * sampleSize_)) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  if (low == 0) {
+    // The head sector is empty: last sample is at the end of previous sector
+    lastSampleAddr_ = PreviousAddress(headStart);
   } else {
-    // there are samples, but we did not find the last one yet
-    // (when at the very end of the flash space)
-    if (lastSampleAddr_ == UINT32_MAX) {
-      lastSampleAddr_ = FlashStorageEnd() - sampleSize_;
+    lastSampleAddr_ = headStart + (low - 1) * sampleSize_;
+  }
+
+  // If the ring has already wrapped, the oldest samples are in the sector
+  // following the head one (then full), otherwise they start at the beginning
+  // of the storage.
+  const uint32_t next = (head + 1) % sectors;
+  if (next != head && IsSlotUsed(SectorFirstSlot(next) + lastSlotOffset)) {
+    firstSampleAddr_ = SectorFirstSlot(next);
+  } else {
+    firstSampleAddr_ = SectorFirstSlot(0);
+  }
+}
+
+template <typename T, typename TIME_ACCESSOR>
+void FlashSamples<T, TIME_ACCESSOR>::HeaderScan() {
+  // Reference implementation: read all the headers, the most recent sector
+  // has the highest sequence number, and the oldest the lowest one.
+  const uint32_t sectors = SectorsInUse();
+  uint32_t head = UINT32_MAX;
+  uint32_t oldest = UINT32_MAX;
+  SectorHeader headHeader;
+  uint32_t minSequence = UINT32_MAX;
+  for (uint32_t s = 0; s < sectors; s++) {
+    SectorHeader header;
+    if (!ReadSectorHeader(s, header)) {
+      continue;
+    }
+    if (head == UINT32_MAX || header.sequence > headHeader.sequence) {
+      head = s;
+      headHeader = header;
+    }
+    if (header.sequence < minSequence) {
+      minSequence = header.sequence;
+      oldest = s;
     }
   }
-  scanned_ = true;
+  if (head != UINT32_MAX) {
+    SetHeadSector(head, oldest, headHeader);
+  }
+}
+
+template <typename T, typename TIME_ACCESSOR>
+void FlashSamples<T, TIME_ACCESSOR>::HeaderSearch() {
+  // The sequence numbers increase around the ring from the oldest sector to
+  // the head sector. At most one erased sector (without header) can follow
+  // the head sector, unless the ring did not wrap yet (then all the sectors
+  // after the head are erased). So starting from sector 0, the sectors with
+  // a sequence number larger or equal to the one of sector 0 form a
+  // contiguous block ending with the head sector.
+  const uint32_t sectors = SectorsInUse();
+  SectorHeader header;
+  uint32_t head;
+  if (ReadSectorHeader(0, header)) {
+    const uint32_t reference = header.sequence;
+    uint32_t low = 0;  // last sector known to be part of the block
+    uint32_t high = sectors;
+    while (high - low > 1) {
+      uint32_t mid = (low + high) / 2;
+      if (ReadSectorHeader(mid, header) && header.sequence >= reference) {
+        low = mid;
+      } else {
+        high = mid;
+      }
+    }
+    head = low;
+  } else if (ReadSectorHeader(1, header)) {
+    // Sector 0 is the erased sector following the head
+    head = sectors - 1;
+  } else {
+    // Sectors 0 and 1 without samples: flash is empty
+    return;
+  }
+  SectorHeader headHeader;
+  if (!ReadSectorHeader(head, headHeader)) {
+    dbg_printf("Invalid head sector header, perform a header scan\n");
+    HeaderScan();
+    return;
+  }
+
+  // The oldest sector is the first sector with a header after the head one
+  // (either the next one, or the one after the erased sector), or sector 0 if
+  // the ring did not wrap yet.
+  uint32_t oldest = 0;
+  for (uint32_t n = 1; n <= 2 && n < sectors; n++) {
+    uint32_t s = (head + n) % sectors;
+    if (ReadSectorHeader(s, header) && header.sequence < headHeader.sequence) {
+      oldest = s;
+      break;
+    }
+  }
+  SetHeadSector(head, oldest, headHeader);
+}
+
+template <typename T, typename TIME_ACCESSOR>
+void FlashSamples<T, TIME_ACCESSOR>::SetHeadSector(
+    uint32_t head, uint32_t oldest, const SectorHeader& header) {
+  nextSequence_ = header.sequence + 1;
+  firstSampleAddr_ = SectorFirstSlot(oldest);
+  uint32_t used = slotsPerSector_;
+  if (header.count == UINT32_MAX) {
+    // Binary search the first erased slot of the open head sector
+    uint32_t low = 0;
+    uint32_t high = slotsPerSector_;
+    while (low < high) {
+      uint32_t mid = (low + high) / 2;
+      if (IsSlotErased(SlotAddress(head * slotsPerSector_ + mid))) {
+        high = mid;
+      } else {
+        low = mid + 1;
+      }
+    }
+    used = low;
+  }
+  if (used > 0) {
+    lastSampleAddr_ = SlotAddress(head * slotsPerSector_ + used - 1);
+  } else if (head != oldest) {
+    // Header written, but not the sample (power loss)
+    lastSampleAddr_ = PreviousAddress(SectorFirstSlot(head));
+  } else {
+    // Only an empty sector: consider the flash empty
+    firstSampleAddr_ = UINT32_MAX;
+  }
 }
 
-template <typename T>
-size_t FlashSamples<T>::NumberOfSamples() {
+template <typename T, typename TIME_ACCESSOR>
+size_t FlashSamples<T, TIME_ACCESSOR>::NumberOfSamples() {
   uint32_t count = UINT32_MAX;
   if (scanned_) {
     // Only if flash has been scanned properly
-    if (firstSampleAddr_ == lastSampleAddr_) {
+    if (empty_) {
       count = 0;
     } else {
+      uint32_t first = SlotPosition(firstSampleAddr_);
+      uint32_t last = SlotPosition(lastSampleAddr_);
       uint32_t span;
-      if (firstSampleAddr_ < lastSampleAddr_) {
-        span = lastSampleAddr_ - firstSampleAddr_;
+      if (first <= last) {
+        span = last - first;
       } else {
-        span = flashStorageLength_ + lastSampleAddr_ - firstSampleAddr_;
+        span = RingSlots() + last - first;
       }
-      count = span / sampleSize_ + 1;
+      count = span + 1;
     }
   }
   return count;
 }
 
-template <typename T>
-bool FlashSamples<T>::ReadSample(size_t index, T& data) {
+template <typename T, typename TIME_ACCESSOR>
+bool FlashSamples<T, TIME_ACCESSOR>::ReadSample(size_t index, T& data) {
   if (index > NumberOfSamples() - 1) {
     return false;
   }
-  uint32_t addr = lastSampleAddr_ - index * sampleSize_;
-  if (addr < flashStorageStart_) {
-    addr += flashStorageLength_;
+  uint32_t position = SlotPosition(lastSampleAddr_);
+  if (position < index) {
+    position += RingSlots();
   }
+  uint32_t addr = SlotAddress(position - index);
   uint32_t* ptr = (uint32_t*)(&data);
   return flash_.flashRead(addr, ptr, sampleSize_);
 }
 
-template <typename T>
-bool FlashSamples<T>::StoreSample(const T& data) {
+template <typename T, typename TIME_ACCESSOR>
+size_t FlashSamples<T, TIME_ACCESSOR>::ReadSamples(size_t index, size_t count,
+                                                   T* data) {
+  const size_t available = NumberOfSamples();
+  if (empty_ || index >= available) {
+    return 0;
+  }
+  if (count > available - index) {
+    count = available - index;
+  }
+  // Samples are read in the flash order (from the oldest to the most recent)
+  // and then reversed in place.
+  const uint32_t total = RingSlots();
+  const bool contiguous =
+      (dataOffset_ == 0 && slotsPerSector_ * sampleSize_ == flashSectorSize_);
+  uint32_t position = SlotPosition(lastSampleAddr_) + total - index -
+                      (count - 1);
+  position %= total;
+  size_t done = 0;
+  while (done < count) {
+    uint32_t run = contiguous ? total - position
+                              : slotsPerSector_ - position % slotsPerSector_;
+    if (run > count - done) {
+      run = count - done;
+    }
+    if (!flash_.flashRead(SlotAddress(position), (uint32_t*)(data + done),
+                          run * sampleSize_)) {
+      return 0;
+    }
+    done += run;
+    position = (position + run) % total;
+  }
+  for (size_t i = 0; i < count / 2; i++) {
+    T tmp = data[i];
+    data[i] = data[count - 1 - i];
+    data[count - 1 - i] = tmp;
+  }
+  return count;
+}
+
+template <typename T, typename TIME_ACCESSOR>
+size_t FlashSamples<T, TIME_ACCESSOR>::FindIndexAtOrBefore(uint32_t seconds) {
+  static_assert(TIME_ACCESSOR::kTimestamped,
+                "FindIndexAtOrBefore requires timestamped samples");
+  if (!scanned_ || empty_) {
+    return SIZE_MAX;
+  }
+  return SearchIndexAtOrBefore(seconds, 0, NumberOfSamples());
+}
+
+template <typename T, typename TIME_ACCESSOR>
+size_t FlashSamples<T, TIME_ACCESSOR>::FindRecentIndexAtOrBefore(
+    uint32_t seconds) {
+  static_assert(TIME_ACCESSOR::kTimestamped,
+                "FindRecentIndexAtOrBefore requires timestamped samples");
+  if (!scanned_ || empty_) {
+    return SIZE_MAX;
+  }
+  // Bracket the range by probing indexes 0, 1, 3, 7... then search it
+  const size_t count = NumberOfSamples();
+  size_t low = 0;
+  T data;
+  for (size_t probe = 0; probe < count; probe = 2 * probe + 1) {
+    ReadSample(probe, data);
+    if (TIME_ACCESSOR::Seconds(data) <= seconds) {
+      return SearchIndexAtOrBefore(seconds, low, probe);
+    }
+    low = probe + 1;
+  }
+  return SearchIndexAtOrBefore(seconds, low, count);
+}
+
+template <typename T, typename TIME_ACCESSOR>
+size_t FlashSamples<T, TIME_ACCESSOR>::SearchIndexAtOrBefore(uint32_t seconds,
+                                                             size_t low,
+                                                             size_t high) {
+  // Timestamps decrease with the index: search the first index with a
+  // timestamp older or equal to seconds (high when none in the range).
+  const size_t count = NumberOfSamples();
+  T data;
+  while (low < high) {
+    size_t mid = (low + high) / 2;
+    ReadSample(mid, data);
+    if (TIME_ACCESSOR::Seconds(data) <= seconds) {
+      high = mid;
+    } else {
+      low = mid + 1;
+    }
+  }
+  if (low == count) {
+    return SIZE_MAX;
+  }
+  return low;
+}
+
+template <typename T, typename TIME_ACCESSOR>
+bool FlashSamples<T, TIME_ACCESSOR>::StoreSample(const T& data) {
   uint8_t status = 0;
   // Handle empty flash versus non-empty
   if (empty_) {
-    firstSampleAddr_ = flashStorageStart_;
-    lastSampleAddr_ = flashStorageStart_;
+    firstSampleAddr_ = SlotAddress(0);
+    lastSampleAddr_ = firstSampleAddr_;
     empty_ = false;
   } else {
-    lastSampleAddr_ = WrapAddress(lastSampleAddr_ + sampleSize_);
+    lastSampleAddr_ = NextAddress(lastSampleAddr_);
+  }
+
+  if (layout_ == FlashLayout::SectorHeaders &&
+      SlotPosition(lastSampleAddr_) % slotsPerSector_ == 0) {
+    if (!OpenSector(lastSampleAddr_, data)) {
+      printf("Error writing sector header :-(\n");
+      status += 1;
+    }
   }
 
   // If everything went well, the flash memory space where we need
@@ -288,12 +812,18 @@ bool FlashSamples<T>::StoreSample(const T& data) {
   // between a last sample at the end of a buffer and the next sample
   // that would be the oldest one).
   uint32_t currentSector = lastSampleAddr_ / flashSectorSize_;
-  uint32_t nextAddress = WrapAddress(lastSampleAddr_ + sampleSize_);
+  uint32_t nextAddress = NextAddress(lastSampleAddr_);
   uint32_t nextSector = nextAddress / flashSectorSize_;
   if (currentSector != nextSector) {
+    if (layout_ == FlashLayout::SectorHeaders &&
+        !CloseSector(lastSampleAddr_)) {
+      printf("Error closing sector :-(\n");
+      status += 1;
+    }
     printf("Erase sector starting at addr = 0x%08X\n", nextAddress);
     if (firstSampleAddr_ == nextAddress) {
-      firstSampleAddr_ = WrapAddress(nextAddress + flashSectorSize_);
+      uint32_t nextIndex = SlotPosition(nextAddress) / slotsPerSector_;
+      firstSampleAddr_ = SectorFirstSlot((nextIndex + 1) % SectorsInUse());
     }
     bool result = flash_.flashEraseSector(nextSector);
     if (!result) {
@@ -304,12 +834,46 @@ bool FlashSamples<T>::StoreSample(const T& data) {
   return (status == 0);
 }
 
-template <typename T>
-void FlashSamples<T>::Info() {
+template <typename T, typename TIME_ACCESSOR>
+bool FlashSamples<T, TIME_ACCESSOR>::OpenSector(uint32_t addr, const T& data) {
+  uint32_t sector = addr / flashSectorSize_;
+  uint32_t sectorStart = sector * flashSectorSize_;
+  SectorHeader header;
+  // The sector should have been erased in advance, except when the storage
+  // was holding something else (or when a sample could not be written after
+  // the header)
+  if (!IsHeaderErased(SlotPosition(addr) / slotsPerSector_)) {
+    printf("Erase sector with unexpected header at addr = 0x%08X\n",
+           sectorStart);
+    flash_.flashEraseSector(sector);
+  }
+  header.magic = kSectorHeaderMagic;
+  header.version = kSectorLayoutVersion;
+  header.sampleSize = (uint8_t)(sampleSize_);
+  header.sequence = nextSequence_++;
+  header.firstSeconds = TIME_ACCESSOR::Seconds(data);
+  header.count = UINT32_MAX;
+  return flash_.flashWrite(sectorStart, (uint32_t*)(&header),
+                           sizeof(SectorHeader));
+}
+
+template <typename T, typename TIME_ACCESSOR>
+bool FlashSamples<T, TIME_ACCESSOR>::CloseSector(uint32_t addr) {
+  // The count was left erased when writing the header, so it can still be
+  // programmed
+  uint32_t count = slotsPerSector_;
+  uint32_t sectorStart = (addr / flashSectorSize_) * flashSectorSize_;
+  return flash_.flashWrite(sectorStart + offsetof(SectorHeader, count), &count,
+                           sizeof(count));
+}
+
+template <typename T, typename TIME_ACCESSOR>
+void FlashSamples<T, TIME_ACCESSOR>::Info() {
   printf("Sample Size               : %u", sampleSize_);
   printf("Flash Storage Start       : 0x%08X", flashStorageStart_);
   printf("Flash Storage Length      : 0x%08X", flashStorageLength_);
   printf("Number of Sectors in Use  : %u", SectorsInUse());
+  printf("Samples per Sector        : %u", slotsPerSector_);
   printf("Capacity (in samples)     : %u", NominalCapacity());
   if (scanned_) {
     printf("First Sample Addr         : 0x%08X", firstSampleAddr_);
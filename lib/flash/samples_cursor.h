@@ -0,0 +1,91 @@
+#ifndef AAQIM_SAMPLES_CURSOR_H
+#define AAQIM_SAMPLES_CURSOR_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/** Direction of the iteration in the samples serie.
+ *
+ *   - Backward : from the most recent to the oldest samples (increasing index)
+ *   - Forward : from the oldest to the most recent samples (decreasing index)
+ */
+enum class CursorDirection : uint8_t { Backward, Forward };
+
+/**
+ * Iterate over the samples of a FlashSamples, reading a page of samples at a
+ * time (with ReadSamples) rather than one flash access per sample.
+ *
+ * @param SAMPLES_SRC samples accessor (FlashSamples or compatible)
+ * @param PAGE_SIZE size in bytes of the read ahead buffer
+ */
+template <typename SAMPLES_SRC, size_t PAGE_SIZE = 256>
+class SamplesCursor {
+ public:
+  typedef typename SAMPLES_SRC::SampleType SampleType;
+
+  static const size_t kPageSamples = (PAGE_SIZE / sizeof(SampleType)) > 0
+                                         ? (PAGE_SIZE / sizeof(SampleType))
+                                         : 1;
+
+  /**
+   * @param src samples accessor (should have been scanned already)
+   * @param index index of the first sample returned by Next()
+   * @param direction see CursorDirection
+   */
+  SamplesCursor(SAMPLES_SRC &src, size_t index,
+                CursorDirection direction = CursorDirection::Backward)
+      : src_(src),
+        direction_(direction),
+        index_(index),
+        pageStart_(0),
+        pageCount_(0) {}
+
+  /** Retrieve the next sample
+   * @return false when there is no more samples in this direction
+   */
+  bool Next(SampleType &data) {
+    if (index_ == SIZE_MAX) {
+      return false;
+    }
+    if (index_ < pageStart_ || index_ >= pageStart_ + pageCount_) {
+      if (!Load()) {
+        index_ = SIZE_MAX;
+        return false;
+      }
+    }
+    data = page_[index_ - pageStart_];
+    if (direction_ == CursorDirection::Backward) {
+      index_++;
+    } else {
+      index_ = (index_ == 0) ? SIZE_MAX : index_ - 1;
+    }
+    return true;
+  }
+
+  /** Index of the sample to be returned by the next call to Next(), or
+   * SIZE_MAX if the cursor reached the end of the serie.
+   */
+  size_t Index() const { return index_; }
+
+ protected:
+  bool Load() {
+    size_t count = kPageSamples;
+    if (direction_ == CursorDirection::Backward) {
+      pageStart_ = index_;
+    } else {
+      pageStart_ = (index_ + 1 > kPageSamples) ? index_ + 1 - kPageSamples : 0;
+      count = index_ + 1 - pageStart_;
+    }
+    pageCount_ = src_.ReadSamples(pageStart_, count, page_);
+    return (index_ < pageStart_ + pageCount_);
+  }
+
+  SAMPLES_SRC &src_;
+  const CursorDirection direction_;
+  size_t index_;
+  size_t pageStart_;
+  size_t pageCount_;
+  SampleType page_[kPageSamples];
+};
+
+#endif
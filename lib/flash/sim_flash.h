@@ -37,14 +37,20 @@ class SimFlash : public AbstractFlash {
   bool flashWrite(uint32_t offset, uint32_t* data, size_t size) {
     if (FS_PHYS_ADDR <= offset &&
         (offset + size) < (FS_PHYS_ADDR + FS_PHYS_SIZE)) {
+      // Like NOR flash, writing can only clear bits. Bytes written as 0xFF
+      // leave the flash untouched (used to append to a partial word), but
+      // any attempt to set a bit back to one is reported as an error.
+      const uint8_t* bytes = (const uint8_t*)(data);
       uint32_t index = offset - FS_PHYS_ADDR;
       for (uint32_t i = 0; i < size; i++) {
-        if (memory_[index] != 0xFF) {
+        if ((memory_[index + i] & bytes[i]) != bytes[i] &&
+            bytes[i] != 0xFF) {
           return false;
         }
-        index++;
       }
-      memcpy(memory_ + offset - FS_PHYS_ADDR, data, size);
+      for (uint32_t i = 0; i < size; i++) {
+        memory_[index + i] &= bytes[i];
+      }
       return true;
     } else {
       return false;
@@ -0,0 +1,23 @@
+#ifndef AAQIM_ABSTRACT_STORE_H
+#define AAQIM_ABSTRACT_STORE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/** Size of the RTC user memory of the ESP8266 (see RtcStore), in bytes */
+const size_t kRtcUserMemorySize = 512;
+
+/** Minimal abstraction of a small persistent memory, to keep some state
+ * between two wake ups (deep sleep resets the RAM).
+ *
+ * Offsets and sizes are expressed in bytes, and should be multiple of 4.
+ */
+class AbstractStore {
+ public:
+  virtual bool Read(uint32_t offset, uint32_t* data, size_t size) = 0;
+  virtual bool Write(uint32_t offset, const uint32_t* data, size_t size) = 0;
+  /** Number of bytes available */
+  virtual size_t Capacity() const = 0;
+};
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef AAQIM_FILE_STORE_H
+#define AAQIM_FILE_STORE_H
+
+#include "abstract_store.h"
+
+#if !defined(ARDUINO)
+
+#include <stdio.h>
+
+/** Stand-in for the RTC memory on native: the content is kept in a file, so
+ * it survives the end of the process like the RTC memory survives the deep
+ * sleep.
+ */
+class FileStore : public AbstractStore {
+ public:
+  FileStore(const char* path, size_t capacity = 512)
+      : path_(path), capacity_(capacity) {}
+
+  bool Read(uint32_t offset, uint32_t* data, size_t size) {
+    if (offset + size > capacity_) {
+      return false;
+    }
+    FILE* file = fopen(path_, "rb");
+    if (file == NULL) {
+      return false;
+    }
+    bool result = (fseek(file, offset, SEEK_SET) == 0 &&
+                   fread(data, 1, size, file) == size);
+    fclose(file);
+    return result;
+  }
+
+  bool Write(uint32_t offset, const uint32_t* data, size_t size) {
+    if (offset + size > capacity_) {
+      return false;
+    }
+    FILE* file = fopen(path_, "r+b");
+    if (file == NULL) {
+      file = fopen(path_, "w+b");
+    }
+    if (file == NULL) {
+      return false;
+    }
+    bool result = (fseek(file, offset, SEEK_SET) == 0 &&
+                   fwrite(data, 1, size, file) == size);
+    fclose(file);
+    return result;
+  }
+
+  size_t Capacity() const { return capacity_; }
+
+  /** Forget the content (like a power off for the RTC memory) */
+  void Clear() { remove(path_); }
+
+ protected:
+  const char* path_;
+  const size_t capacity_;
+};
+
+#endif  // if !defined(ARDUINO)
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef AAQIM_MEMORY_STORE_H
+#define AAQIM_MEMORY_STORE_H
+
+#include <string.h>
+
+#include "abstract_store.h"
+
+/** Volatile store in RAM, of the size of the RTC user memory: to force a
+ * rebuild of the states saved in a store, or to stand for the RTC memory
+ * across simulated wake ups on native.
+ */
+class MemoryStore : public AbstractStore {
+ public:
+  MemoryStore() { Clear(); }
+
+  bool Read(uint32_t offset, uint32_t* data, size_t size) {
+    if (offset + size > sizeof(words_)) {
+      return false;
+    }
+    memcpy(data, (uint8_t*)(words_) + offset, size);
+    return true;
+  }
+
+  bool Write(uint32_t offset, const uint32_t* data, size_t size) {
+    if (offset + size > sizeof(words_)) {
+      return false;
+    }
+    memcpy((uint8_t*)(words_) + offset, data, size);
+    return true;
+  }
+
+  size_t Capacity() const { return sizeof(words_); }
+
+  /** Forget the content (like a power off for the RTC memory) */
+  void Clear() { memset(words_, 0, sizeof(words_)); }
+
+ protected:
+  uint32_t words_[kRtcUserMemorySize / 4];
+};
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef AAQIM_RTC_STORE_H
+#define AAQIM_RTC_STORE_H
+
+#include "abstract_store.h"
+
+#if defined(ARDUINO)
+
+#include <Arduino.h>
+
+/** Store in the RTC user memory of the ESP8266: preserved during deep sleep,
+ * but lost on power off (users of the store should check their data, with a
+ * magic number and a crc for example).
+ *
+ * The eboot command used by OTA updates lives in the first 128 bytes of the
+ * user memory, so use a startOffset of 128 when doing OTA.
+ */
+class RtcStore : public AbstractStore {
+ public:
+  RtcStore(uint32_t startOffset = 0) : startOffset_(startOffset) {}
+
+  bool Read(uint32_t offset, uint32_t* data, size_t size) {
+    return ESP.rtcUserMemoryRead((startOffset_ + offset) / 4, data, size);
+  }
+
+  bool Write(uint32_t offset, const uint32_t* data, size_t size) {
+    return ESP.rtcUserMemoryWrite((startOffset_ + offset) / 4,
+                                  (uint32_t*)(data), size);
+  }
+
+  size_t Capacity() const { return kRtcUserMemorySize - startOffset_; }
+
+ protected:
+  const uint32_t startOffset_;
+};
+
+#endif  // if defined(ARDUINO)
+
+#endif
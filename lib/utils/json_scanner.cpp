@@ -0,0 +1,161 @@
+#include "json_scanner.h"
+
+#include <string.h>
+
+void JsonScanner::Reset() {
+  nested_ = nullptr;
+  objects_ = 0;
+  depth_ = 0;
+  state_ = State::Between;
+  expectKey_ = false;
+  escape_ = false;
+  unicode_ = 0;
+  complete_ = false;
+  error_ = false;
+  length_ = 0;
+  token_[0] = '\0';
+  key_[0] = '\0';
+}
+
+void JsonScanner::Append(char c) {
+  if (length_ < kMaxTokenLength) {
+    token_[length_++] = c;
+  }
+}
+
+void JsonScanner::EndString() {
+  token_[length_] = '\0';
+  if (state_ == State::Key) {
+    memcpy(key_, token_, length_ + 1);
+  } else if (state_ == State::Value) {
+    handler_.OnValue(depth_, InObject() ? key_ : "", token_);
+  }
+  nested_ = nullptr;
+  state_ = State::Between;
+}
+
+bool JsonScanner::Feed(char c) {
+  if (error_) {
+    return false;
+  }
+  switch (state_) {
+    case State::Key:
+    case State::Value:
+    case State::Nested:
+      if (unicode_ > 0) {
+        // not decoded
+        if (--unicode_ == 0) {
+          c = '?';
+        } else {
+          return true;
+        }
+      } else if (escape_) {
+        const char *escapes = "b\bf\fn\nr\rt\t";
+        const char *found = strchr(escapes, c);
+        if (c == 'u') {
+          unicode_ = 4;
+          escape_ = false;
+          return true;
+        } else if (c != '\0' && found != nullptr &&
+                   (found - escapes) % 2 == 0) {
+          c = found[1];
+        }
+      } else if (c == '\\') {
+        escape_ = true;
+        return true;
+      } else if (c == '"') {
+        EndString();
+        return true;
+      }
+      escape_ = false;
+      if (state_ == State::Nested) {
+        nested_->Feed(c);
+      } else {
+        Append(c);
+      }
+      return true;
+
+    case State::Literal:
+      if (c == ',' || c == '}' || c == ']' || c == ' ' || c == '\t' ||
+          c == '\n' || c == '\r') {
+        token_[length_] = '\0';
+        handler_.OnValue(depth_, InObject() ? key_ : "", token_);
+        state_ = State::Between;
+        return Between(c);
+      }
+      Append(c);
+      return true;
+
+    case State::Between:
+      return Between(c);
+  }
+  return true;
+}
+
+bool JsonScanner::Between(char c) {
+  switch (c) {
+    case ' ':
+    case '\t':
+    case '\n':
+    case '\r':
+      break;
+    case '{':
+    case '[': {
+      if (depth_ >= kMaxDepth || complete_) {
+        error_ = true;
+        break;
+      }
+      const char *key = InObject() ? key_ : "";
+      if (c == '{') {
+        objects_ |= (uint32_t)(1) << depth_;
+      } else {
+        objects_ &= ~((uint32_t)(1) << depth_);
+      }
+      depth_++;
+      handler_.OnStart(depth_, key, c == '{');
+      expectKey_ = (c == '{');
+      break;
+    }
+    case '}':
+    case ']':
+      if (depth_ == 0 || InObject() != (c == '}')) {
+        error_ = true;
+        break;
+      }
+      handler_.OnEnd(depth_, c == '}');
+      depth_--;
+      complete_ = (depth_ == 0);
+      expectKey_ = false;
+      break;
+    case ',':
+      expectKey_ = InObject();
+      break;
+    case ':':
+      expectKey_ = false;
+      break;
+    case '"':
+      length_ = 0;
+      if (expectKey_) {
+        state_ = State::Key;
+      } else {
+        nested_ = handler_.NestedScanner(depth_, InObject() ? key_ : "");
+        if (nested_ != nullptr) {
+          nested_->Reset();
+          state_ = State::Nested;
+        } else {
+          state_ = State::Value;
+        }
+      }
+      break;
+    default:
+      if (depth_ == 0) {
+        error_ = true;
+        break;
+      }
+      length_ = 0;
+      Append(c);
+      state_ = State::Literal;
+      break;
+  }
+  return !error_;
+}
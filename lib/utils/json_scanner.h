@@ -0,0 +1,95 @@
+#ifndef AAQIM_JSON_SCANNER_H
+#define AAQIM_JSON_SCANNER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+class JsonScanner;
+
+/** Receives the events of a JsonScanner */
+class JsonHandler {
+ public:
+  virtual ~JsonHandler() {}
+
+  /** Start of an object or an array (depth 1 for the root)
+   * @param key of the object or array, empty in the arrays and for the root */
+  virtual void OnStart(uint8_t depth, const char *key, bool object) {}
+
+  virtual void OnEnd(uint8_t depth, bool object) {}
+
+  /**
+   * Scalar value: unescaped string (truncated to kMaxTokenLength), number,
+   * true, false or null.
+   * @param depth of the object or array holding the value
+   * @param key of the value, empty in the arrays
+   */
+  virtual void OnValue(uint8_t depth, const char *key, const char *value) = 0;
+
+  /** Scanner of the content of a string value holding JSON (nullptr for a
+   * regular string): the string is unescaped and fed to this scanner, instead
+   * of being reported by OnValue. */
+  virtual JsonScanner *NestedScanner(uint8_t depth, const char *key) {
+    return nullptr;
+  }
+};
+
+/**
+ * Streaming (SAX style) JSON scanner: the document is fed a character at a
+ * time and the handler is called for each value, so only the current key and
+ * value are kept in memory (no document, no heap).
+ *
+ * The syntax is only partially checked (nesting, unexpected characters).
+ */
+class JsonScanner {
+ public:
+  static const size_t kMaxTokenLength = 31;
+  static const uint8_t kMaxDepth = 32;
+
+  explicit JsonScanner(JsonHandler &handler) : handler_(handler) { Reset(); }
+
+  void Reset();
+
+  /** @return false once a syntax error was found (the next characters are
+   * ignored) */
+  bool Feed(char c);
+
+  bool Feed(const char *data, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+      if (!Feed(data[i])) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  /** Was the root object or array closed? */
+  bool IsComplete() const { return complete_; }
+
+  bool HasError() const { return error_; }
+
+ protected:
+  enum class State : uint8_t { Between, Key, Value, Nested, Literal };
+
+  bool Between(char c);
+  void EndString();
+  void Append(char c);
+  bool InObject() const {
+    return depth_ > 0 && (objects_ & ((uint32_t)(1) << (depth_ - 1)));
+  }
+
+  JsonHandler &handler_;
+  JsonScanner *nested_;
+  uint32_t objects_;  // bit i set if the container of depth i + 1 is an object
+  uint8_t depth_;
+  State state_;
+  bool expectKey_;
+  bool escape_;
+  uint8_t unicode_;  // hex digits of a \u escape left to skip
+  bool complete_;
+  bool error_;
+  uint8_t length_;
+  char token_[kMaxTokenLength + 1];
+  char key_[kMaxTokenLength + 1];
+};
+
+#endif
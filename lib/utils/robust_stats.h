@@ -0,0 +1,297 @@
+#ifndef AAQIM_ROBUST_STATS_H
+#define AAQIM_ROBUST_STATS_H
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/** Scale of the MAD to estimate the standard deviation of a normal serie */
+const float kMadToSigma = 1.4826f;
+
+/** Order two values with a min and a max (conditional moves, or minss and
+ * maxss for the floats), rather than a data dependent branch */
+template <typename T>
+inline void compare_swap(T &a, T &b) {
+  const T low = (b < a) ? b : a;
+  b = (a < b) ? b : a;
+  a = low;
+}
+
+/**
+ * Sorting networks (optimal number of comparators, see Knuth TAOCP vol. 3):
+ * fixed sequences of compare and swap, fully unrolled at compile time and
+ * without data dependent branches (see compare_swap).
+ */
+template <size_t N>
+struct SortingNetwork;
+
+template <>
+struct SortingNetwork<2> {
+  template <typename T>
+  static void Sort(T v[]) {
+    compare_swap(v[0], v[1]);
+  }
+};
+
+template <>
+struct SortingNetwork<3> {
+  template <typename T>
+  static void Sort(T v[]) {
+    compare_swap(v[1], v[2]);
+    compare_swap(v[0], v[2]);
+    compare_swap(v[0], v[1]);
+  }
+};
+
+template <>
+struct SortingNetwork<4> {
+  template <typename T>
+  static void Sort(T v[]) {
+    compare_swap(v[0], v[1]);
+    compare_swap(v[2], v[3]);
+    compare_swap(v[0], v[2]);
+    compare_swap(v[1], v[3]);
+    compare_swap(v[1], v[2]);
+  }
+};
+
+template <>
+struct SortingNetwork<5> {
+  template <typename T>
+  static void Sort(T v[]) {
+    compare_swap(v[0], v[1]);
+    compare_swap(v[3], v[4]);
+    compare_swap(v[2], v[4]);
+    compare_swap(v[2], v[3]);
+    compare_swap(v[1], v[4]);
+    compare_swap(v[0], v[3]);
+    compare_swap(v[0], v[2]);
+    compare_swap(v[1], v[3]);
+    compare_swap(v[1], v[2]);
+  }
+};
+
+template <>
+struct SortingNetwork<6> {
+  template <typename T>
+  static void Sort(T v[]) {
+    compare_swap(v[1], v[2]);
+    compare_swap(v[4], v[5]);
+    compare_swap(v[0], v[2]);
+    compare_swap(v[3], v[5]);
+    compare_swap(v[0], v[1]);
+    compare_swap(v[3], v[4]);
+    compare_swap(v[2], v[5]);
+    compare_swap(v[0], v[3]);
+    compare_swap(v[1], v[4]);
+    compare_swap(v[2], v[4]);
+    compare_swap(v[1], v[3]);
+    compare_swap(v[2], v[3]);
+  }
+};
+
+template <>
+struct SortingNetwork<7> {
+  template <typename T>
+  static void Sort(T v[]) {
+    compare_swap(v[1], v[2]);
+    compare_swap(v[3], v[4]);
+    compare_swap(v[5], v[6]);
+    compare_swap(v[0], v[2]);
+    compare_swap(v[3], v[5]);
+    compare_swap(v[4], v[6]);
+    compare_swap(v[0], v[1]);
+    compare_swap(v[4], v[5]);
+    compare_swap(v[2], v[6]);
+    compare_swap(v[0], v[4]);
+    compare_swap(v[1], v[5]);
+    compare_swap(v[0], v[3]);
+    compare_swap(v[2], v[5]);
+    compare_swap(v[1], v[3]);
+    compare_swap(v[2], v[4]);
+    compare_swap(v[2], v[3]);
+  }
+};
+
+template <>
+struct SortingNetwork<8> {
+  template <typename T>
+  static void Sort(T v[]) {
+    compare_swap(v[0], v[1]);
+    compare_swap(v[2], v[3]);
+    compare_swap(v[4], v[5]);
+    compare_swap(v[6], v[7]);
+    compare_swap(v[0], v[2]);
+    compare_swap(v[1], v[3]);
+    compare_swap(v[4], v[6]);
+    compare_swap(v[5], v[7]);
+    compare_swap(v[1], v[2]);
+    compare_swap(v[5], v[6]);
+    compare_swap(v[0], v[4]);
+    compare_swap(v[3], v[7]);
+    compare_swap(v[1], v[5]);
+    compare_swap(v[2], v[6]);
+    compare_swap(v[1], v[4]);
+    compare_swap(v[3], v[6]);
+    compare_swap(v[2], v[4]);
+    compare_swap(v[3], v[5]);
+    compare_swap(v[3], v[4]);
+  }
+};
+
+/** Sort a few values in place: sorting network up to 8 values, insertion
+ * sort above. */
+template <typename T>
+void sort_small(T v[], size_t n) {
+  switch (n) {
+    case 0:
+    case 1:
+      return;
+    case 2:
+      return SortingNetwork<2>::Sort(v);
+    case 3:
+      return SortingNetwork<3>::Sort(v);
+    case 4:
+      return SortingNetwork<4>::Sort(v);
+    case 5:
+      return SortingNetwork<5>::Sort(v);
+    case 6:
+      return SortingNetwork<6>::Sort(v);
+    case 7:
+      return SortingNetwork<7>::Sort(v);
+    case 8:
+      return SortingNetwork<8>::Sort(v);
+  }
+  for (size_t i = 1; i < n; i++) {
+    T value = v[i];
+    size_t j = i;
+    while (j > 0 && value < v[j - 1]) {
+      v[j] = v[j - 1];
+      j--;
+    }
+    v[j] = value;
+  }
+}
+
+/** Median of sorted values */
+template <typename T>
+float sorted_median(const T v[], size_t n) {
+  return (n % 2 == 1) ? (float)(v[n / 2])
+                      : ((float)(v[n / 2 - 1]) + (float)(v[n / 2])) / 2.0f;
+}
+
+struct FusionResult {
+  float mean;        /** weighted mean of the kept values */
+  float mae;         /** mean absolute error of the kept values to the mean */
+  float median;      /** median of all the values */
+  float mad;         /** median absolute deviation of all the values */
+  size_t kept;       /** number of values kept */
+};
+
+/**
+ * Fusion of the readings of a few sensors, robust to outliers: the values
+ * further from the median than `threshold` standard deviations (estimated
+ * from the MAD) are rejected, then the weighted mean of the others is
+ * computed (trimmed mean).
+ *
+ * Fixed capacity, no heap: the values are sorted with sorting networks up to
+ * 8 sensors.
+ * @param CAPACITY max number of values
+ */
+template <size_t CAPACITY>
+class SensorFusion {
+ public:
+  SensorFusion() : count_(0) {}
+
+  /** @param weight relative confidence in the value (> 0)
+   * @return false if full */
+  bool Add(float value, float weight = 1.0f) {
+    if (count_ >= CAPACITY) {
+      return false;
+    }
+    values_[count_] = value;
+    weights_[count_] = weight;
+    count_++;
+    return true;
+  }
+
+  size_t Count() const { return count_; }
+
+  /**
+   * @param threshold rejection threshold, in standard deviations (0 to keep
+   *                  all the values)
+   * @param minSigma lower bound of the standard deviation, so close values
+   *                 are not rejected when the others are equal (MAD = 0)
+   * @param kept optional, set for each value (Count() of them) to whether
+   *             it was kept
+   * @return false if there is no value
+   */
+  bool Fuse(float threshold, float minSigma, FusionResult &result,
+            bool kept[] = nullptr) const;
+
+ protected:
+  float values_[CAPACITY];
+  float weights_[CAPACITY];
+  size_t count_;
+};
+
+template <size_t CAPACITY>
+bool SensorFusion<CAPACITY>::Fuse(float threshold, float minSigma,
+                                  FusionResult &result,
+                                  bool kept[]) const {
+  result.kept = 0;
+  if (count_ == 0) {
+    return false;
+  }
+
+  float sorted[CAPACITY];
+  for (size_t i = 0; i < count_; i++) {
+    sorted[i] = values_[i];
+  }
+  sort_small(sorted, count_);
+  result.median = sorted_median(sorted, count_);
+  for (size_t i = 0; i < count_; i++) {
+    sorted[i] = fabsf(values_[i] - result.median);
+  }
+  sort_small(sorted, count_);
+  result.mad = sorted_median(sorted, count_);
+
+  float sigma = kMadToSigma * result.mad;
+  if (sigma < minSigma) {
+    sigma = minSigma;
+  }
+  const float maxDeviation = threshold * sigma;
+  float sum = 0.0f;
+  float weights = 0.0f;
+  for (size_t i = 0; i < count_; i++) {
+    const bool keep = threshold <= 0.0f ||
+                      fabsf(values_[i] - result.median) <= maxDeviation;
+    if (kept != nullptr) {
+      kept[i] = keep;
+    }
+    if (keep) {
+      sum += weights_[i] * values_[i];
+      weights += weights_[i];
+      result.kept++;
+    }
+  }
+  if (result.kept == 0) {
+    // only with a threshold below the MAD
+    result.mean = result.median;
+    result.mae = result.mad;
+    return true;
+  }
+  result.mean = sum / weights;
+
+  float error = 0.0f;
+  for (size_t i = 0; i < count_; i++) {
+    if (threshold <= 0.0f ||
+        fabsf(values_[i] - result.median) <= maxDeviation) {
+      error += fabsf(values_[i] - result.mean);
+    }
+  }
+  result.mae = error / (float)(result.kept);
+  return true;
+}
+
+#endif
@@ -2,13 +2,121 @@
 #define AAQIM_STATS_H
 
 #include <math.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 
+/**
+ * Single pass statistics of a serie: count, min, max, mean and variance
+ * (Welford's algorithm, numerically stable), and the Mean Absolute Error.
+ *
+ * Accumulators of different buckets or sensors can be merged (Chan et al.
+ * parallel variance). The MAE is a one pass estimate: the deviations to the
+ * running mean are accumulated like the variance (n1.n2/n |mean1 - mean2| for
+ * each merge, n/(n+1) |x - mean| for each new value). It is exact for
+ * constant series and close for stationary ones (0.88 instead of 0.86 for
+ * 1,2,3,3,3,4,5), use mean_error when all the values are available.
+ *
+ * Plain data (trivially copyable), so it can be persisted as is.
+ */
+template <class T>
+class StatsAccumulator {
+ public:
+  StatsAccumulator() { Reset(); }
+
+  void Reset() {
+    count_ = 0;
+    mean_ = 0.0f;
+    m2_ = 0.0f;
+    deviation_ = 0.0f;
+    min_ = 0;
+    max_ = 0;
+  }
+
+  void Add(T value) { AddAggregate(1, (float)(value), value, value); }
+
+  /** Add `count` values of the given mean (like a RollupData record), whose
+   * spread is unknown. */
+  void AddAggregate(uint32_t count, float mean, T min, T max) {
+    if (count > 0) {
+      UpdateLimits(min, max);
+      Combine(count, mean, 0.0f, 0.0f);
+    }
+  }
+
+  void Merge(const StatsAccumulator &other) {
+    if (other.count_ > 0) {
+      UpdateLimits(other.min_, other.max_);
+      Combine(other.count_, other.mean_, other.m2_, other.deviation_);
+    }
+  }
+
+  uint32_t Count() const { return count_; }
+
+  bool IsEmpty() const { return count_ == 0; }
+
+  T Mean() const { return static_cast<T>(mean_); }
+
+  T Min() const { return min_; }
+
+  T Max() const { return max_; }
+
+  /** Population variance */
+  float Variance() const {
+    return (count_ > 0) ? m2_ / (float)(count_) : 0.0f;
+  }
+
+  float StdDev() const { return sqrtf(Variance()); }
+
+  T Mae() const {
+    return static_cast<T>((count_ > 0) ? deviation_ / (float)(count_) : 0.0f);
+  }
+
+  /** MAE normalized by the mean, 0 when the mean is 0 */
+  float Nmae() const {
+    return (mean_ != 0.0f) ? deviation_ / (float)(count_) / fabsf(mean_)
+                           : 0.0f;
+  }
+
+ protected:
+  void UpdateLimits(T min, T max) {
+    if (count_ == 0 || min < min_) {
+      min_ = min;
+    }
+    if (count_ == 0 || max > max_) {
+      max_ = max;
+    }
+  }
+
+  void Combine(uint32_t count, float mean, float m2, float deviation) {
+    const float total = (float)(count_) + (float)(count);
+    const float delta = mean - mean_;
+    const float weight = (float)(count_) * (float)(count) / total;
+    m2_ += m2 + delta * delta * weight;
+    deviation_ += deviation + fabsf(delta) * weight;
+    mean_ += delta * (float)(count) / total;
+    count_ += count;
+  }
+
+  uint32_t count_;
+  float mean_;
+  float m2_;        // sum of the squared differences to the mean
+  float deviation_; // sum of the absolute differences to the mean (estimate)
+  T min_;
+  T max_;
+};
+
 /** Compute the arithmetic mean of the provided array, together with the Mean
- * Absolute Error (MAE) and the Normalized Mean Absolute Error. (NMAE)*/
+ * Absolute Error (MAE) and the Normalized Mean Absolute Error (NMAE, 0 when
+ * the sum is 0). The MAE is exact (second pass over the data), see
+ * StatsAccumulator for the streaming version. */
 template <class T>
 T mean_error(size_t size, const T data[], T &mae, float &nmae) {
+  if (size == 0) {
+    mae = 0;
+    nmae = 0.0f;
+    return 0;
+  }
   T sum = 0;
   for (size_t i = 0; i < size; i++) {
     sum += data[i];
@@ -19,7 +127,7 @@ T mean_error(size_t size, const T data[], T &mae, float &nmae) {
     error += fabs(data[i] - mean);
   }
   mae = static_cast<T>(error / (float)(size));
-  nmae = error / (float)(sum);
+  nmae = (sum != 0) ? error / (float)(sum) : 0.0f;
   return mean;
 }
 
@@ -0,0 +1,49 @@
+#ifndef AAQIM_VARINT_H
+#define AAQIM_VARINT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Variable length encoding of integers (LEB128 style: 7 bits per byte, the
+// most significant bit set when more bytes follow), plus the zigzag mapping
+// so small negative differences also fit in a single byte.
+
+const size_t kMaxVarintSize = 5;  // for 32 bits values
+
+inline uint32_t zigzag_encode(int32_t value) {
+  return ((uint32_t)(value) << 1) ^ (uint32_t)(value >> 31);
+}
+
+inline int32_t zigzag_decode(uint32_t value) {
+  return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+/** Write value at out (at least kMaxVarintSize bytes available)
+ * @return number of bytes written
+ */
+inline size_t varint_write(uint32_t value, uint8_t *out) {
+  size_t size = 0;
+  while (value >= 0x80) {
+    out[size++] = (uint8_t)(value) | 0x80;
+    value >>= 7;
+  }
+  out[size++] = (uint8_t)(value);
+  return size;
+}
+
+/** Read a value from at most `available` bytes
+ * @return number of bytes consumed, 0 if the encoding is not complete
+ */
+inline size_t varint_read(const uint8_t *in, size_t available,
+                          uint32_t &value) {
+  value = 0;
+  for (size_t i = 0; i < available && i < kMaxVarintSize; i++) {
+    value |= (uint32_t)(in[i] & 0x7F) << (7 * i);
+    if ((in[i] & 0x80) == 0) {
+      return i + 1;
+    }
+  }
+  return 0;
+}
+
+#endif
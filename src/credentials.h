@@ -4,3 +4,6 @@
 // (burning them to flash will come later)
 static const char SSID[] = "********";
 static const char PASS[] = "********";
+
+// Key of the PurpleAir API (see USE_PURPLE_AIR_API)
+static const char PURPLE_AIR_API_KEY[] = "********";
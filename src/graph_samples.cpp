@@ -9,7 +9,8 @@
 constexpr int16_t kGraphXstart = 2;
 constexpr int16_t kGraphYstart = EPD_HEIGHT - 2;
 
-int16_t GraphSamples::ValueToVerticalPixel(int16_t value) {
+template <typename AGGREGATOR, typename FIELD>
+int16_t GraphSamples<AGGREGATOR, FIELD>::ValueToVerticalPixel(int16_t value) {
   return (kGraphYstart -
           kGraphHeight * (value - lowerLimit_) / (upperLimit_ - lowerLimit_));
 }
@@ -18,7 +19,8 @@ int16_t GraphSamples::ValueToVerticalPixel(int16_t value) {
 const size_t kMaxRandomNumbers = 2048;
 uint32_t gRandoms[kMaxRandomNumbers];
 
-void GraphSamples::Labels() {
+template <typename AGGREGATOR, typename FIELD>
+void GraphSamples<AGGREGATOR, FIELD>::Labels() {
   // char buffer[8];
   blackCanvas_->setTextColor(1);
   blackCanvas_->setTextSize(1);
@@ -67,7 +69,8 @@ void GraphSamples::Labels() {
   blackCanvas_->print("00");
 }
 
-void GraphSamples::Background() {
+template <typename AGGREGATOR, typename FIELD>
+void GraphSamples<AGGREGATOR, FIELD>::Background() {
   // Let's have some fun: I do not know how to various shade of
   // grey with dithering, so just draw random dots with various
   // densities! The EPS has a real random generator that can 
@@ -105,7 +108,8 @@ void GraphSamples::Background() {
   }
 }
 
-void GraphSamples::Grid() {
+template <typename AGGREGATOR, typename FIELD>
+void GraphSamples<AGGREGATOR, FIELD>::Grid() {
   // Grid (we also "clear" the Red canvas)
   for (int16_t h = 0; h < 5; h++) {
     int16_t x = kGraphXstart + h * kGraphWidth / 4;
@@ -119,7 +123,8 @@ void GraphSamples::Grid() {
   }
 }
 
-void GraphSamples::Serie() {
+template <typename AGGREGATOR, typename FIELD>
+void GraphSamples<AGGREGATOR, FIELD>::Serie() {
   // Actually draw the Time Serie :-)
   int16_t y1 = 0;
   // It is actually necessary to draw twice: on the black buffer to see the curve,
@@ -145,7 +150,8 @@ void GraphSamples::Serie() {
   }
 }
 
-void GraphSamples::Draw(GFXcanvas1 *black, GFXcanvas1 *red) {
+template <typename AGGREGATOR, typename FIELD>
+void GraphSamples<AGGREGATOR, FIELD>::Draw(GFXcanvas1 *black, GFXcanvas1 *red) {
   blackCanvas_ = black;
   redCanvas_ = red;
   // Round upper and lower limits to 100 AQI
@@ -157,3 +163,8 @@ void GraphSamples::Draw(GFXcanvas1 *black, GFXcanvas1 *red) {
   Grid();
   Serie();
 }
+
+template class GraphSamples<MeanAggregator>;
+template class GraphSamples<MaxAggregator>;
+template class GraphSamples<P90Aggregator>;
+template class GraphSamples<CodeMeanAggregator, Pm_2_5CodeField>;
@@ -2,20 +2,39 @@
 #define AAQIM_GRAPH_SAMPLES_H
 
 #include "display_samples.h"
+#include "wake_up.h"
 
 class GFXcanvas1;
 
-constexpr int16_t kGraphWidth = 144;
+// kGraphWidth is set with the samples of the graph (see GraphBuffer)
 constexpr int16_t kGraphHeight = 100;
 
-class GraphSamples : public DisplaySamples<kGraphWidth, int16_t> {
+/** AQI graph of the e-paper display
+ * @param AGGREGATOR how the samples of each column are reduced (mean of the
+ *                   concentrations by default, MaxAggregator to show the
+ *                   peaks, CodeMeanAggregator for the integer mean...)
+ * @param FIELD has to match the aggregator (Pm_2_5CodeField for
+ *              CodeMeanAggregator)
+ * See the explicit instantiations in graph_samples.cpp.
+ */
+template <typename AGGREGATOR = MeanAggregator, typename FIELD = Pm_2_5Field>
+class GraphSamples
+    : public DisplaySamples<kGraphWidth, int16_t, AGGREGATOR, FIELD> {
  public:
   GraphSamples(uint32_t period_in_seconds)
-      : DisplaySamples(period_in_seconds) {}
+      : DisplaySamples<kGraphWidth, int16_t, AGGREGATOR, FIELD>(
+            period_in_seconds) {}
 
   void Draw(GFXcanvas1 *black, GFXcanvas1 *red);
 
  protected:
+  typedef DisplaySamples<kGraphWidth, int16_t, AGGREGATOR, FIELD> Base;
+  using Base::length_;
+  using Base::max_;
+  using Base::min_;
+  using Base::period_;
+  using Base::Value;
+
   GFXcanvas1 *blackCanvas_;
   GFXcanvas1 *redCanvas_;
   const int16_t vStep_ = 100;
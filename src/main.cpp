@@ -14,7 +14,16 @@
 #include "credentials.h"
 #include "epd2in7b.h"
 #include "graph_samples.h"
+#include "nowcast_samples.h"
+#include "rollup_archive.h"
+#include "rtc_store.h"
 #include "sensors.h"
+#include "sensors_provider.h"
+#include "wake_up.h"
+
+// Uncomment to request only the fields used from the PurpleAir API (~1KB
+// instead of ~19KB, but https and an API key in credentials.h are required)
+// #define USE_PURPLE_AIR_API
 
 #define COLORED 1
 #define UNCOLORED 0
@@ -24,7 +33,15 @@ Epd epd;
 GFXcanvas1 *canvas[2];
 
 EspFlash gFlash;
-FlashSamples<AirSampleData> gFlashSamples(gFlash, 0xA000);
+FlashSamples<AirSampleData, AirSampleTime> gFlashSamples(gFlash, 0xA000);
+// Down sampled series stored after the raw samples (~160 sectors):
+// one year of hourly and 3 years of daily pm2.5 aggregates.
+RollupFlashSamples gHourlySamples(gFlash, 366 * 24, 0xA0000);
+RollupFlashSamples gDailySamples(gFlash, 1024, 0xC8000);
+RollupArchive<FlashSamples<AirSampleData, AirSampleTime>> gArchive(
+    gFlashSamples);
+// Graph state kept during deep sleep (see the layout in wake_up.h)
+RtcStore gRtcStore;
 
 // Use the AD converted of the ESP8266 to read the chip supply
 // voltage (instean of the analog input pin)
@@ -61,6 +78,10 @@ void setup() {
   Serial.println(ESP.getHeapFragmentation());
 
   gFlashSamples.Begin();
+  gHourlySamples.Begin();
+  gDailySamples.Begin();
+  gArchive.AddTier(gHourlySamples, 3600);
+  gArchive.AddTier(gDailySamples, 24 * 3600);
   printf("nb of sectors in use : %d\n", gFlashSamples.SectorsInUse());
   printf("first addr of reserved : 0x%08X\n",
          gFlashSamples.FlashStorageStart());
@@ -68,6 +89,8 @@ void setup() {
   printf("nominal number of samples : %d\n", gFlashSamples.NominalCapacity());
   printf("current number of samples stored : %d\n",
          gFlashSamples.NumberOfSamples());
+  printf("hourly / daily aggregates stored : %d / %d\n",
+         gHourlySamples.NumberOfSamples(), gDailySamples.NumberOfSamples());
 
   // Wiped flash in 4986 ms
   // nb of sectors in use : 160
@@ -103,24 +126,32 @@ void setup() {
   time_t seconds;
   {
     AirSampleData data;
-    AirSample last;
     gFlashSamples.ReadSample(0, data);
-    last.FromData(data);
-    seconds = last.Seconds();
+    seconds = AirSampleView(data).Seconds();
   }
 
   if (WiFi.status() == WL_CONNECTED) {
     Serial.println();
     Serial.println("WiFi Connected :-)");
+#if defined(USE_PURPLE_AIR_API)
+    // the certificate is not checked
+    BearSSL::WiFiClientSecure client;
+    client.setInsecure();
+    const PurpleAirApiProvider provider(PURPLE_AIR_API_KEY);
+#else
     WiFiClient client;
+    const PurpleAirJsonProvider provider;
+#endif
     HTTPClient http;
 
+    // the sensors chronically rejected are only requested now and then
+    GroupReliability reliability;
+    reliability.Load(gRtcStore, kReliabilityStateOffset);
     AirSensors sensors;
-    for (size_t i = 0; i < sizeof(kSensorIds) / sizeof(size_t); i++) {
-      sensors.AddSensor(kSensorIds[i]);
-    }
+    RequestSensors(kSensorIds, sizeof(kSensorIds) / sizeof(size_t),
+                   reliability, sensors);
     Serial.println("Update data");
-    sensors.UpdateData(client, http);
+    sensors.UpdateData(client, http, provider);
     Serial.println("List of sensors");
     sensors.PrintAllData();
 
@@ -143,7 +174,9 @@ void setup() {
 
     AirSample sample;
     int32_t primaryIndex;
-    size_t nbSamples = ComputeStats(sensors, sample, primaryIndex);
+    size_t nbSamples =
+        ComputeStats(sensors, sample, primaryIndex, nullptr, &reliability);
+    reliability.Save(gRtcStore, kReliabilityStateOffset);
 #if 0
     // Photo Op only :-)
     sample.Set(sample.Seconds(), 0.0, 98.1, 0.0, 0.0, 0, 0, sample.SamplesCount(), 18.4);
@@ -154,7 +187,12 @@ void setup() {
       // Store permanently sample to flash
       AirSampleData compacted;
       sample.ToData(compacted);
-      gFlashSamples.StoreSample(compacted);
+      gArchive.StoreSample(compacted);
+
+      // hourly buckets saved in RTC memory after the graph state
+      NowCastSamples nowcast;
+      nowcast.Update(gFlashSamples, sample.Seconds(), gRtcStore,
+                     kNowCastStateOffset);
 
       seconds = sample.Seconds();
       time_t localSeconds = seconds + kTimeZoneOffsetSeconds;
@@ -176,6 +214,8 @@ void setup() {
       Serial.print(aqi);
       Serial.print(" --> ");
       Serial.println(AqiNames[static_cast<int>(sample.Level())]);
+      Serial.print("NowCast AQI = ");
+      Serial.println(nowcast.Aqi());
       if (aqi > 100) {
         canvas[1]->fillRoundRect(6, 29, EPD_WIDTH - 2 * 6, 70, 8, COLORED);
         canvas[1]->fillRoundRect(10, 33, EPD_WIDTH - 2 * 10, 62, 4, UNCOLORED);
@@ -192,7 +232,11 @@ void setup() {
         canvas[1]->fillRoundRect(28, 134, EPD_WIDTH - 2 * 28, 24, 6, COLORED);
         canvas[1]->fillRoundRect(30, 136, EPD_WIDTH - 2 * 30, 20, 4, UNCOLORED);
       }
-      sprintf(msg, "MAE=%.1f / #%d/%d", sample.MaeValue(), primaryIndex+1, sample.SamplesCount());
+      if (nowcast.IsValid()) {
+        sprintf(msg, "NC=%d MAE=%.0f", nowcast.Aqi(), sample.MaeValue());
+      } else {
+        sprintf(msg, "MAE=%.1f / #%d/%d", sample.MaeValue(), primaryIndex+1, sample.SamplesCount());
+      }
       CenterText(&ClearSans_Medium12pt7b, msg, 152);
 
 #if 0
@@ -241,8 +285,14 @@ void setup() {
     CenterText(&ClearSans_Medium18pt7b, "No WiFi :-(", 132);
   }
 
-  GraphSamples graph(10 * 60);
-  graph.Fill(gFlashSamples, seconds, pm25_to_aqi_value);
+  // averaged in integers (no float emulation)
+  GraphSamples<CodeMeanAggregator, Pm_2_5CodeField> graph(
+      kGraphPeriodSeconds);
+  graph.Update(gFlashSamples, seconds, pm25_short_to_aqi_value, gRtcStore,
+               kGraphStateOffset);
+  if (graph.WasRebuilt()) {
+    Serial.println("Graph rebuilt from flash");
+  }
   for (size_t i=0; i<graph.Length(); i+=14) {
     printf("sample #%d : %d\n", i, graph.Value(i));
   }
@@ -1,3 +1,5 @@
+#include <time.h>
+
 #include "air_sample.h"
 #include "crc8_functions.h"
 #include "sample_encoding.h"
@@ -93,6 +95,15 @@ void test_data_structure(void) {
   TEST_ASSERT_EQUAL(40, output.HumidityPercent());
   TEST_ASSERT_EQUAL(5, output.SamplesCount());
   TEST_ASSERT_EQUAL(0.1f, output.Pm_2_5_Nmae());
+  TEST_ASSERT_EQUAL(137, output.AqiPm_2_5());
+  TEST_ASSERT_EQUAL(73, output.AqiPm_10_0());
+  TEST_ASSERT_EQUAL(137, output.Aqi());
+
+  // pm10 can drive the overall AQI
+  AirSample dusty(seconds, 10.0f, 10.0f, 300.0f, 1000.0f, 77, 40, 5, 0.1f);
+  TEST_ASSERT_EQUAL(42, dusty.AqiPm_2_5());
+  TEST_ASSERT_EQUAL(173, dusty.AqiPm_10_0());
+  TEST_ASSERT_EQUAL(173, dusty.Aqi());
 }
 
 void test_crc()
@@ -111,6 +122,80 @@ void test_crc()
   TEST_ASSERT_FALSE(outputCorrupted.IsValid());
 }
 
+void test_view()
+{
+  uint32_t seconds = k2019epoch + 365 * 24 * 3600;
+  AirSample input(seconds, 10.0f, 50.0f, 100.0f, 1000.0f, 77, 40, 5, 0.1f);
+
+  AirSampleData data;
+  input.ToData(data);
+  AirSample sample(data);
+  AirSampleView view(data);
+  TEST_ASSERT_EQUAL(sample.Seconds(), view.Seconds());
+  TEST_ASSERT_EQUAL_FLOAT(sample.Pm_1_0(), view.Pm_1_0());
+  TEST_ASSERT_EQUAL_FLOAT(sample.Pm_2_5(), view.Pm_2_5());
+  TEST_ASSERT_EQUAL_FLOAT(sample.Pm_10_0(), view.Pm_10_0());
+  TEST_ASSERT_EQUAL_FLOAT(sample.PressureMbar(), view.PressureMbar());
+  TEST_ASSERT_EQUAL(sample.TemperatureF(), view.TemperatureF());
+  TEST_ASSERT_EQUAL(sample.HumidityPercent(), view.HumidityPercent());
+  TEST_ASSERT_EQUAL(sample.SamplesCount(), view.SamplesCount());
+  TEST_ASSERT_EQUAL_FLOAT(sample.Pm_2_5_Nmae(), view.Pm_2_5_Nmae());
+  TEST_ASSERT_EQUAL(sample.AqiPm_2_5(), view.AqiPm_2_5());
+  TEST_ASSERT_EQUAL(sample.AqiPm_10_0(), view.AqiPm_10_0());
+  TEST_ASSERT_EQUAL(sample.Aqi(), view.Aqi());
+  TEST_ASSERT_TRUE(sample.Level() == view.Level());
+  TEST_ASSERT_TRUE(view.IsValid());
+  TEST_ASSERT_EQUAL(seconds, AirSampleTime::Seconds(data));
+
+  data.reserved = 0x01;
+  TEST_ASSERT_FALSE(view.IsValid());
+}
+
+// Timestamp and pm2.5 of a series of samples (what a graph needs): full
+// decode vs view
+void test_view_benchmark()
+{
+  const size_t kCount = 1024;
+  static AirSampleData samples[kCount];
+  for (size_t i = 0; i < kCount; i++) {
+    AirSample input(k2019epoch + i * 300, 5.0f, 5.0f + (i % 200), 20.0f,
+                    1000.0f, 77, 40, 5, 0.1f);
+    input.ToData(samples[i]);
+  }
+
+  const int kLoops = 200;
+  float fullSum = 0.0f;
+  uint32_t fullSeconds = 0;
+  clock_t start = clock();
+  for (int l = 0; l < kLoops; l++) {
+    for (size_t i = 0; i < kCount; i++) {
+      AirSample sample(samples[i]);
+      fullSeconds += sample.Seconds();
+      fullSum += sample.Pm_2_5();
+    }
+  }
+  clock_t full = clock() - start;
+
+  float viewSum = 0.0f;
+  uint32_t viewSeconds = 0;
+  start = clock();
+  for (int l = 0; l < kLoops; l++) {
+    for (size_t i = 0; i < kCount; i++) {
+      AirSampleView view(samples[i]);
+      viewSeconds += view.Seconds();
+      viewSum += view.Pm_2_5();
+    }
+  }
+  clock_t lazy = clock() - start;
+
+  TEST_ASSERT_EQUAL(fullSeconds, viewSeconds);
+  TEST_ASSERT_EQUAL_FLOAT(fullSum, viewSum);
+  float n = (float)(kLoops * kCount);
+  printf("Decode timestamp + pm2.5: %.1f ns/sample (view) vs %.1f ns/sample"
+         " (FromData)\n",
+         1e9f * lazy / CLOCKS_PER_SEC / n, 1e9f * full / CLOCKS_PER_SEC / n);
+}
+
 #if defined(ARDUINO)
 #include <Arduino.h>
 void loop() {}
@@ -126,5 +211,10 @@ int main(int argc, char **argv) {
   RUN_TEST(test_stats);
   RUN_TEST(test_data_structure);
   RUN_TEST(test_crc);
+  RUN_TEST(test_view);
+#if !defined(ARDUINO)
+  // clock() is not a usable timer on the board
+  RUN_TEST(test_view_benchmark);
+#endif
   UNITY_END();
 }
@@ -0,0 +1,420 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "byte_source.h"
+#include "purple_air_fields_parser.h"
+#include "sensors.h"
+#include "sensors_provider.h"
+#include "unity.h"
+
+void test_memory_source(void) {
+  const char *text = "0123456789";
+  MemorySource source(text, 10);
+  char buffer[8];
+  TEST_ASSERT_EQUAL(8, source.Read(buffer, sizeof(buffer)));
+  TEST_ASSERT_EQUAL_MEMORY("01234567", buffer, 8);
+  TEST_ASSERT_EQUAL('8', source.read());
+  TEST_ASSERT_EQUAL(1, source.readBytes(buffer, sizeof(buffer)));
+  TEST_ASSERT_EQUAL('9', buffer[0]);
+  TEST_ASSERT_EQUAL(0, source.Read(buffer, sizeof(buffer)));
+  TEST_ASSERT_EQUAL(-1, source.read());
+  source.Rewind();
+  TEST_ASSERT_EQUAL('0', source.read());
+}
+
+void test_sensors_index(void) {
+  // ids added in a shuffled order: the data stays in the order of AddSensor
+  const size_t kCount = 60;
+  AirSensorsGroup<kCount> sensors;
+  TEST_ASSERT_EQUAL(kCount, sensors.Capacity());
+  for (size_t i = 0; i < kCount; i++) {
+    TEST_ASSERT_TRUE(sensors.AddSensor(10000 + (i * 37) % kCount * 10));
+  }
+  TEST_ASSERT_FALSE(sensors.AddSensor(99999));
+  TEST_ASSERT_EQUAL(kCount, sensors.Count());
+  for (size_t i = 0; i < kCount; i++) {
+    size_t sid = 10000 + (i * 37) % kCount * 10;
+    TEST_ASSERT_EQUAL(i, sensors.GetSensorIndex(sid));
+  }
+  TEST_ASSERT_EQUAL(SIZE_MAX, sensors.GetSensorIndex(9999));
+  TEST_ASSERT_EQUAL(SIZE_MAX, sensors.GetSensorIndex(10005));
+  TEST_ASSERT_EQUAL(SIZE_MAX, sensors.GetSensorIndex(20000));
+
+  AirSensorsGroup<4> small;
+  TEST_ASSERT_TRUE(small.AddSensor(42));
+  TEST_ASSERT_FALSE(small.AddSensor(42));
+  TEST_ASSERT_EQUAL(1, small.Count());
+
+  // records of unknown sensors and of B channels of unknown parents
+  PurpleAirRecord record = {};
+  record.id = 43;
+  record.pm_2_5 = 12.5f;
+  TEST_ASSERT_FALSE(small.StoreRecord(record));
+  record.parentId = 41;
+  TEST_ASSERT_FALSE(small.StoreRecord(record));
+  record.parentId = 42;
+  TEST_ASSERT_TRUE(small.StoreRecord(record));
+  TEST_ASSERT_EQUAL_FLOAT(12.5f, small.Data(0).pm_2_5_B);
+  TEST_ASSERT_EQUAL(0, small.Data(0).id);
+  TEST_ASSERT_EQUAL(0, small.Data(1).id);
+}
+
+void test_provider_urls(void) {
+  AirSensors sensors;
+  sensors.AddSensor(59927);
+  sensors.AddSensor(25301);
+  char url[kMaxUrlLength];
+  PurpleAirJsonProvider legacy;
+  TEST_ASSERT_TRUE(legacy.RequestUrl(sensors, url, sizeof(url)));
+  TEST_ASSERT_EQUAL_STRING("http://www.purpleair.com/json?show=25301|59927",
+                           url);
+  TEST_ASSERT_NULL(legacy.ApiKey());
+
+  PurpleAirApiProvider api("KEY");
+  TEST_ASSERT_TRUE(api.RequestUrl(sensors, url, sizeof(url)));
+  TEST_ASSERT_EQUAL_STRING(
+      "https://api.purpleair.com/v1/sensors?fields=sensor_index,last_seen,"
+      "humidity,temperature,pressure,pm2.5_atm_a,pm2.5_atm_b,pm2.5_10minute,"
+      "pm2.5_30minute,pm2.5_60minute,pm2.5_6hour,pm2.5_24hour,pm2.5_1week"
+      "&show_only=25301,59927",
+      url);
+  TEST_ASSERT_EQUAL_STRING("KEY", api.ApiKey());
+
+  // too long
+  TEST_ASSERT_FALSE(legacy.RequestUrl(sensors, url, 40));
+  TEST_ASSERT_FALSE(api.RequestUrl(sensors, url, 200));
+
+  // skipped sensors, but never all of them
+  TEST_ASSERT_TRUE(sensors.SetSkipped(25301, true));
+  TEST_ASSERT_FALSE(sensors.SetSkipped(12345, true));
+  TEST_ASSERT_EQUAL(1, sensors.RequestedCount());
+  TEST_ASSERT_TRUE(legacy.RequestUrl(sensors, url, sizeof(url)));
+  TEST_ASSERT_EQUAL_STRING("http://www.purpleair.com/json?show=59927", url);
+  PurpleAirRecord record = {};
+  record.id = 25301;
+  TEST_ASSERT_FALSE(sensors.StoreRecord(record));
+  sensors.SetSkipped(59927, true);
+  TEST_ASSERT_FALSE(sensors.IsSkipped(59927));
+  TEST_ASSERT_TRUE(legacy.RequestUrl(sensors, url, sizeof(url)));
+  TEST_ASSERT_EQUAL_STRING("http://www.purpleair.com/json?show=25301|59927",
+                           url);
+  TEST_ASSERT_TRUE(sensors.StoreRecord(record));
+}
+
+void test_fields_parser(void) {
+  // any order of the fields, unknown fields and missing values
+  const char *json =
+      "{\"time_stamp\": 1000, \"fields\": [\"pm2.5_atm_b\", \"confidence\","
+      " \"sensor_index\", \"last_seen\", \"pm2.5_atm_a\", "
+      "\"pm2.5_1week\"],"
+      " \"data\": [[7.5, 100, 42, 820, 6.5, null], [1, 2, 43, 3, 4, 5]]}";
+  MemorySource source(json, strlen(json));
+  AirSensorsGroup<2> sensors;
+  sensors.AddSensor(42);
+  TEST_ASSERT_EQUAL(1, sensors.ParseSensorsFields(source));
+  const SensorData &data = sensors.Data(0);
+  TEST_ASSERT_EQUAL(42, data.id);
+  TEST_ASSERT_EQUAL(820, data.timestamp);
+  TEST_ASSERT_EQUAL_FLOAT(6.5f, data.pm_2_5_A);
+  TEST_ASSERT_EQUAL_FLOAT(7.5f, data.pm_2_5_B);
+  TEST_ASSERT_EQUAL(3, data.age_A);
+  TEST_ASSERT_EQUAL(3, data.age_B);
+  TEST_ASSERT_EQUAL_FLOAT(0.0f, data.averages[OneWeek]);
+}
+
+/** Source returning a few bytes at a time, like a slow network stream */
+class TricklingSource : public ByteSource {
+ public:
+  TricklingSource(ByteSource &source, size_t step)
+      : source_(source), step_(step) {}
+
+  size_t Read(char *buffer, size_t size) {
+    return source_.Read(buffer, (size < step_) ? size : step_);
+  }
+
+ protected:
+  ByteSource &source_;
+  size_t step_;
+};
+
+#if !defined(ARDUINO)
+
+#include "file_source.h"
+
+void test_parse_sample_file(void) {
+  FileSource file("data/sample.json");
+  TEST_ASSERT_TRUE(file.IsOpen());
+  AirSensors sensors;
+  sensors.AddSensor(59927);
+  TEST_ASSERT_EQUAL(1, sensors.ParseSensors(file));
+
+  const SensorData &data = sensors.Data(0);
+  TEST_ASSERT_EQUAL(59927, data.id);
+  TEST_ASSERT_EQUAL(1600140196, data.timestamp);
+  TEST_ASSERT_EQUAL_FLOAT(70.3, data.pm_2_5_A);
+  TEST_ASSERT_EQUAL_FLOAT(70.74, data.pm_2_5_B);
+  TEST_ASSERT_EQUAL(1, data.age_A);
+  TEST_ASSERT_EQUAL(1, data.age_B);
+  TEST_ASSERT_EQUAL(65, data.temperature);
+  TEST_ASSERT_EQUAL(59, data.humidity);
+  TEST_ASSERT_EQUAL_FLOAT(992.95, data.pressure);
+  const float averages[] = {73.83, 78.03, 80.27, 91.23, 105.22, 58.59};
+  for (short i = 0; i < PmAvgSize; i++) {
+    TEST_ASSERT_EQUAL_FLOAT(averages[i], data.averages[i]);
+  }
+  TEST_ASSERT_EQUAL_FLOAT(70.3, data.statsValue);
+  TEST_ASSERT_EQUAL(1600140196, data.statsTimestamp);
+  TEST_ASSERT_TRUE(sensors.ParseMemory() < 512);
+}
+
+static void add_group_sensors(AirSensorsBase &sensors) {
+  const size_t ids[] = {59927, 65489, 67415, 25301, 54857, 36667};
+  for (size_t i = 0; i < 6; i++) {
+    sensors.AddSensor(ids[i]);
+  }
+}
+
+static void assert_same_data(const AirSensorsBase &expected,
+                             const AirSensorsBase &actual,
+                             bool withStats = true) {
+  TEST_ASSERT_EQUAL(expected.Count(), actual.Count());
+  for (size_t i = 0; i < expected.Count(); i++) {
+    const SensorData &a = expected.Data(i);
+    const SensorData &b = actual.Data(i);
+    TEST_ASSERT_EQUAL(a.id, b.id);
+    TEST_ASSERT_EQUAL(a.timestamp, b.timestamp);
+    TEST_ASSERT_EQUAL_FLOAT(a.pm_2_5_A, b.pm_2_5_A);
+    TEST_ASSERT_EQUAL_FLOAT(a.pm_2_5_B, b.pm_2_5_B);
+    TEST_ASSERT_EQUAL(a.age_A, b.age_A);
+    TEST_ASSERT_EQUAL(a.age_B, b.age_B);
+    TEST_ASSERT_EQUAL_FLOAT(a.pressure, b.pressure);
+    for (short j = 0; j < PmAvgSize; j++) {
+      TEST_ASSERT_EQUAL_FLOAT(a.averages[j], b.averages[j]);
+    }
+    TEST_ASSERT_EQUAL(a.temperature, b.temperature);
+    TEST_ASSERT_EQUAL(a.humidity, b.humidity);
+    if (withStats) {
+      TEST_ASSERT_EQUAL_FLOAT(a.statsValue, b.statsValue);
+      TEST_ASSERT_EQUAL(a.statsTimestamp, b.statsTimestamp);
+    }
+  }
+}
+
+static char gResponse[32 * 1024];
+
+static size_t load_response(const char *path) {
+  FileSource file(path);
+  size_t size = file.Read(gResponse, sizeof(gResponse));
+  TEST_ASSERT_TRUE(size > 0 && size < sizeof(gResponse));
+  return size;
+}
+
+void test_parse_in_pieces(void) {
+  size_t size = load_response("data/sensor_group.json");
+  AirSensors whole;
+  add_group_sensors(whole);
+  TEST_ASSERT_EQUAL(6, whole.ParseSensors(gResponse, size));
+
+  const size_t steps[] = {1, 7, 64, 1000};
+  for (size_t s = 0; s < 4; s++) {
+    MemorySource memory(gResponse, size);
+    TricklingSource trickling(memory, steps[s]);
+    AirSensors sensors;
+    add_group_sensors(sensors);
+    TEST_ASSERT_EQUAL(6, sensors.ParseSensors(trickling));
+    assert_same_data(whole, sensors);
+  }
+
+  // a larger group, with the sensors of the response among others
+  AirSensorsGroup<48> large;
+  for (size_t i = 0; i < 42; i++) {
+    large.AddSensor(100000 + i);
+  }
+  add_group_sensors(large);
+  TEST_ASSERT_EQUAL(6, large.ParseSensors(gResponse, size));
+  for (size_t i = 0; i < whole.Count(); i++) {
+    TEST_ASSERT_EQUAL_MEMORY(&whole.Data(i), &large.Data(42 + i),
+                             sizeof(SensorData));
+  }
+
+  // a truncated response only updates the complete records
+  AirSensors truncated;
+  add_group_sensors(truncated);
+  size_t count = truncated.ParseSensors(gResponse, size / 2);
+  TEST_ASSERT_TRUE(count > 0 && count < 6);
+}
+
+#if defined(AAQIM_ARDUINOJSON)
+void test_parse_document(void) {
+  size_t size = load_response("data/sensor_group.json");
+  AirSensors streaming;
+  add_group_sensors(streaming);
+  TEST_ASSERT_EQUAL(6, streaming.ParseSensors(gResponse, size));
+
+  MemorySource source(gResponse, size);
+  AirSensors document;
+  add_group_sensors(document);
+  TEST_ASSERT_EQUAL(6, document.ParseSensorsDocument(source));
+  assert_same_data(streaming, document);
+}
+#endif
+
+/** Parse the response in a loop, and report the throughput and the memory
+ * used by the parser */
+static void benchmark_parse(const char *path, bool document) {
+  size_t size = load_response(path);
+  const int kLoops = 200;
+  AirSensors sensors;
+  add_group_sensors(sensors);
+  size_t count = 0;
+  clock_t start = clock();
+  for (int l = 0; l < kLoops; l++) {
+    MemorySource source(gResponse, size);
+#if defined(AAQIM_ARDUINOJSON)
+    if (document) {
+      count = sensors.ParseSensorsDocument(source);
+      continue;
+    }
+#endif
+    count = sensors.ParseSensors(source);
+  }
+  float elapsed = (float)(clock() - start) / CLOCKS_PER_SEC;
+  TEST_ASSERT_TRUE(count > 0);
+  printf("%s %s: %.1f MB/s, %u bytes of memory\n", path,
+         document ? "ArduinoJson" : "PurpleAirParser",
+         (float)(kLoops * size) / elapsed / 1e6f,
+         (unsigned)(sensors.ParseMemory()));
+}
+
+void test_providers(void) {
+  // the same sensors from both APIs (the Stats v and lastModified are only
+  // in the legacy response)
+  PurpleAirJsonProvider legacy;
+  PurpleAirApiProvider api("KEY");
+  size_t size = load_response("data/sensor_group.json");
+  MemorySource legacySource(gResponse, size);
+  AirSensors expected;
+  add_group_sensors(expected);
+  TEST_ASSERT_EQUAL(6, legacy.Parse(legacySource, expected));
+
+  FileSource file("data/sensor_group_fields.json");
+  AirSensors sensors;
+  add_group_sensors(sensors);
+  TEST_ASSERT_EQUAL(6, api.Parse(file, sensors));
+  assert_same_data(expected, sensors, false);
+}
+
+/** Parse the response of a provider in a loop, and report the payload size
+ * and the parse time */
+static void benchmark_provider(const SensorsProvider &provider,
+                               const char *path) {
+  size_t size = load_response(path);
+  const int kLoops = 200;
+  AirSensors sensors;
+  add_group_sensors(sensors);
+  size_t count = 0;
+  clock_t start = clock();
+  for (int l = 0; l < kLoops; l++) {
+    MemorySource source(gResponse, size);
+    count = provider.Parse(source, sensors);
+  }
+  float elapsed = (float)(clock() - start) / CLOCKS_PER_SEC;
+  TEST_ASSERT_EQUAL(6, count);
+  TEST_ASSERT_EQUAL(size, sensors.ParseBytes());
+  printf("%s: %u bytes for 8 sensors, parsed in %.1f us\n", provider.Name(),
+         (unsigned)(size), elapsed / kLoops * 1e6f);
+}
+
+void test_providers_benchmark(void) {
+  benchmark_provider(PurpleAirJsonProvider(), "data/sensor_group.json");
+  benchmark_provider(PurpleAirApiProvider("KEY"),
+                     "data/sensor_group_fields.json");
+}
+
+/** Parser skipping the Stats string, to measure what its extraction costs */
+class NoStatsParser : public PurpleAirParser {
+ public:
+  JsonScanner *NestedScanner(uint8_t depth, const char *key) override {
+    return nullptr;
+  }
+
+ protected:
+  void OnRecord(const PurpleAirRecord &record) override {}
+};
+
+class StatsParser : public PurpleAirParser {
+ protected:
+  void OnRecord(const PurpleAirRecord &record) override {}
+};
+
+static float time_parse(PurpleAirParser &parser, const char *data,
+                        size_t size) {
+  const int kLoops = 200;
+  clock_t start = clock();
+  for (int l = 0; l < kLoops; l++) {
+    parser.Reset();
+    parser.Feed(data, size);
+  }
+  TEST_ASSERT_TRUE(parser.IsComplete());
+  return (float)(clock() - start) / CLOCKS_PER_SEC / kLoops;
+}
+
+void test_stats_benchmark(void) {
+  size_t size = load_response("data/sensor_group.json");
+  StatsParser withStats;
+  NoStatsParser withoutStats;
+  float statsTime = time_parse(withStats, gResponse, size);
+  float skipTime = time_parse(withoutStats, gResponse, size);
+  size_t records = withStats.Records();
+  // the scanner of the Stats string replaces the second ArduinoJson
+  // document, and the parsing of each average key
+  printf("Stats in the main pass: %.0f ns per record (%.0f%% of the parse),"
+         " %u bytes (vs %u for the Stats document)\n",
+         (statsTime - skipTime) / records * 1e9f,
+         100.0f * (statsTime - skipTime) / statsTime,
+         (unsigned)(sizeof(JsonScanner)), 400);
+  TEST_ASSERT_EQUAL(records, withoutStats.Records());
+}
+
+void test_parse_benchmark(void) {
+  const char *paths[] = {"data/sample.json", "data/sensor_group.json"};
+  for (size_t p = 0; p < 2; p++) {
+    benchmark_parse(paths[p], false);
+#if defined(AAQIM_ARDUINOJSON)
+    benchmark_parse(paths[p], true);
+#endif
+  }
+}
+
+#endif
+
+#if defined(ARDUINO)
+#include <Arduino.h>
+void setup() {
+#else
+int main(int argc, char **argv) {
+#endif
+  UNITY_BEGIN();
+  RUN_TEST(test_memory_source);
+  RUN_TEST(test_sensors_index);
+  RUN_TEST(test_provider_urls);
+  RUN_TEST(test_fields_parser);
+#if !defined(ARDUINO)
+  // the recorded responses are only available on the host
+  RUN_TEST(test_parse_sample_file);
+  RUN_TEST(test_parse_in_pieces);
+#if defined(AAQIM_ARDUINOJSON)
+  RUN_TEST(test_parse_document);
+#endif
+  RUN_TEST(test_providers);
+  RUN_TEST(test_providers_benchmark);
+  RUN_TEST(test_stats_benchmark);
+  RUN_TEST(test_parse_benchmark);
+#endif
+  UNITY_END();
+}
+
+#if defined(ARDUINO)
+void loop() {}
+#endif
@@ -0,0 +1,236 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "analysis.h"
+#include "unity.h"
+
+#if !defined(ARDUINO)
+
+/** Value of a key in a record of a PurpleAir response (quoted or not), 0 if
+ * not found */
+static double find_value(const char *record, const char *end,
+                         const char *key) {
+  char pattern[32];
+  snprintf(pattern, sizeof(pattern), "%s\":", key);
+  const char *found = strstr(record, pattern);
+  if (found == nullptr || found >= end) {
+    return 0.0f;
+  }
+  found += strlen(pattern);
+  while (*found == '"' || *found == '\\' || *found == ' ') {
+    found++;
+  }
+  return strtod(found, nullptr);
+}
+
+/** Load the sensors of a recorded response (data/), in their order in the
+ * file. Only what ParseSensors reads is extracted, with a naive key search
+ * good enough for these files.
+ * @return number of sensors */
+static size_t load_sensors(const char *path, SensorData sensors[]) {
+  static char json[32 * 1024];
+  FILE *file = fopen(path, "rb");
+  if (file == nullptr) {
+    return 0;
+  }
+  size_t size = fread(json, 1, sizeof(json) - 1, file);
+  fclose(file);
+  json[size] = '\0';
+
+  size_t count = 0;
+  const char *record = strstr(json, "\"ID\":");
+  while (record != nullptr) {
+    const char *next = strstr(record + 1, "\"ID\":");
+    const char *end = (next != nullptr) ? next : json + size;
+    size_t id = (size_t)(find_value(record, end, "\"ID"));
+    size_t parent = (size_t)(find_value(record, end, "ParentID"));
+    if (parent == 0 && count < kMaxSensors) {
+      SensorData &data = sensors[count++];
+      memset(&data, 0, sizeof(data));
+      data.id = id;
+      data.timestamp = (uint32_t)(find_value(record, end, "LastSeen"));
+      data.pm_2_5_A = find_value(record, end, "PM2_5Value");
+      data.age_A = (int16_t)(find_value(record, end, "AGE"));
+      data.temperature = (int16_t)(find_value(record, end, "temp_f"));
+      data.humidity = (int16_t)(find_value(record, end, "humidity"));
+      data.pressure = find_value(record, end, "pressure");
+      const char *stats = strstr(record, "Stats");
+      for (short i = 0; stats != nullptr && stats < end && i < PmAvgSize;
+           i++) {
+        // escaped in the Stats string
+        char key[8];
+        snprintf(key, sizeof(key), "v%d\\", i + 1);
+        data.averages[i] = find_value(stats, end, key);
+      }
+    } else {
+      for (size_t i = 0; i < count; i++) {
+        if (sensors[i].id == parent) {
+          sensors[i].pm_2_5_B = find_value(record, end, "PM2_5Value");
+          sensors[i].age_B = (int16_t)(find_value(record, end, "AGE"));
+        }
+      }
+    }
+    record = next;
+  }
+  return count;
+}
+
+void TestSensorGroup() {
+  SensorData sensors[kMaxSensors];
+  size_t count = load_sensors("data/sensor_group.json", sensors);
+  TEST_ASSERT_EQUAL(8, count);
+  TEST_ASSERT_EQUAL(59927, sensors[0].id);
+  TEST_ASSERT_EQUAL_FLOAT(24.16, sensors[0].pm_2_5_B);
+  TEST_ASSERT_EQUAL_FLOAT(19.31, sensors[0].averages[TenMinutes]);
+
+  AgeFilter ageFilter;
+  ConsistencyFilter consistencyFilter;
+  SensorAnalysis analysis;
+  TEST_ASSERT_TRUE(analysis.AddFilter(ageFilter));
+  TEST_ASSERT_TRUE(analysis.AddFilter(consistencyFilter));
+  AirSample sample;
+  GroupDiagnostics<kMaxSensors> diagnostics;
+  TEST_ASSERT_EQUAL(8, analysis.Analyze(sensors, count, sample, diagnostics));
+  TEST_ASSERT_EQUAL(0, diagnostics.primaryIndex);
+  TEST_ASSERT_EQUAL_FLOAT(16.125, diagnostics.fusion.median);
+  TEST_ASSERT_EQUAL_FLOAT(3.065, diagnostics.fusion.mad);
+  TEST_ASSERT_FLOAT_WITHIN(0.001, 128.79 / 8, diagnostics.fusion.mean);
+  TEST_ASSERT_EQUAL(1600617076, sample.Seconds());
+  TEST_ASSERT_FLOAT_WITHIN(0.01, 128.79 / 8, sample.Pm_2_5());
+  TEST_ASSERT_EQUAL(68, sample.TemperatureF());
+
+  // An old reading and an inconsistent sensor
+  sensors[0].age_B = kMaxReadingAgeMinutes + 1;
+  sensors[3].pm_2_5_B = sensors[3].pm_2_5_A + kMaxConcentrationDiscrepancy + 1;
+  TEST_ASSERT_EQUAL(6, analysis.Analyze(sensors, count, sample, diagnostics));
+  TEST_ASSERT_EQUAL(Rejection::Age, diagnostics.rejections[0]);
+  TEST_ASSERT_EQUAL(Rejection::Consistency, diagnostics.rejections[3]);
+  TEST_ASSERT_EQUAL(Rejection::None, diagnostics.rejections[1]);
+  TEST_ASSERT_EQUAL(1, diagnostics.primaryIndex);
+  TEST_ASSERT_EQUAL(1600617176, sample.Seconds());
+
+  // A larger group is analyzed as a whole, its values beyond 32 included
+  const size_t kGroupSize = 64;
+  SensorData group[kGroupSize + 1];
+  count = load_sensors("data/sensor_group.json", group);
+  for (size_t i = count; i < kGroupSize + 1; i++) {
+    group[i] = group[i % count];
+  }
+  GroupDiagnostics<kGroupSize> groupDiagnostics;
+  TEST_ASSERT_EQUAL(kGroupSize, analysis.Analyze(group, kGroupSize, sample,
+                                                 groupDiagnostics));
+  TEST_ASSERT_EQUAL(kGroupSize, groupDiagnostics.sensorsCount);
+  TEST_ASSERT_FLOAT_WITHIN(0.001, 128.79 / 8, groupDiagnostics.fusion.mean);
+  const size_t outlier = 45;
+  group[outlier].averages[TenMinutes] = 500.0f;
+  group[outlier].pm_2_5_A = group[outlier].pm_2_5_B = 500.0f;
+  TEST_ASSERT_EQUAL(kGroupSize - 1, analysis.Analyze(group, kGroupSize, sample,
+                                                     groupDiagnostics));
+  TEST_ASSERT_EQUAL(Rejection::Outlier, groupDiagnostics.rejections[outlier]);
+  const float outlierAverage = group[outlier % count].averages[TenMinutes];
+  TEST_ASSERT_FLOAT_WITHIN(
+      0.001, (128.79 * kGroupSize / 8 - outlierAverage) / (kGroupSize - 1),
+      groupDiagnostics.fusion.mean);
+  // 128 real time values
+  SensorAnalysis realTime;
+  realTime.AddFilter(ageFilter);
+  realTime.AddFilter(consistencyFilter);
+  realTime.UseRealTime(true);
+  TEST_ASSERT_EQUAL(kGroupSize - 1, realTime.Analyze(group, kGroupSize, sample,
+                                                     groupDiagnostics));
+  TEST_ASSERT_EQUAL(Rejection::Outlier, groupDiagnostics.rejections[outlier]);
+  TEST_ASSERT_EQUAL(0, groupDiagnostics.primaryIndex);
+  // and rejected beyond the capacity, rather than truncated
+  TEST_ASSERT_EQUAL(0, analysis.Analyze(group, kGroupSize + 1, sample,
+                                        groupDiagnostics));
+  TEST_ASSERT_EQUAL(0, groupDiagnostics.sensorsCount);
+  TEST_ASSERT_EQUAL(-1, groupDiagnostics.primaryIndex);
+  TEST_ASSERT_EQUAL(0, sample.Seconds());
+}
+
+void TestOutlierRejection() {
+  SensorData sensors[kMaxSensors];
+  size_t count = load_sensors("data/lowvalues_with_one_outlier.json", sensors);
+  TEST_ASSERT_EQUAL(6, count);
+
+  AgeFilter ageFilter;
+  ConsistencyFilter consistencyFilter;
+  SensorAnalysis analysis;
+  analysis.AddFilter(ageFilter);
+  analysis.AddFilter(consistencyFilter);
+  AirSample sample;
+  GroupDiagnostics<kMaxSensors> diagnostics;
+  TEST_ASSERT_EQUAL(5, analysis.Analyze(sensors, count, sample, diagnostics));
+  TEST_ASSERT_EQUAL(Rejection::Outlier, diagnostics.rejections[1]);
+  TEST_ASSERT_FLOAT_WITHIN(0.001, 25.32 / 5, diagnostics.fusion.mean);
+  TEST_ASSERT_EQUAL_FLOAT(35.86, diagnostics.max);
+
+  // the outlier drags the plain mean
+  analysis.SetOutlierRejection(0.0f);
+  TEST_ASSERT_EQUAL(6, analysis.Analyze(sensors, count, sample, diagnostics));
+  TEST_ASSERT_FLOAT_WITHIN(0.001, 61.18 / 6, diagnostics.fusion.mean);
+
+  // weighted by age: the older readings count less
+  AgeFilter weightedAge(kMaxReadingAgeMinutes, kAgeHalfWeightMinutes);
+  SensorAnalysis weighted;
+  weighted.AddFilter(weightedAge);
+  weighted.AddFilter(consistencyFilter);
+  TEST_ASSERT_EQUAL(5, weighted.Analyze(sensors, count, sample, diagnostics));
+  float expected = (5.99f + 4.79f + (4.04f + 5.77f + 4.73f) * 5.0f / 6.0f) /
+                   (2.0f + 3.0f * 5.0f / 6.0f);
+  TEST_ASSERT_FLOAT_WITHIN(0.001, expected, diagnostics.fusion.mean);
+
+  // real time A and B values
+  analysis.SetOutlierRejection(kFusionRejectionSigmas);
+  analysis.UseRealTime(true);
+  TEST_ASSERT_EQUAL(5, analysis.Analyze(sensors, count, sample, diagnostics));
+  TEST_ASSERT_EQUAL(10, diagnostics.fusion.kept);
+  TEST_ASSERT_EQUAL(Rejection::Outlier, diagnostics.rejections[1]);
+
+  // no sensor left
+  TEST_ASSERT_EQUAL(0, analysis.Analyze(sensors, 0, sample, diagnostics));
+  TEST_ASSERT_EQUAL(-1, diagnostics.primaryIndex);
+}
+
+void TestAnalysisBenchmark() {
+  SensorData sensors[kMaxSensors];
+  size_t count = load_sensors("data/sensor_group.json", sensors);
+  AgeFilter ageFilter;
+  ConsistencyFilter consistencyFilter;
+  SensorAnalysis analysis;
+  analysis.AddFilter(ageFilter);
+  analysis.AddFilter(consistencyFilter);
+
+  const int kLoops = 100000;
+  AirSample sample;
+  GroupDiagnostics<kMaxSensors> diagnostics;
+  size_t kept = 0;
+  clock_t start = clock();
+  for (int l = 0; l < kLoops; l++) {
+    sensors[l % count].averages[TenMinutes] += 0.01f;
+    kept += analysis.Analyze(sensors, count, sample, diagnostics);
+  }
+  float elapsed = (float)(clock() - start) / CLOCKS_PER_SEC;
+  printf("Analysis of %d sensors: %.0f ns (%.0f analyses/s)\n", (int)(count),
+         elapsed / kLoops * 1e9f, kLoops / elapsed);
+  TEST_ASSERT_EQUAL(kLoops * count, kept);
+}
+
+#endif
+
+#if defined(ARDUINO)
+void loop() {}
+void setup() {
+#else
+int main() {
+#endif
+  UNITY_BEGIN();
+#if !defined(ARDUINO)
+  // the recorded responses are only available on the host
+  RUN_TEST(TestSensorGroup);
+  RUN_TEST(TestOutlierRejection);
+  RUN_TEST(TestAnalysisBenchmark);
+#endif
+  UNITY_END();
+}
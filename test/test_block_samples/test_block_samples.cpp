@@ -0,0 +1,230 @@
+#include <math.h>
+#include <string.h>
+#include <time.h>
+
+#include "air_sample_codec.h"
+#include "block_samples.h"
+#include "counting_flash.h"
+#include "unity.h"
+
+#if defined(ARDUINO)
+EspFlash gSectors;
+#else
+#include "sim_flash.h"
+SimFlash gSectors;
+#endif
+
+CountingFlash gFlash(gSectors);
+
+const uint32_t kFlashOffset = 0x000A0000;
+const uint32_t kStartSeconds = k2019epoch + 400 * 24 * 3600;
+
+typedef BlockSamples<AirSampleCodec, AirSampleTime> AirBlockSamples;
+
+/** Series looking like the ones published by the PurpleAir sensors (see
+ * data/): a sample every 5 minutes with a few gaps, slowly varying
+ * concentrations with noise, daily temperature and humidity cycles. */
+class SyntheticSerie {
+ public:
+  SyntheticSerie() : seed_(12345), seconds_(kStartSeconds), pm_2_5_(12.0f) {}
+
+  void Next(AirSampleData& data) {
+    seconds_ += (Random() % 50 == 0) ? 600 + 300 * (Random() % 4) : 300;
+    pm_2_5_ += ((float)(Random() % 201) - 100.0f) / 100.0f;
+    if (pm_2_5_ < 0.5f) {
+      pm_2_5_ = 0.5f;
+    }
+    float hour = (float)((seconds_ / 60) % (24 * 60)) / 60.0f;
+    float cycle = sinf(hour * 2.0f * (float)M_PI / 24.0f);
+    AirSample sample(seconds_, pm_2_5_ * 0.68f, pm_2_5_, pm_2_5_ * 1.13f,
+                     1012.0f + 3.0f * cycle, 64 + (int)(12.0f * cycle),
+                     45 - (int)(15.0f * cycle), 3 + Random() % 3,
+                     (float)(Random() % 100) / 10.0f);
+    sample.ToData(data);
+  }
+
+ protected:
+  uint32_t Random() {
+    seed_ = seed_ * 1103515245 + 12345;
+    return (seed_ >> 16) & 0x7FFF;
+  }
+
+  uint32_t seed_;
+  uint32_t seconds_;
+  float pm_2_5_;
+};
+
+void TestCodecRoundTrip() {
+  SyntheticSerie serie;
+  AirSampleCodec::State encoder;
+  AirSampleCodec::State decoder;
+  AirSampleData base;
+  serie.Next(base);
+  AirSampleCodec::Reset(encoder, base);
+  AirSampleCodec::Reset(decoder, base);
+
+  size_t total = 0;
+  const size_t kCount = 1000;
+  for (size_t i = 0; i < kCount; i++) {
+    AirSampleData data;
+    serie.Next(data);
+    if (i == kCount / 2) {
+      // corrupted samples are stored verbatim
+      data.crc ^= 0x5A;
+    }
+    uint8_t record[AirSampleCodec::kMaxEncodedSize];
+    size_t size = AirSampleCodec::Encode(encoder, data, record);
+    TEST_ASSERT_TRUE(size <= AirSampleCodec::kMaxEncodedSize);
+    TEST_ASSERT_TRUE(record[0] != 0xFF);
+    total += size;
+
+    AirSampleData decoded;
+    TEST_ASSERT_EQUAL(size,
+                      AirSampleCodec::Decode(decoder, record, size, decoded));
+    TEST_ASSERT_EQUAL_MEMORY(&data, &decoded, sizeof(AirSampleData));
+    // a truncated record is not decoded
+    AirSampleCodec::State copy = decoder;
+    TEST_ASSERT_EQUAL(0,
+                      AirSampleCodec::Decode(copy, record, size - 1, decoded));
+  }
+  printf("Codec: %.2f bytes per sample (vs %d)\n", (float)total / kCount,
+         kCompactedSampleSize);
+}
+
+void TestStoreAndRead() {
+  AirBlockSamples samples(gFlash, 3, kFlashOffset);
+  samples.Begin(true);
+  TEST_ASSERT_TRUE(samples.IsEmpty());
+  TEST_ASSERT_EQUAL(0, samples.NumberOfSamples());
+
+  // Enough samples to fill the ring a few times
+  const size_t kCount = 2000;
+  static AirSampleData reference[kCount];
+  SyntheticSerie serie;
+  for (size_t i = 0; i < kCount; i++) {
+    serie.Next(reference[i]);
+    TEST_ASSERT_TRUE(samples.StoreSample(reference[i]));
+  }
+  size_t n = samples.NumberOfSamples();
+  TEST_ASSERT_TRUE(n > 0 && n < kCount);
+  TEST_ASSERT_EQUAL(3, samples.BlocksInUse());
+
+  // random access
+  AirSampleData data;
+  for (size_t index = 0; index < n; index += 37) {
+    TEST_ASSERT_TRUE(samples.ReadSample(index, data));
+    TEST_ASSERT_EQUAL_MEMORY(&reference[kCount - 1 - index], &data,
+                             sizeof(AirSampleData));
+  }
+  TEST_ASSERT_FALSE(samples.ReadSample(n, data));
+
+  // range across blocks
+  static AirSampleData range[kCount];
+  TEST_ASSERT_EQUAL(n, samples.ReadSamples(0, kCount, range));
+  for (size_t i = 0; i < n; i++) {
+    TEST_ASSERT_EQUAL_MEMORY(&reference[kCount - 1 - i], &range[i],
+                             sizeof(AirSampleData));
+  }
+  TEST_ASSERT_EQUAL(10, samples.ReadSamples(n - 20, 10, range));
+  TEST_ASSERT_EQUAL_MEMORY(&reference[kCount - 1 - (n - 20)], &range[0],
+                           sizeof(AirSampleData));
+
+  // After a reboot, the index is rebuilt and samples can be appended
+  AirBlockSamples again(gFlash, 3, kFlashOffset);
+  again.Begin();
+  TEST_ASSERT_EQUAL(n, again.NumberOfSamples());
+  AirSampleData next;
+  serie.Next(next);
+  TEST_ASSERT_TRUE(again.StoreSample(next));
+  TEST_ASSERT_TRUE(again.ReadSample(0, data));
+  TEST_ASSERT_EQUAL_MEMORY(&next, &data, sizeof(AirSampleData));
+  TEST_ASSERT_TRUE(again.ReadSample(1, data));
+  TEST_ASSERT_EQUAL_MEMORY(&reference[kCount - 1], &data,
+                           sizeof(AirSampleData));
+}
+
+void TestFindIndexAtOrBefore() {
+  AirBlockSamples samples(gFlash, 4, kFlashOffset);
+  samples.Begin(true);
+  TEST_ASSERT_EQUAL(SIZE_MAX, samples.FindIndexAtOrBefore(kStartSeconds));
+
+  const size_t kCount = 1500;
+  static uint32_t seconds[kCount];
+  SyntheticSerie serie;
+  AirSampleData data;
+  for (size_t i = 0; i < kCount; i++) {
+    serie.Next(data);
+    seconds[i] = AirSampleTime::Seconds(data);
+    samples.StoreSample(data);
+  }
+  size_t n = samples.NumberOfSamples();
+  TEST_ASSERT_EQUAL(kCount, n);
+  TEST_ASSERT_EQUAL(0, samples.FindIndexAtOrBefore(seconds[kCount - 1] + 60));
+  TEST_ASSERT_EQUAL(n - 1, samples.FindIndexAtOrBefore(seconds[0]));
+  TEST_ASSERT_EQUAL(SIZE_MAX, samples.FindIndexAtOrBefore(seconds[0] - 60));
+  for (size_t i = 1; i < kCount; i += 101) {
+    // just before the next sample
+    TEST_ASSERT_EQUAL(kCount - 1 - (i - 1),
+                      samples.FindIndexAtOrBefore(seconds[i] - 60));
+    TEST_ASSERT_EQUAL(kCount - 1 - i, samples.FindIndexAtOrBefore(seconds[i]));
+  }
+}
+
+void TestCompressionBenchmark() {
+  const size_t kSectors = 16;
+  AirBlockSamples samples(gFlash, kSectors, kFlashOffset);
+  samples.Begin(true);
+
+  SyntheticSerie serie;
+  AirSampleData data;
+  // fill all the blocks but the last one
+  while (samples.BlocksInUse() < kSectors) {
+    serie.Next(data);
+    samples.StoreSample(data);
+  }
+  size_t n = samples.NumberOfSamples() - 1;
+  float ratio = (float)(n * sizeof(AirSampleData)) /
+                (float)((kSectors - 1) * SPI_FLASH_SEC_SIZE);
+  printf("Block storage: %d samples in %d sectors (%.1f per sector vs %d raw)"
+         " - ratio = %.2f\n",
+         (int)(n), (int)(kSectors - 1), (float)n / (kSectors - 1),
+         SPI_FLASH_SEC_SIZE / kCompactedSampleSize, ratio);
+  TEST_ASSERT_TRUE(ratio > 1.5f);
+
+  // decode throughput, with the cost of the simulated flash reads
+  const size_t kChunk = 1024;
+  static AirSampleData chunk[kChunk];
+  const int kLoops = 20;
+  gFlash.ResetCounters();
+  clock_t start = clock();
+  for (int l = 0; l < kLoops; l++) {
+    size_t read = 0;
+    for (size_t index = 0; index <= n; index += kChunk) {
+      read += samples.ReadSamples(index, kChunk, chunk);
+    }
+    TEST_ASSERT_EQUAL(n + 1, read);
+  }
+  float elapsed = (float)(clock() - start) / CLOCKS_PER_SEC;
+  printf("Decode: %.1f Msamples/s (%d flash reads per pass)\n",
+         (float)(kLoops * (n + 1)) / elapsed / 1e6f, gFlash.Reads() / kLoops);
+
+  // random access cost: one block decode
+  gFlash.ResetCounters();
+  samples.ReadSample(n / 2, data);
+  printf("ReadSample: %d flash reads\n", gFlash.Reads());
+  TEST_ASSERT_TRUE(gFlash.Reads() <= SPI_FLASH_SEC_SIZE / 256);
+}
+
+#if defined(ARDUINO)
+void loop() {}
+void setup() {
+#else
+int main() {
+#endif
+  UNITY_BEGIN();
+  RUN_TEST(TestCodecRoundTrip);
+  RUN_TEST(TestStoreAndRead);
+  RUN_TEST(TestFindIndexAtOrBefore);
+  RUN_TEST(TestCompressionBenchmark);
+  UNITY_END();
+}
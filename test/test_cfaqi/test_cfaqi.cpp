@@ -1,6 +1,14 @@
+#include <stdio.h>
+#include <time.h>
+
 #include "cfaqi.h"
+#include "sample_encoding.h"
 #include "unity.h"
 
+#if defined(ARDUINO)
+#include <Arduino.h>
+#endif
+
 void test_function_pm25_to_aqi_out_of_range(void) {
   int16_t value;
   AqiLevel level;
@@ -40,6 +48,86 @@ void test_function_pm25_to_aqi_conversions(void) {
   }
 }
 
+void test_function_pm10_to_aqi_conversions(void) {
+  const float concentrations[] = {0.0,   54.0,  55.0,  100.0, 154.0, 155.0,
+                                  254.0, 255.0, 354.0, 355.0, 424.0, 425.0,
+                                  504.0, 505.0, 511.0};
+  const int aqivalues[] = {0,   50,  51,  73,  100, 101, 150, 151,
+                           200, 201, 300, 301, 400, 401, 407};
+  const int aqilevels[] = {0, 0, 1, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6};
+
+  int i = 0;
+  for (float c : concentrations) {
+    int16_t value;
+    AqiLevel level;
+    TEST_ASSERT_TRUE(Pm10Aqi::ToAqi(c, value, level));
+    TEST_ASSERT_EQUAL(aqivalues[i], value);
+    TEST_ASSERT_EQUAL(aqilevels[i], static_cast<int>(level));
+    TEST_ASSERT_EQUAL(aqivalues[i], pm10_short_to_aqi_value(cf_to_short(c)));
+    i++;
+  }
+
+  // all the stored concentrations
+  for (uint32_t code = 0; code <= 0xFFFF; code++) {
+    int16_t value, codeValue;
+    AqiLevel level, codeLevel;
+    bool valid = Pm10Aqi::ToAqi(short_to_cf(code), value, level);
+    TEST_ASSERT_EQUAL(valid, Pm10Aqi::CodeToAqi(code, codeValue, codeLevel));
+    TEST_ASSERT_EQUAL(static_cast<int>(level), static_cast<int>(codeLevel));
+    TEST_ASSERT_EQUAL(value, codeValue);
+  }
+}
+
+void test_function_pm25_short_to_aqi(void) {
+  // the lookup table matches the float conversion for every stored
+  // concentration (requires IEEE single precision floats: the x87 extended
+  // precision of -m32 rounds one code differently, see platformio.ini)
+  for (uint32_t code = 0; code <= 0xFFFF; code++) {
+    int16_t value, shortValue;
+    AqiLevel level, shortLevel;
+    bool valid = pm25_to_aqi(short_to_cf(code), value, level);
+    TEST_ASSERT_EQUAL(valid, pm25_short_to_aqi(code, shortValue, shortLevel));
+    TEST_ASSERT_EQUAL(static_cast<int>(level), static_cast<int>(shortLevel));
+    TEST_ASSERT_EQUAL(value, shortValue);
+    TEST_ASSERT_EQUAL(value, pm25_to_aqi_value(short_to_cf(code)));
+  }
+  // not quantized concentrations still use the float conversion
+  TEST_ASSERT_EQUAL(42, pm25_to_aqi_value(10.0001f));
+}
+
+// CPU cycles on the device, clock ticks on native
+static uint32_t cycles() {
+#if defined(ARDUINO)
+  return ESP.getCycleCount();
+#else
+  return (uint32_t)(clock());
+#endif
+}
+
+void test_benchmark_pm25_short_to_aqi(void) {
+  const uint32_t kStep = 7;
+  int32_t floatSum = 0;
+  uint32_t start = cycles();
+  for (uint32_t code = 0; code <= 0xFFFF; code += kStep) {
+    int16_t value;
+    AqiLevel level;
+    pm25_to_aqi(short_to_cf(code), value, level);
+    floatSum += value;
+  }
+  uint32_t floatCycles = cycles() - start;
+
+  int32_t shortSum = 0;
+  start = cycles();
+  for (uint32_t code = 0; code <= 0xFFFF; code += kStep) {
+    shortSum += pm25_short_to_aqi_value(code);
+  }
+  uint32_t shortCycles = cycles() - start;
+
+  printf("AQI of %u codes: float = %u, integer = %u (cycles/ticks)\n",
+         0x10000 / kStep, floatCycles, shortCycles);
+  TEST_ASSERT_EQUAL(floatSum, shortSum);
+}
+
 #if defined(ARDUINO)
 #include <Arduino.h>
 void setup() {
@@ -49,6 +137,9 @@ int main(int argc, char **argv) {
   UNITY_BEGIN();
   RUN_TEST(test_function_pm25_to_aqi_out_of_range);
   RUN_TEST(test_function_pm25_to_aqi_conversions);
+  RUN_TEST(test_function_pm25_short_to_aqi);
+  RUN_TEST(test_function_pm10_to_aqi_conversions);
+  RUN_TEST(test_benchmark_pm25_short_to_aqi);
   UNITY_END();
 }
 
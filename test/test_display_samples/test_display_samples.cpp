@@ -1,18 +1,28 @@
+#include <math.h>
+#include <time.h>
+
 #include "aaqim_debug.h"
+#include "counting_flash.h"
 #include "display_samples.h"
+#include "memory_store.h"
 #include "unity.h"
 
 #if defined(ARDUINO)
+#include "rtc_store.h"
 EspFlash gFlash;
+RtcStore gStore;
 #else
 #include "sim_flash.h"
 SimFlash gFlash;
+// the RTC memory, without leaving a file in the working tree
+MemoryStore gStore;
 #endif
 
 const uint32_t kFlashOffset = 0x000A0000;
 const uint32_t kNowSeconds = k2019epoch + 365 * 24 * 3600;
 
-FlashSamples<AirSampleData> gFlashSamples(gFlash, 64, kFlashOffset);
+FlashSamples<AirSampleData, AirSampleTime> gFlashSamples(gFlash, 64,
+                                                         kFlashOffset);
 
 void TestFillFromEmptyFlash() {
   gFlashSamples.Begin(true);
@@ -107,6 +117,345 @@ void TestFillDisplaySample() {
 #endif
 }
 
+void TestFillInThePast() {
+  // Same serie as above (already on flash), but with a window ending two
+  // buckets earlier: the two most recent samples are skipped.
+  DisplaySamples<8, int16_t> displaySamples(300);
+  size_t count =
+      displaySamples.Fill(gFlashSamples, kNowSeconds - 600, pm25_to_aqi_value);
+  TEST_ASSERT_EQUAL(3, count);
+
+  TEST_ASSERT_EQUAL(INT16_MIN, displaySamples.Value(2));
+  TEST_ASSERT_EQUAL(100, displaySamples.Value(3));
+  TEST_ASSERT_EQUAL(200, displaySamples.Value(4));
+  TEST_ASSERT_EQUAL(300, displaySamples.Value(5));
+  TEST_ASSERT_EQUAL(INT16_MIN, displaySamples.Value(6));
+  TEST_ASSERT_EQUAL(INT16_MIN, displaySamples.Value(7));
+
+  // Window ending before the first sample
+  count = displaySamples.Fill(gFlashSamples, kNowSeconds - 3600,
+                              pm25_to_aqi_value);
+  TEST_ASSERT_EQUAL(0, count);
+  TEST_ASSERT_EQUAL(INT16_MIN, displaySamples.Value(7));
+}
+
+int16_t ToTenths(float value) { return (int16_t)(roundf(value * 10.0f)); }
+
+void TestFillAggregators() {
+  // Same serie again, aggregated differently (see StoreSerie)
+  DisplaySamples<8, int16_t, MaxAggregator> maxSamples(300);
+  DisplaySamples<8, int16_t, MinAggregator> minSamples(300);
+  DisplaySamples<8, int16_t, LastAggregator> lastSamples(300);
+  DisplaySamples<8, int16_t, P90Aggregator> p90Samples(300);
+  DisplaySamples<8, int16_t, StdDevAggregator> spreadSamples(300);
+  DisplaySamples<8, int16_t, MeanAggregator, TemperatureFField> temperature(
+      300);
+  TEST_ASSERT_EQUAL(8, FillAll(gFlashSamples, kNowSeconds, ToTenths,
+                               maxSamples, minSamples, lastSamples, p90Samples,
+                               spreadSamples, temperature));
+
+  TEST_ASSERT_EQUAL(404, maxSamples.Value(1));
+  TEST_ASSERT_EQUAL(1504, maxSamples.Value(2));
+  TEST_ASSERT_EQUAL(2904, maxSamples.Value(3));
+  TEST_ASSERT_EQUAL(3704, maxSamples.Value(6));
+  TEST_ASSERT_EQUAL(INT16_MIN, maxSamples.Value(7));
+  TEST_ASSERT_EQUAL(3704, maxSamples.SerieMax());
+
+  TEST_ASSERT_EQUAL(304, minSamples.Value(1));
+  TEST_ASSERT_EQUAL(2104, minSamples.Value(3));
+  TEST_ASSERT_EQUAL(3304, minSamples.Value(6));
+  TEST_ASSERT_EQUAL(304, minSamples.SerieMin());
+
+  // the most recent sample, whatever the order on flash
+  TEST_ASSERT_EQUAL(404, lastSamples.Value(1));
+  TEST_ASSERT_EQUAL(2104, lastSamples.Value(3));
+  TEST_ASSERT_EQUAL(3304, lastSamples.Value(6));
+
+  // nearest rank with so few samples
+  TEST_ASSERT_EQUAL(404, p90Samples.Value(1));
+  TEST_ASSERT_EQUAL(2904, p90Samples.Value(3));
+
+  // 30.4, 35.4 and 40.4: sqrt(50/3)
+  TEST_ASSERT_EQUAL(41, spreadSamples.Value(1));
+  TEST_ASSERT_EQUAL(0, spreadSamples.Value(2));
+  TEST_ASSERT_EQUAL(200, spreadSamples.Value(6));
+
+  TEST_ASSERT_EQUAL(INT16_MIN, temperature.Value(0));
+  TEST_ASSERT_EQUAL(770, temperature.Value(1));
+  TEST_ASSERT_EQUAL(770, temperature.Value(6));
+  TEST_ASSERT_EQUAL(770, temperature.SerieMin());
+  TEST_ASSERT_EQUAL(770, temperature.SerieMax());
+}
+
+void TestPercentileEstimation() {
+  // shuffled 1..1000
+  P90Aggregator p90;
+  PercentileAggregator<50> median;
+  p90.Reset();
+  median.Reset();
+  TEST_ASSERT_TRUE(p90.IsEmpty());
+  for (uint32_t i = 0; i < 1000; i++) {
+    BucketInput input;
+    single_bucket_input(i, (float)((i * 389 + 17) % 1000 + 1), input);
+    p90.Add(input);
+    median.Add(input);
+  }
+  TEST_ASSERT_FALSE(p90.IsEmpty());
+  printf("P2 estimation: p90 = %.1f, median = %.1f (exact 900, 500)\n",
+         p90.Value(), median.Value());
+  TEST_ASSERT_FLOAT_WITHIN(20.0f, 900.0f, p90.Value());
+  TEST_ASSERT_FLOAT_WITHIN(20.0f, 500.0f, median.Value());
+}
+
+// Fill a 24h graph from two days of samples (every 5 minutes), and compare
+// the number of flash accesses with the one sample per read approach.
+void TestFillFlashReads() {
+  CountingFlash flash(gFlash);
+  FlashSamples<AirSampleData, AirSampleTime> samples(flash, 1024, 0);
+  samples.Begin(true);
+  const size_t stored = 2 * 24 * 12;
+  for (size_t i = 0; i < stored; i++) {
+    AirSample sample(kNowSeconds - (stored - 1 - i) * 300, 0.0f,
+                     10.0f + (i % 7), 0.0f, 1000.0f, 77, 33, 3, 0.5f);
+    AirSampleData data;
+    sample.ToData(data);
+    samples.StoreSample(data);
+  }
+
+  DisplaySamples<144, int16_t> graph(600);
+  flash.ResetCounters();
+  size_t count = graph.Fill(samples, kNowSeconds, pm25_to_aqi_value);
+  TEST_ASSERT_EQUAL(144, count);
+  uint32_t fillReads = flash.Reads();
+
+  // Reference: read the same samples one at a time
+  flash.ResetCounters();
+  AirSampleData data;
+  for (size_t i = 0; i < 24 * 12; i++) {
+    samples.ReadSample(i, data);
+  }
+  uint32_t singleReads = flash.Reads();
+
+  printf("Fill 24h graph: %u flash reads (vs %u one sample at a time)\n",
+         fillReads, singleReads);
+  // binary search for now + one read per 16 samples page
+  TEST_ASSERT_TRUE(fillReads <= 11 + 24 * 12 / 16 + 1);
+}
+
+// Integer pipeline: mean of the concentration codes and integer AQI, vs the
+// float mean and AQI
+void TestFillFixedPoint() {
+  FlashSamples<AirSampleData, AirSampleTime> samples(gFlash, 1024, 0);
+  samples.Begin(true);
+  const size_t stored = 2 * 24 * 12;
+  for (size_t i = 0; i < stored; i++) {
+    AirSample sample(kNowSeconds - (stored - 1 - i) * 300, 0.0f,
+                     3.0f + (float)((i * 37) % 4000) / 10.0f, 0.0f, 1000.0f,
+                     77, 33, 3, 0.5f);
+    AirSampleData data;
+    sample.ToData(data);
+    samples.StoreSample(data);
+  }
+
+  DisplaySamples<144, int16_t> graph(600);
+  DisplaySamples<144, int16_t, CodeMeanAggregator, Pm_2_5CodeField> fixed(600);
+  clock_t start = clock();
+  TEST_ASSERT_EQUAL(144, graph.Fill(samples, kNowSeconds, pm25_to_aqi_value));
+  clock_t floatTicks = clock() - start;
+  start = clock();
+  TEST_ASSERT_EQUAL(144,
+                    fixed.Fill(samples, kNowSeconds, pm25_short_to_aqi_value));
+  clock_t fixedTicks = clock() - start;
+  printf("Fill 24h graph: %ld ticks (float) vs %ld ticks (integer)\n",
+         (long)floatTicks, (long)fixedTicks);
+
+  for (size_t i = 0; i < graph.Length(); i++) {
+    TEST_ASSERT_INT_WITHIN(1, graph.Value(i), fixed.Value(i));
+  }
+}
+
+// 24h, 7 days and 30 days views filled in one pass: same buffers as three
+// separate Fill, with the flash read only once.
+void TestFillAll() {
+  CountingFlash flash(gFlash);
+  FlashSamples<AirSampleData, AirSampleTime> samples(flash, 12 * 1024, 0);
+  samples.Begin(true);
+  const size_t stored = 10 * 24 * 12;
+  for (size_t i = 0; i < stored; i++) {
+    AirSample sample(kNowSeconds - (stored - 1 - i) * 300, 0.0f,
+                     10.0f + (i % 7) + (i / 500), 0.0f, 1000.0f, 77, 33, 3,
+                     0.5f);
+    AirSampleData data;
+    sample.ToData(data);
+    samples.StoreSample(data);
+  }
+
+  DisplaySamples<144, int16_t> day(600);
+  DisplaySamples<168, int16_t> week(3600);
+  DisplaySamples<30, int16_t> month(24 * 3600);
+  flash.ResetCounters();
+  size_t read = FillAll(samples, kNowSeconds, pm25_to_aqi_value, day, week,
+                        month);
+  uint32_t allReads = flash.Reads();
+  TEST_ASSERT_EQUAL(stored, read);
+
+  DisplaySamples<144, int16_t> dayRef(600);
+  DisplaySamples<168, int16_t> weekRef(3600);
+  DisplaySamples<30, int16_t> monthRef(24 * 3600);
+  flash.ResetCounters();
+  TEST_ASSERT_EQUAL(144, dayRef.Fill(samples, kNowSeconds, pm25_to_aqi_value));
+  TEST_ASSERT_EQUAL(168,
+                    weekRef.Fill(samples, kNowSeconds, pm25_to_aqi_value));
+  TEST_ASSERT_EQUAL(10,
+                    monthRef.Fill(samples, kNowSeconds, pm25_to_aqi_value));
+  uint32_t separateReads = flash.Reads();
+
+  for (size_t i = 0; i < day.Length(); i++) {
+    TEST_ASSERT_EQUAL(dayRef.Value(i), day.Value(i));
+  }
+  for (size_t i = 0; i < week.Length(); i++) {
+    TEST_ASSERT_EQUAL(weekRef.Value(i), week.Value(i));
+  }
+  for (size_t i = 0; i < month.Length(); i++) {
+    TEST_ASSERT_EQUAL(monthRef.Value(i), month.Value(i));
+  }
+  TEST_ASSERT_EQUAL(monthRef.SerieMin(), month.SerieMin());
+  TEST_ASSERT_EQUAL(monthRef.SerieMax(), month.SerieMax());
+
+  printf("Fill 24h + 7d + 30d: %u flash reads in one pass (vs %u)\n",
+         allReads, separateReads);
+  TEST_ASSERT_TRUE(allReads <= stored / 16 + 2);
+  TEST_ASSERT_TRUE(allReads < separateReads);
+}
+
+// Wake up every 5 minutes to store a new sample and update a 24h graph:
+// the incremental update should match a full rebuild, while only reading the
+// new sample from flash.
+void TestUpdateAcrossWakeUps() {
+  CountingFlash flash(gFlash);
+  FlashSamples<AirSampleData, AirSampleTime> samples(flash, 1024, 0);
+  samples.Begin(true);
+  MemoryStore reference;
+  // invalidate the state left by a previous run
+  uint32_t zeros[4] = {0, 0, 0, 0};
+  gStore.Write(0, zeros, sizeof(zeros));
+
+  const uint32_t kStart = kNowSeconds - 2 * 24 * 3600;
+  uint32_t maxReads = 0;
+  for (size_t i = 0; i < 2 * 24 * 12; i++) {
+    uint32_t now = kStart + i * 300 + 20;
+    if (i % 50 != 17) {
+      // some wake ups without new sample
+      AirSample sample(now - 15, 0.0f, 10.0f + (i % 11), 0.0f, 1000.0f, 77,
+                       33, 3, 0.5f);
+      AirSampleData data;
+      sample.ToData(data);
+      samples.StoreSample(data);
+    }
+
+    // New graph object, like after a deep sleep
+    DisplaySamples<144, int16_t> graph(600);
+    flash.ResetCounters();
+    size_t count = graph.Update(samples, now, pm25_to_aqi_value, gStore);
+    TEST_ASSERT_EQUAL(i == 0, graph.WasRebuilt());
+    if (i > 0 && flash.Reads() > maxReads) {
+      maxReads = flash.Reads();
+    }
+
+    if (i % 23 == 0 || i == 2 * 24 * 12 - 1) {
+      DisplaySamples<144, int16_t> rebuilt(600);
+      reference.Clear();
+      TEST_ASSERT_EQUAL(count, rebuilt.Update(samples, now, pm25_to_aqi_value,
+                                              reference));
+      TEST_ASSERT_TRUE(rebuilt.WasRebuilt());
+      for (size_t b = 0; b < graph.Length(); b++) {
+        TEST_ASSERT_EQUAL(rebuilt.Value(b), graph.Value(b));
+      }
+      TEST_ASSERT_EQUAL(rebuilt.SerieMin(), graph.SerieMin());
+      TEST_ASSERT_EQUAL(rebuilt.SerieMax(), graph.SerieMax());
+    }
+  }
+  printf("Incremental update: at most %u flash reads per wake up\n",
+         maxReads);
+  // two binary searches and a page
+  TEST_ASSERT_TRUE(maxReads <= 2 * (11 + 1) + 1);
+
+  // A corrupted state is detected
+  uint32_t word;
+  gStore.Read(sizeof(DisplayState), &word, 4);
+  word ^= 0x00010000;
+  gStore.Write(sizeof(DisplayState), &word, 4);
+  DisplaySamples<144, int16_t> graph(600);
+  graph.Update(samples, kNowSeconds, pm25_to_aqi_value, gStore);
+  TEST_ASSERT_TRUE(graph.WasRebuilt());
+
+  // As well as samples erased from flash
+  samples.Begin(true);
+  graph.Update(samples, kNowSeconds, pm25_to_aqi_value, gStore);
+  TEST_ASSERT_TRUE(graph.WasRebuilt());
+  TEST_ASSERT_EQUAL(INT16_MIN, graph.Value(graph.Length() - 1));
+
+  // Without any sample in the window, the next wake ups keep the state
+  flash.ResetCounters();
+  TEST_ASSERT_EQUAL(0, graph.Update(samples, kNowSeconds + 300,
+                                    pm25_to_aqi_value, gStore));
+  TEST_ASSERT_FALSE(graph.WasRebuilt());
+  TEST_ASSERT_EQUAL(0, flash.Reads());
+  AirSample sample(kNowSeconds + 550, 0.0f, 12.0f, 0.0f, 1000.0f, 77, 33, 3,
+                   0.5f);
+  AirSampleData data;
+  sample.ToData(data);
+  samples.StoreSample(data);
+  TEST_ASSERT_EQUAL(1, graph.Update(samples, kNowSeconds + 600,
+                                    pm25_to_aqi_value, gStore));
+  TEST_ASSERT_FALSE(graph.WasRebuilt());
+  DisplaySamples<144, int16_t> rebuilt(600);
+  reference.Clear();
+  TEST_ASSERT_EQUAL(1, rebuilt.Update(samples, kNowSeconds + 600,
+                                      pm25_to_aqi_value, reference));
+  TEST_ASSERT_EQUAL(rebuilt.Value(graph.Length() - 1),
+                    graph.Value(graph.Length() - 1));
+  TEST_ASSERT_EQUAL(rebuilt.Value(graph.Length() - 2),
+                    graph.Value(graph.Length() - 2));
+}
+
+// Incremental 90th percentile: the state of the P2 estimator of the open
+// bucket is saved along with the graph.
+void TestUpdateWithAggregator() {
+  FlashSamples<AirSampleData, AirSampleTime> samples(gFlash, 1024, 0);
+  samples.Begin(true);
+  MemoryStore reference;
+  uint32_t zeros[4] = {0, 0, 0, 0};
+  gStore.Write(0, zeros, sizeof(zeros));
+
+  const uint32_t kStart = kNowSeconds - 24 * 3600;
+  for (size_t i = 0; i < 12 * 12; i++) {
+    // several samples per wake up, so the open bucket has enough of them
+    for (uint32_t s = 0; s < 3; s++) {
+      uint32_t seconds = kStart + i * 300 + s * 90;
+      AirSample sample(seconds, 0.0f, 5.0f + ((i * 7 + s * 13) % 23), 0.0f,
+                       1000.0f, 77, 33, 3, 0.5f);
+      AirSampleData data;
+      sample.ToData(data);
+      samples.StoreSample(data);
+    }
+    uint32_t now = kStart + i * 300 + 200;
+    DisplaySamples<144, int16_t, P90Aggregator> graph(3600);
+    size_t count = graph.Update(samples, now, ToTenths, gStore);
+    TEST_ASSERT_EQUAL(i == 0, graph.WasRebuilt());
+
+    if (i % 10 == 0 || i == 12 * 12 - 1) {
+      DisplaySamples<144, int16_t, P90Aggregator> rebuilt(3600);
+      reference.Clear();
+      TEST_ASSERT_EQUAL(count,
+                        rebuilt.Update(samples, now, ToTenths, reference));
+      for (size_t b = 0; b < graph.Length(); b++) {
+        TEST_ASSERT_EQUAL(rebuilt.Value(b), graph.Value(b));
+      }
+    }
+  }
+}
+
 #if defined(ARDUINO)
 void loop() {}
 void setup() {
@@ -116,6 +465,14 @@ int main() {
   UNITY_BEGIN();
   RUN_TEST(TestFillFromEmptyFlash);
   RUN_TEST(TestFillDisplaySample);
+  RUN_TEST(TestFillInThePast);
+  RUN_TEST(TestFillAggregators);
+  RUN_TEST(TestPercentileEstimation);
+  RUN_TEST(TestFillFlashReads);
+  RUN_TEST(TestFillFixedPoint);
+  RUN_TEST(TestFillAll);
+  RUN_TEST(TestUpdateAcrossWakeUps);
+  RUN_TEST(TestUpdateWithAggregator);
 
   UNITY_END();
 }
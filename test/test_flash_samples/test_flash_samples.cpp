@@ -1,4 +1,6 @@
+#include "counting_flash.h"
 #include "flash_samples.h"
+#include "samples_cursor.h"
 #include "unity.h"
 
 #if defined(ARDUINO)
@@ -199,6 +201,305 @@ void TestWriteAgainOnFirstAndSecond() {
   TEST_ASSERT_EQUAL(4 * kSamplesPerSector + kSamplesPerSector / 2 - 1, data);
 }
 
+// Compare the sector search with the reference linear scan, for all the
+// interesting positions of the last sample in its sector, over more than
+// three rounds of the ring buffer.
+void TestSectorSearchMatchesLinearScan() {
+  FlashSamples<uint64_t> writer(gFlash, kMaxSampleLength, kFlashOffset);
+  writer.Begin(true);
+  uint64_t data = 0;
+  for (size_t i = 0; i < 10 * kSamplesPerSector; i++) {
+    TEST_ASSERT_TRUE(writer.StoreSample(data++));
+    size_t slot = i % kSamplesPerSector;
+    if (slot > 1 && slot < kSamplesPerSector - 2 &&
+        slot != kSamplesPerSector / 2) {
+      continue;
+    }
+    FlashSamples<uint64_t> linear(gFlash, kMaxSampleLength, kFlashOffset);
+    linear.Begin(false, ScanMode::Linear);
+    FlashSamples<uint64_t> search(gFlash, kMaxSampleLength, kFlashOffset);
+    search.Begin(false, ScanMode::SectorSearch);
+    TEST_ASSERT_EQUAL(writer.FirstSampleAddr(), linear.FirstSampleAddr());
+    TEST_ASSERT_EQUAL(writer.LastSampleAddr(), linear.LastSampleAddr());
+    TEST_ASSERT_EQUAL(linear.FirstSampleAddr(), search.FirstSampleAddr());
+    TEST_ASSERT_EQUAL(linear.LastSampleAddr(), search.LastSampleAddr());
+    TEST_ASSERT_EQUAL(linear.NumberOfSamples(), search.NumberOfSamples());
+  }
+}
+
+// Count the flash reads required to recover a ring buffer of the size used
+// by the application (160 sectors).
+void TestRecoveryReadCount() {
+  CountingFlash flash(gFlash);
+  const size_t length = 160 * kSamplesPerSector;
+  FlashSamples<uint64_t> writer(flash, length, 0);
+  writer.Begin(true);
+  uint64_t data = 0;
+  for (size_t i = 0; i < 5 * kSamplesPerSector / 2; i++) {
+    writer.StoreSample(data++);
+  }
+
+  FlashSamples<uint64_t> linear(flash, length, 0);
+  flash.ResetCounters();
+  linear.Begin(false, ScanMode::Linear);
+  uint32_t linearReads = flash.Reads();
+
+  FlashSamples<uint64_t> search(flash, length, 0);
+  flash.ResetCounters();
+  search.Begin(false, ScanMode::SectorSearch);
+  uint32_t searchReads = flash.Reads();
+
+  printf("Begin() flash reads: linear = %u / sector search = %u\n",
+         linearReads, searchReads);
+  TEST_ASSERT_EQUAL(linear.FirstSampleAddr(), search.FirstSampleAddr());
+  TEST_ASSERT_EQUAL(linear.LastSampleAddr(), search.LastSampleAddr());
+  TEST_ASSERT_EQUAL(length + 1, linearReads);
+  // one read per sector, ~log2(samples per sector) for the head sector,
+  // plus one read to check for the wrap around
+  TEST_ASSERT_TRUE(searchReads <= search.SectorsInUse() + 10 + 1);
+}
+
+// Samples with a timestamp for the sector headers
+struct TimedSample {
+  uint32_t seconds;
+  uint32_t value;
+};
+
+struct TimedSampleTime {
+  static const bool kTimestamped = true;
+  static uint32_t Seconds(const TimedSample& sample) { return sample.seconds; }
+};
+
+const uint32_t kHeadersOffset = kFlashOffset + 4 * SPI_FLASH_SEC_SIZE;
+const uint32_t kHeadersSectors = 4;
+
+void TestSectorHeadersLayout() {
+  typedef FlashSamples<TimedSample, TimedSampleTime> TimedFlashSamples;
+  // 16 bytes header = 2 slots of 8 bytes
+  const uint32_t slots = kSamplesPerSector - 2;
+  TimedFlashSamples writer(gFlash, kHeadersSectors * slots, kHeadersOffset,
+                           FlashLayout::SectorHeaders);
+  TEST_ASSERT_EQUAL(kHeadersSectors, writer.SectorsInUse());
+  TEST_ASSERT_EQUAL(slots, writer.SlotsPerSector());
+  writer.Begin(true);
+  TEST_ASSERT_TRUE(writer.IsEmpty());
+
+  // The first four bytes of the samples are all ones: not a problem anymore
+  TimedSample sample = {0xFFFFFFFF, 0};
+  for (size_t i = 0; i < 3 * kHeadersSectors * slots; i++) {
+    sample.value = i;
+    TEST_ASSERT_TRUE(writer.StoreSample(sample));
+    size_t slot = i % slots;
+    if (slot > 1 && slot < slots - 2 && slot != slots / 2) {
+      continue;
+    }
+    TimedFlashSamples scan(gFlash, kHeadersSectors * slots,
+                           kHeadersOffset, FlashLayout::SectorHeaders);
+    scan.Begin(false, ScanMode::Linear);
+    TimedFlashSamples search(gFlash, kHeadersSectors * slots,
+                             kHeadersOffset, FlashLayout::SectorHeaders);
+    search.Begin(false, ScanMode::SectorSearch);
+    TEST_ASSERT_EQUAL(writer.FirstSampleAddr(), scan.FirstSampleAddr());
+    TEST_ASSERT_EQUAL(writer.LastSampleAddr(), scan.LastSampleAddr());
+    TEST_ASSERT_EQUAL(writer.FirstSampleAddr(), search.FirstSampleAddr());
+    TEST_ASSERT_EQUAL(writer.LastSampleAddr(), search.LastSampleAddr());
+
+    size_t n = search.NumberOfSamples();
+    TEST_ASSERT_EQUAL(writer.NumberOfSamples(), n);
+    TimedSample read;
+    TEST_ASSERT_TRUE(search.ReadSample(0, read));
+    TEST_ASSERT_EQUAL(i, read.value);
+    TEST_ASSERT_TRUE(search.ReadSample(n - 1, read));
+    TEST_ASSERT_EQUAL(i + 1 - n, read.value);
+  }
+
+  // Continue storing after a new Begin()
+  TimedFlashSamples resumed(gFlash, kHeadersSectors * slots,
+                            kHeadersOffset, FlashLayout::SectorHeaders);
+  resumed.Begin();
+  for (size_t i = 0; i < slots / 2; i++) {
+    sample.seconds = 1000 + i;
+    sample.value++;
+    TEST_ASSERT_TRUE(resumed.StoreSample(sample));
+  }
+  TimedSample read;
+  TEST_ASSERT_TRUE(resumed.ReadSample(0, read));
+  TEST_ASSERT_EQUAL(sample.value, read.value);
+
+  // Header of the sector holding the most recent samples
+  uint32_t head = (resumed.LastSampleAddr() - resumed.FlashStorageStart()) /
+                  SPI_FLASH_SEC_SIZE;
+  SectorHeader header;
+  TEST_ASSERT_TRUE(resumed.ReadSectorHeader(head, header));
+  TEST_ASSERT_EQUAL(3 * kHeadersSectors, header.sequence);
+  TEST_ASSERT_EQUAL(1000, header.firstSeconds);
+  TEST_ASSERT_EQUAL(UINT32_MAX, header.count);
+  uint32_t previous = (head + kHeadersSectors - 1) % kHeadersSectors;
+  TEST_ASSERT_TRUE(resumed.ReadSectorHeader(previous, header));
+  TEST_ASSERT_EQUAL(3 * kHeadersSectors - 1, header.sequence);
+  TEST_ASSERT_EQUAL(slots, header.count);
+}
+
+void TestSectorHeadersReadCount() {
+  CountingFlash flash(gFlash);
+  const size_t length = 160 * kSamplesPerSector;
+  FlashSamples<uint64_t> writer(flash, length, 0, FlashLayout::SectorHeaders);
+  writer.Begin(true);
+  uint64_t data = 0;
+  for (size_t i = 0; i < 5 * kSamplesPerSector / 2; i++) {
+    writer.StoreSample(data++);
+  }
+
+  FlashSamples<uint64_t> scan(flash, length, 0, FlashLayout::SectorHeaders);
+  flash.ResetCounters();
+  scan.Begin(false, ScanMode::Linear);
+  uint32_t scanReads = flash.Reads();
+
+  FlashSamples<uint64_t> search(flash, length, 0, FlashLayout::SectorHeaders);
+  flash.ResetCounters();
+  search.Begin(false, ScanMode::SectorSearch);
+  uint32_t searchReads = flash.Reads();
+
+  printf("Begin() flash reads with headers: scan = %u / search = %u\n",
+         scanReads, searchReads);
+  TEST_ASSERT_EQUAL(writer.LastSampleAddr(), search.LastSampleAddr());
+  TEST_ASSERT_EQUAL(writer.FirstSampleAddr(), search.FirstSampleAddr());
+  TEST_ASSERT_EQUAL(writer.LastSampleAddr(), scan.LastSampleAddr());
+  // binary search over the sectors, then over the slots of the head sector
+  TEST_ASSERT_TRUE(searchReads <= 2 * 9 + 4);
+}
+
+void TestFindIndexAtOrBefore() {
+  CountingFlash flash(gFlash);
+  FlashSamples<TimedSample, TimedSampleTime> samples(
+      flash, kHeadersSectors * kSamplesPerSector, kHeadersOffset);
+  samples.Begin(true);
+  TEST_ASSERT_EQUAL(SIZE_MAX, samples.FindIndexAtOrBefore(1000));
+
+  // One sample every 5 minutes, wrapping around the ring
+  const uint32_t start = 1600000000;
+  const size_t stored = 5 * kSamplesPerSector;
+  TimedSample sample;
+  for (size_t i = 0; i < stored; i++) {
+    sample.seconds = start + i * 300;
+    sample.value = i;
+    samples.StoreSample(sample);
+  }
+  const size_t n = samples.NumberOfSamples();
+  const uint32_t oldest = sample.seconds - (n - 1) * 300;
+
+  TEST_ASSERT_EQUAL(0, samples.FindIndexAtOrBefore(sample.seconds));
+  TEST_ASSERT_EQUAL(0, samples.FindIndexAtOrBefore(sample.seconds + 3600));
+  TEST_ASSERT_EQUAL(1, samples.FindIndexAtOrBefore(sample.seconds - 1));
+  TEST_ASSERT_EQUAL(12, samples.FindIndexAtOrBefore(sample.seconds - 3600));
+  TEST_ASSERT_EQUAL(n - 1, samples.FindIndexAtOrBefore(oldest));
+  TEST_ASSERT_EQUAL(n - 1, samples.FindIndexAtOrBefore(oldest + 299));
+  TEST_ASSERT_EQUAL(SIZE_MAX, samples.FindIndexAtOrBefore(oldest - 1));
+
+  flash.ResetCounters();
+  size_t index = samples.FindIndexAtOrBefore(oldest + 1000 * 300 + 10);
+  TEST_ASSERT_EQUAL(n - 1 - 1000, index);
+  // log2(n) reads
+  TEST_ASSERT_TRUE(flash.Reads() <= 12);
+  TimedSample read;
+  samples.ReadSample(index, read);
+  TEST_ASSERT_EQUAL(oldest + 1000 * 300, read.seconds);
+
+  // Same results from the most recent sample
+  const uint32_t times[] = {sample.seconds + 3600, sample.seconds - 1,
+                            sample.seconds - 3600, oldest + 299,
+                            oldest + 1000 * 300 + 10, oldest - 1};
+  for (uint32_t seconds : times) {
+    TEST_ASSERT_EQUAL(samples.FindIndexAtOrBefore(seconds),
+                      samples.FindRecentIndexAtOrBefore(seconds));
+  }
+  // a single read for the most recent sample, 2 * log2(index) + 1 otherwise
+  flash.ResetCounters();
+  TEST_ASSERT_EQUAL(0, samples.FindRecentIndexAtOrBefore(sample.seconds + 60));
+  TEST_ASSERT_EQUAL(1, flash.Reads());
+  flash.ResetCounters();
+  TEST_ASSERT_EQUAL(12, samples.FindRecentIndexAtOrBefore(sample.seconds -
+                                                          3600));
+  TEST_ASSERT_TRUE(flash.Reads() <= 2 * 4 + 1);
+}
+
+template <typename SAMPLES>
+void CheckReadSamples(SAMPLES& samples, CountingFlash& flash,
+                      uint32_t maxReads) {
+  const size_t n = samples.NumberOfSamples();
+  const size_t kMaxRange = 600;
+  static TimedSample range[kMaxRange];
+  const size_t starts[] = {0, 1, 100, 511, 1000, n - 300, n - 1};
+  for (size_t start : starts) {
+    flash.ResetCounters();
+    size_t count = samples.ReadSamples(start, kMaxRange, range);
+    TEST_ASSERT_TRUE(flash.Reads() <= maxReads);
+    TEST_ASSERT_EQUAL(kMaxRange < n - start ? kMaxRange : n - start, count);
+    for (size_t i = 0; i < count; i++) {
+      TimedSample expected;
+      samples.ReadSample(start + i, expected);
+      TEST_ASSERT_EQUAL(expected.value, range[i].value);
+    }
+  }
+  TEST_ASSERT_EQUAL(0, samples.ReadSamples(n, 10, range));
+}
+
+void TestReadSamples() {
+  CountingFlash flash(gFlash);
+  TimedSample sample;
+  FlashLayout layouts[] = {FlashLayout::Raw, FlashLayout::SectorHeaders};
+  for (FlashLayout layout : layouts) {
+    FlashSamples<TimedSample, TimedSampleTime> samples(
+        flash, kHeadersSectors * kSamplesPerSector, kHeadersOffset, layout);
+    samples.Begin(true);
+    // Wrap around the ring, with the last sample in the middle of a sector
+    for (size_t i = 0; i < 5 * kSamplesPerSector + kSamplesPerSector / 3;
+         i++) {
+      sample.seconds = 1600000000 + i * 300;
+      sample.value = i;
+      samples.StoreSample(sample);
+    }
+    if (layout == FlashLayout::Raw) {
+      // at most 2 reads when wrapping around the storage end
+      CheckReadSamples(samples, flash, 2);
+    } else {
+      // one read per sector crossed
+      CheckReadSamples(samples, flash, 3);
+    }
+
+    // Iterate over the full serie in both directions
+    const size_t n = samples.NumberOfSamples();
+    SamplesCursor<FlashSamples<TimedSample, TimedSampleTime> > backward(
+        samples, 0);
+    size_t count = 0;
+    flash.ResetCounters();
+    while (backward.Next(sample)) {
+      TEST_ASSERT_EQUAL(5 * kSamplesPerSector + kSamplesPerSector / 3 - 1 -
+                            count,
+                        sample.value);
+      count++;
+    }
+    TEST_ASSERT_EQUAL(n, count);
+    printf("Cursor over %u samples: %u flash reads\n", (unsigned)n,
+           flash.Reads());
+    TEST_ASSERT_TRUE(flash.Reads() <= 2 * (n / 32 + 1));
+
+    SamplesCursor<FlashSamples<TimedSample, TimedSampleTime> > forward(
+        samples, n - 1, CursorDirection::Forward);
+    count = 0;
+    uint32_t previous = 0;
+    while (forward.Next(sample)) {
+      if (count > 0) {
+        TEST_ASSERT_EQUAL(previous + 1, sample.value);
+      }
+      previous = sample.value;
+      count++;
+    }
+    TEST_ASSERT_EQUAL(n, count);
+    TEST_ASSERT_EQUAL(SIZE_MAX, forward.Index());
+  }
+}
+
 #if defined(ARDUINO)
 void loop() {}
 
@@ -223,5 +524,11 @@ void setup() {
   RUN_TEST(TestWriteOnSecondSector);
   RUN_TEST(TestWriteOnThirdSector);
   RUN_TEST(TestWriteAgainOnFirstAndSecond);
+  RUN_TEST(TestSectorSearchMatchesLinearScan);
+  RUN_TEST(TestRecoveryReadCount);
+  RUN_TEST(TestSectorHeadersLayout);
+  RUN_TEST(TestSectorHeadersReadCount);
+  RUN_TEST(TestFindIndexAtOrBefore);
+  RUN_TEST(TestReadSamples);
   UNITY_END();
 }
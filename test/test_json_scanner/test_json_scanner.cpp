@@ -0,0 +1,152 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "json_scanner.h"
+#include "sensors.h"
+#include "unity.h"
+
+/** Records the events as text */
+class TraceHandler : public JsonHandler {
+ public:
+  TraceHandler() : nested_(*this) { trace_[0] = '\0'; }
+
+  void OnStart(uint8_t depth, const char *key, bool object) override {
+    Append("%s%c%d ", key, object ? '{' : '[', depth);
+  }
+  void OnEnd(uint8_t depth, bool object) override {
+    Append("%c%d ", object ? '}' : ']', depth);
+  }
+  void OnValue(uint8_t depth, const char *key, const char *value) override {
+    Append("%s=%s ", key, value);
+  }
+  JsonScanner *NestedScanner(uint8_t depth, const char *key) override {
+    return (strcmp(key, "json") == 0) ? &nested_ : nullptr;
+  }
+
+  const char *Trace() const { return trace_; }
+
+ protected:
+  void Append(const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+  JsonScanner nested_;
+  char trace_[512];
+};
+
+#include <stdarg.h>
+
+void TraceHandler::Append(const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+  size_t length = strlen(trace_);
+  vsnprintf(trace_ + length, sizeof(trace_) - length, format, args);
+  va_end(args);
+}
+
+void test_scanner_events(void) {
+  const char *json =
+      "{\"a\": 1, \"b\":\"x\\\"y\\n\\u00e9\", \"c\": [true, null, -2.5e3],"
+      "\"d\": {\"e\": {}}, \"json\": \"{\\\"v1\\\":3.5,\\\"v\\\":[1]}\","
+      "\"long\": \"0123456789012345678901234567890123456789\"}";
+  TraceHandler handler;
+  JsonScanner scanner(handler);
+  TEST_ASSERT_TRUE(scanner.Feed(json, strlen(json)));
+  TEST_ASSERT_TRUE(scanner.IsComplete());
+  TEST_ASSERT_EQUAL_STRING(
+      "{1 a=1 b=x\"y\n? c[2 =true =null =-2.5e3 ]2 d{2 e{3 }3 }2 "
+      "{1 v1=3.5 v[2 =1 ]2 }1 long=0123456789012345678901234567890 }1 ",
+      handler.Trace());
+}
+
+void test_scanner_errors(void) {
+  TraceHandler handler;
+  JsonScanner scanner(handler);
+  TEST_ASSERT_FALSE(scanner.Feed("{\"a\": [1}", 9));
+  TEST_ASSERT_TRUE(scanner.HasError());
+  TEST_ASSERT_FALSE(scanner.Feed('}'));
+
+  scanner.Reset();
+  TEST_ASSERT_FALSE(scanner.Feed("x", 1));
+  scanner.Reset();
+  TEST_ASSERT_FALSE(scanner.Feed("{}}", 3));
+
+  // fed in pieces
+  scanner.Reset();
+  TEST_ASSERT_TRUE(scanner.Feed("{\"a\"", 4));
+  TEST_ASSERT_TRUE(scanner.Feed(":12", 3));
+  TEST_ASSERT_FALSE(scanner.IsComplete());
+  TEST_ASSERT_TRUE(scanner.Feed("3}", 2));
+  TEST_ASSERT_TRUE(scanner.IsComplete());
+}
+
+#if !defined(ARDUINO)
+
+static size_t read_file(const char *path, char *buffer, size_t capacity) {
+  FILE *file = fopen(path, "rb");
+  if (file == nullptr) {
+    return 0;
+  }
+  size_t size = fread(buffer, 1, capacity, file);
+  fclose(file);
+  return size;
+}
+
+void test_parse_sensor_group(void) {
+  static char json[32 * 1024];
+  size_t size = read_file("data/sensor_group.json", json, sizeof(json));
+  TEST_ASSERT_TRUE(size > 0);
+
+  // unordered, and one sensor not in the response
+  AirSensors sensors;
+  const size_t ids[] = {54857, 59927, 12345, 36667};
+  for (size_t i = 0; i < 4; i++) {
+    sensors.AddSensor(ids[i]);
+  }
+  TEST_ASSERT_EQUAL(3, sensors.ParseSensors(json, size));
+
+  const SensorData &first = sensors.Data(0);
+  TEST_ASSERT_EQUAL(54857, first.id);
+  TEST_ASSERT_EQUAL(1600617119, first.timestamp);
+  TEST_ASSERT_EQUAL_FLOAT(18.26, first.pm_2_5_A);
+  TEST_ASSERT_EQUAL_FLOAT(16.09, first.pm_2_5_B);
+  TEST_ASSERT_EQUAL(1, first.age_A);
+  TEST_ASSERT_EQUAL(1, first.age_B);
+  TEST_ASSERT_EQUAL(70, first.temperature);
+  TEST_ASSERT_EQUAL(68, first.humidity);
+  TEST_ASSERT_EQUAL_FLOAT(993.54, first.pressure);
+  TEST_ASSERT_EQUAL_FLOAT(15.43, first.averages[TenMinutes]);
+
+  const SensorData &second = sensors.Data(1);
+  TEST_ASSERT_EQUAL(59927, second.id);
+  TEST_ASSERT_EQUAL_FLOAT(24.16, second.pm_2_5_B);
+  const float averages[] = {19.31, 18.3, 19.1, 18.1, 18.06, 43.14};
+  for (short i = 0; i < PmAvgSize; i++) {
+    TEST_ASSERT_EQUAL_FLOAT(averages[i], second.averages[i]);
+  }
+  TEST_ASSERT_EQUAL_FLOAT(12.19, sensors.Data(3).pm_2_5_A);
+
+  printf("Streaming parser: %u bytes (vs %u for the JSON document)\n",
+         (unsigned)(sizeof(PurpleAirParser)), 20000);
+  TEST_ASSERT_TRUE(sizeof(PurpleAirParser) < 400);
+}
+
+#endif
+
+#if defined(ARDUINO)
+#include <Arduino.h>
+void setup() {
+#else
+int main(int argc, char **argv) {
+#endif
+  UNITY_BEGIN();
+  RUN_TEST(test_scanner_events);
+  RUN_TEST(test_scanner_errors);
+#if !defined(ARDUINO)
+  // the recorded responses are only available on the host
+  RUN_TEST(test_parse_sensor_group);
+#endif
+  UNITY_END();
+}
+
+#if defined(ARDUINO)
+void loop() {}
+#endif
@@ -0,0 +1,125 @@
+#include <string.h>
+
+#include "counting_flash.h"
+#include "memory_store.h"
+#include "nowcast_samples.h"
+#include "unity.h"
+
+#if defined(ARDUINO)
+#include "rtc_store.h"
+EspFlash gFlash;
+RtcStore gStore;
+#else
+#include "sim_flash.h"
+SimFlash gFlash;
+// the RTC memory, without leaving a file in the working tree
+MemoryStore gStore;
+#endif
+
+const uint32_t kNowSeconds = k2019epoch + 365 * 24 * 3600;
+
+void TestNowCastFormula() {
+  // Example from the AirNow NowCast documentation (most recent hour first)
+  const float hourly[kNowCastHours] = {13, 16, 10, 21, 74, 64,
+                                       53, 82, 90, 75, 80, 50};
+  float nowcast;
+  TEST_ASSERT_TRUE(pm_nowcast(hourly, nowcast));
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, 17.41f, nowcast);
+
+  float constant[kNowCastHours];
+  for (size_t i = 0; i < kNowCastHours; i++) {
+    constant[i] = 10.0f;
+  }
+  TEST_ASSERT_TRUE(pm_nowcast(constant, nowcast));
+  TEST_ASSERT_FLOAT_WITHIN(0.001f, 10.0f, nowcast);
+
+  // w = 0.5 with the missing hours ignored: (20 + 0.5 * 10) / 1.5
+  float partial[kNowCastHours];
+  for (size_t i = 0; i < kNowCastHours; i++) {
+    partial[i] = -1.0f;
+  }
+  partial[0] = 20.0f;
+  TEST_ASSERT_FALSE(pm_nowcast(partial, nowcast));
+  partial[1] = 10.0f;
+  TEST_ASSERT_TRUE(pm_nowcast(partial, nowcast));
+  TEST_ASSERT_FLOAT_WITHIN(0.001f, 50.0f / 3.0f, nowcast);
+
+  // two of the three most recent hours are required
+  partial[0] = -1.0f;
+  partial[2] = 10.0f;
+  TEST_ASSERT_TRUE(pm_nowcast(partial, nowcast));
+  TEST_ASSERT_FLOAT_WITHIN(0.001f, 10.0f, nowcast);
+  partial[1] = -1.0f;
+  partial[5] = 10.0f;
+  TEST_ASSERT_FALSE(pm_nowcast(partial, nowcast));
+}
+
+// Wake up every 5 minutes to store a new sample: the NowCast updated from
+// the saved hourly buckets matches the one rebuilt from flash, and only the
+// new samples are read.
+void TestNowCastAcrossWakeUps() {
+  CountingFlash flash(gFlash);
+  FlashSamples<AirSampleData, AirSampleTime> samples(flash, 1024, 0);
+  samples.Begin(true);
+  MemoryStore reference;
+  // invalidate the state left by a previous run
+  uint32_t zeros[4] = {0, 0, 0, 0};
+  gStore.Write(0, zeros, sizeof(zeros));
+
+  const uint32_t kStart = kNowSeconds - 24 * 3600;
+  const size_t kWakeUps = 24 * 12;
+  uint32_t maxReads = 0;
+  for (size_t i = 0; i < kWakeUps; i++) {
+    uint32_t now = kStart + i * 300 + 20;
+    // a smoke event in the afternoon
+    float pm25 = (i > 150 && i < 200) ? 80.0f + (i % 7) : 8.0f + (i % 5);
+    AirSample sample(now - 15, 0.0f, pm25, 0.0f, 1000.0f, 77, 33, 3, 0.5f);
+    AirSampleData data;
+    sample.ToData(data);
+    samples.StoreSample(data);
+
+    NowCastSamples nowcast;
+    flash.ResetCounters();
+    bool valid = nowcast.Update(samples, now, gStore);
+    TEST_ASSERT_EQUAL(i == 0, nowcast.WasRebuilt());
+    // two complete hours are needed
+    if (i < 12) {
+      TEST_ASSERT_FALSE(valid);
+    } else if (i >= 3 * 12) {
+      TEST_ASSERT_TRUE(valid);
+    }
+    if (i > 0 && flash.Reads() > maxReads) {
+      maxReads = flash.Reads();
+    }
+
+    if (i % 19 == 0 || i == kWakeUps - 1) {
+      NowCastSamples rebuilt;
+      reference.Clear();
+      TEST_ASSERT_EQUAL(valid, rebuilt.Update(samples, now, reference));
+      TEST_ASSERT_TRUE(rebuilt.WasRebuilt());
+      TEST_ASSERT_EQUAL_FLOAT(rebuilt.Concentration(),
+                              nowcast.Concentration());
+      TEST_ASSERT_EQUAL(rebuilt.Aqi(), nowcast.Aqi());
+    }
+    if (i == 200) {
+      // the NowCast follows the smoke event
+      TEST_ASSERT_TRUE(nowcast.Concentration() > 50.0f);
+      TEST_ASSERT_TRUE(nowcast.Aqi() >= 150);
+    }
+  }
+  printf("NowCast update: at most %u flash reads per wake up\n", maxReads);
+  TEST_ASSERT_TRUE(maxReads <= 2 * (11 + 1) + 1);
+  TEST_ASSERT_TRUE(NowCastSamples::StateSize() <= 128);
+}
+
+#if defined(ARDUINO)
+void loop() {}
+void setup() {
+#else
+int main() {
+#endif
+  UNITY_BEGIN();
+  RUN_TEST(TestNowCastFormula);
+  RUN_TEST(TestNowCastAcrossWakeUps);
+  UNITY_END();
+}
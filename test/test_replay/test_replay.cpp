@@ -0,0 +1,372 @@
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "unity.h"
+
+#if !defined(ARDUINO)
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#include "cfaqi.h"
+#include "counting_flash.h"
+#include "memory_store.h"
+#include "sim_flash.h"
+#include "wake_up.h"
+
+/**
+ * Replay of the wake ups of the monitor on the native target, through the
+ * code of the device: parse of the response, analysis of the sensors and
+ * scores of their reliability (wake_up.h, like main.cpp), storage of the
+ * sample on flash, and update of the graph and of the NowCast from the
+ * flash. A virtual clock replaces millis() and the deep sleep, and a
+ * MemoryStore the RTC memory.
+ *
+ * The responses are synthesized (PurpleAir API with selected fields) from a
+ * daily cycle of the concentrations, with a smoke episode and a sensor
+ * failing in the middle of the replay. Recorded responses can be replayed
+ * instead: AAQIM_REPLAY_DIR=<dir> with <dir>/00000.json, 00001.json... in
+ * the order of the wake ups (legacy or API format).
+ */
+
+/** Durations of a stage of the wake ups */
+class StageTimer {
+ public:
+  explicit StageTimer(const char* name) : name_(name) {}
+
+  void Start() { start_ = std::chrono::steady_clock::now(); }
+
+  void Stop() {
+    std::chrono::duration<float, std::micro> elapsed =
+        std::chrono::steady_clock::now() - start_;
+    durations_.push_back(elapsed.count());
+  }
+
+  /** Nearest rank percentile, in microseconds */
+  float Percentile(int percent) {
+    std::sort(durations_.begin(), durations_.end());
+    size_t rank = (percent * durations_.size() + 99) / 100;
+    return durations_[(rank > 0 ? rank : 1) - 1];
+  }
+
+  float Total() const {
+    float total = 0.0f;
+    for (float d : durations_) {
+      total += d;
+    }
+    return total;
+  }
+
+  void Print() {
+    printf("%-9s p50 %7.1f us | p90 %7.1f | p99 %7.1f | max %7.1f | "
+           "%8.0f /s\n",
+           name_, Percentile(50), Percentile(90), Percentile(99),
+           Percentile(100), durations_.size() / Total() * 1e6f);
+  }
+
+ protected:
+  const char* name_;
+  std::chrono::steady_clock::time_point start_;
+  std::vector<float> durations_;
+};
+
+const uint32_t kWakePeriod = 5 * 60;
+const uint32_t kReplayStart = 1600617180;
+const uint32_t kReplayDays = 60;
+// a sensor reading wrong values from the 10th day
+const size_t kFailingSensor = 1;
+const uint32_t kFailureStart = kReplayStart + 10 * 24 * 3600;
+
+SimFlash gSimFlash;
+CountingFlash gFlash(gSimFlash);
+
+// ~16K samples: the ring wraps during the replay
+class DeviceSamples : public FlashSamples<AirSampleData, AirSampleTime> {
+ public:
+  DeviceSamples()
+      : FlashSamples<AirSampleData, AirSampleTime>(gFlash, 64 * 256,
+                                                   0x10000) {}
+};
+
+/** Concentration of the synthesized air (ug/m3): a daily cycle, and a smoke
+ * episode of 5 days */
+static float true_concentration(uint32_t seconds) {
+  float day = (float)(seconds - kReplayStart) / (24.0f * 3600.0f);
+  float pm = 8.0f + 5.0f * sinf(2.0f * (float)(M_PI) * day);
+  if (day >= 20.0f && day < 25.0f) {
+    pm += 60.0f * sinf((float)(M_PI) * (day - 20.0f) / 5.0f);
+  }
+  return pm;
+}
+
+/** Deterministic noise in [-1, 1] */
+static float noise(uint32_t &state) {
+  state = state * 1664525u + 1013904223u;
+  return (float)(state >> 8) / (float)(1 << 23) - 1.0f;
+}
+
+/** Response of the PurpleAir API for the sensors requested */
+static size_t synthesize_response(const AirSensorsBase &sensors, uint32_t now,
+                                  uint32_t &random, char *json,
+                                  size_t capacity) {
+  int length = snprintf(
+      json, capacity,
+      "{\"api_version\": \"V1.0.6\", \"time_stamp\": %u, \"fields\": "
+      "[\"sensor_index\", \"last_seen\", \"humidity\", \"temperature\", "
+      "\"pressure\", \"pm2.5_atm_a\", \"pm2.5_atm_b\", \"pm2.5_10minute\"], "
+      "\"data\": [",
+      (unsigned)(now));
+  bool first = true;
+  for (size_t i = 0; i < sensors.Count(); i++) {
+    size_t id = sensors.Id(i);
+    if (sensors.IsSkipped(id)) {
+      continue;
+    }
+    float pm = true_concentration(now) * (1.0f + 0.05f * noise(random));
+    if (i == kFailingSensor && now >= kFailureStart) {
+      pm = 4.0f * pm + 30.0f;
+    }
+    float pmA = pm * (1.0f + 0.03f * noise(random));
+    float pmB = pm * (1.0f + 0.03f * noise(random));
+    length += snprintf(json + length, capacity - length,
+                       "%s[%u, %u, 35, 68, 1012.5, %.2f, %.2f, %.2f]",
+                       first ? "" : ", ", (unsigned)(id),
+                       (unsigned)(now - 20 - i * 7), pmA, pmB, pm);
+    first = false;
+  }
+  length += snprintf(json + length, capacity - length, "]}");
+  return (size_t)(length);
+}
+
+/** Recorded response of a wake up, if AAQIM_REPLAY_DIR is set */
+static size_t read_recorded_response(size_t wake, char *json,
+                                     size_t capacity) {
+  const char *dir = getenv("AAQIM_REPLAY_DIR");
+  if (dir == nullptr) {
+    return 0;
+  }
+  char path[256];
+  snprintf(path, sizeof(path), "%s/%05u.json", dir, (unsigned)(wake));
+  FILE *file = fopen(path, "rb");
+  if (file == nullptr) {
+    return 0;
+  }
+  size_t size = fread(json, 1, capacity, file);
+  fclose(file);
+  return size;
+}
+
+/** Result of a wake up, for the checks */
+struct WakeResult {
+  size_t kept;
+  float pm_2_5;
+  uint32_t seconds;  // of the sample, the time of the graph like in main.cpp
+  AirSampleData stored;
+  bool failingRequested;
+  size_t responseBytes;
+  bool nowcastValid;
+  float nowcast;
+  uint32_t historyReads;  // flash reads of the graph and NowCast updates
+};
+
+struct ReplayTimers {
+  StageTimer begin{"begin"};
+  StageTimer parse{"parse"};
+  StageTimer analysis{"analysis"};
+  StageTimer store{"store"};
+  StageTimer graph{"graph"};
+  StageTimer wake{"wake up"};
+};
+
+/** A wake up of main.cpp, without the network and the display */
+static bool replay_wake(uint32_t now, size_t wake, bool recorded,
+                        MemoryStore &rtc, uint32_t &random,
+                        ReplayTimers &timers, WakeResult &result,
+                        GraphBuffer &graph) {
+  static char json[24 * 1024];
+
+  timers.wake.Start();
+  timers.begin.Start();
+  // new objects, like after a deep sleep
+  DeviceSamples flashSamples;
+  flashSamples.Begin();
+  GroupReliability reliability;
+  reliability.Load(rtc, kReliabilityStateOffset);
+  AirSensors sensors;
+  RequestSensors(kSensorIds, sizeof(kSensorIds) / sizeof(size_t), reliability,
+                 sensors);
+  timers.begin.Stop();
+  result.failingRequested = !sensors.IsSkipped(kSensorIds[kFailingSensor]);
+
+  // not timed: the network
+  timers.wake.Stop();
+  size_t size = recorded ? read_recorded_response(wake, json, sizeof(json))
+                         : synthesize_response(sensors, now, random, json,
+                                               sizeof(json));
+  if (size == 0) {
+    return false;
+  }
+  result.responseBytes = size;
+  timers.wake.Start();
+
+  timers.parse.Start();
+  MemorySource source(json, size);
+  if (strstr(json, "\"fields\"") != nullptr) {
+    sensors.ParseSensorsFields(source);
+  } else {
+    sensors.ParseSensors(source);
+  }
+  timers.parse.Stop();
+
+  timers.analysis.Start();
+  AirSample sample;
+  GroupDiagnostics<AirSensors::kCapacity> diagnostics;
+  result.kept = AnalyzeSensors(sensors, sample, diagnostics, nullptr,
+                               &reliability);
+  reliability.Save(rtc, kReliabilityStateOffset);
+  result.pm_2_5 = sample.Pm_2_5();
+  result.seconds = sample.Seconds();
+  timers.analysis.Stop();
+
+  if (result.kept > 0) {
+    timers.store.Start();
+    sample.ToData(result.stored);
+    flashSamples.StoreSample(result.stored);
+    timers.store.Stop();
+
+    timers.graph.Start();
+    gFlash.ResetCounters();
+    NowCastSamples nowcast;
+    result.nowcastValid = nowcast.Update(flashSamples, sample.Seconds(), rtc,
+                                         kNowCastStateOffset);
+    result.nowcast = nowcast.Concentration();
+    graph.Update(flashSamples, sample.Seconds(), pm25_short_to_aqi_value, rtc,
+                 kGraphStateOffset);
+    result.historyReads = gFlash.Reads();
+    timers.graph.Stop();
+  }
+  timers.wake.Stop();
+  return true;
+}
+
+void TestReplay() {
+  const bool recorded = (getenv("AAQIM_REPLAY_DIR") != nullptr);
+  DeviceSamples flashSamples;
+  flashSamples.Begin(true);
+  MemoryStore rtc;
+  ReplayTimers timers;
+  uint32_t random = 1;
+
+  const size_t kWakes = kReplayDays * 24 * 3600 / kWakePeriod;
+  size_t wakes = 0;
+  size_t failingRequests = 0;
+  size_t bytes = 0;
+  uint32_t maxHistoryReads = 0;
+  float maxError = 0.0f;
+  AirSampleData lastStored;
+  uint32_t now = kReplayStart;
+  for (; wakes < kWakes; wakes++, now += kWakePeriod) {
+    GraphBuffer graph(kGraphPeriodSeconds);
+    WakeResult result;
+    if (!replay_wake(now, wakes, recorded, rtc, random, timers, result,
+                     graph)) {
+      break;
+    }
+    bytes += result.responseBytes;
+    TEST_ASSERT_TRUE(result.kept > 0);
+    lastStored = result.stored;
+    if (wakes > 0 && result.historyReads > maxHistoryReads) {
+      // the first wake up builds the states from flash
+      maxHistoryReads = result.historyReads;
+    }
+    if (recorded) {
+      continue;
+    }
+
+    // the fusion follows the air, whatever the failing sensor does
+    float error = fabsf(result.pm_2_5 - true_concentration(now)) /
+                  true_concentration(now);
+    maxError = (error > maxError) ? error : maxError;
+    TEST_ASSERT_TRUE(error < 0.1f);
+    if (now >= kFailureStart && result.failingRequested) {
+      failingRequests++;
+    }
+
+    // the incremental graph and NowCast match the ones rebuilt from flash,
+    // once a day
+    if (wakes % (24 * 3600 / kWakePeriod) == 0) {
+      DeviceSamples samples;
+      samples.Begin();
+      GraphBuffer rebuilt(kGraphPeriodSeconds);
+      MemoryStore empty;
+      rebuilt.Update(samples, result.seconds, pm25_short_to_aqi_value, empty);
+      TEST_ASSERT_TRUE(rebuilt.WasRebuilt());
+      for (size_t b = 0; b < graph.Length(); b++) {
+        TEST_ASSERT_EQUAL(rebuilt.Value(b), graph.Value(b));
+      }
+      NowCastSamples nowcast;
+      empty.Clear();
+      TEST_ASSERT_EQUAL(result.nowcastValid,
+                        nowcast.Update(samples, result.seconds, empty));
+      TEST_ASSERT_TRUE(nowcast.WasRebuilt());
+      TEST_ASSERT_EQUAL_FLOAT(nowcast.Concentration(), result.nowcast);
+    }
+  }
+  TEST_ASSERT_TRUE(wakes > 0);
+  // every sample stored, up to the capacity of the ring
+  flashSamples.Begin();
+  TEST_ASSERT_TRUE(flashSamples.NumberOfSamples() >=
+                   std::min(wakes, flashSamples.NominalCapacity()));
+  AirSampleData last;
+  TEST_ASSERT_TRUE(flashSamples.ReadSample(0, last));
+  TEST_ASSERT_EQUAL_MEMORY(&lastStored, &last, sizeof(last));
+
+  printf("Replay of %u wake ups (%s responses, %u KB), %.1f%% max error\n",
+         (unsigned)(wakes), recorded ? "recorded" : "synthesized",
+         (unsigned)(bytes / 1024), maxError * 100.0f);
+  timers.begin.Print();
+  timers.parse.Print();
+  timers.analysis.Print();
+  timers.store.Print();
+  timers.graph.Print();
+  timers.wake.Print();
+  printf("%.0f simulated days per second\n",
+         wakes / (timers.wake.Total() * 1e-6f) / (24 * 3600 / kWakePeriod));
+  printf("Graph and NowCast: at most %u flash reads per wake up\n",
+         (unsigned)(maxHistoryReads));
+
+  if (!recorded) {
+    // the failing sensor is only probed (once an hour)
+    size_t failingWakes = (kWakes - (kFailureStart - kReplayStart) /
+                                        kWakePeriod);
+    printf("Failing sensor requested at %u of %u wake ups\n",
+           (unsigned)(failingRequests), (unsigned)(failingWakes));
+    TEST_ASSERT_TRUE(failingRequests < failingWakes / kUnreliableProbeWakes +
+                                           kUnreliableProbeWakes);
+  }
+  // the durations depend on the host: the gate is on the flash reads, a few
+  // per incremental update (a rebuild of the 24h graph alone takes ~30)
+  TEST_ASSERT_TRUE(maxHistoryReads <= 16);
+}
+
+#endif
+
+#if defined(ARDUINO)
+#include <Arduino.h>
+void setup() {
+#else
+int main(int argc, char **argv) {
+#endif
+  UNITY_BEGIN();
+#if !defined(ARDUINO)
+  // the simulated flash and the clock are only on the host
+  RUN_TEST(TestReplay);
+#endif
+  UNITY_END();
+}
+
+#if defined(ARDUINO)
+void loop() {}
+#endif
@@ -0,0 +1,129 @@
+#include <time.h>
+
+#include "robust_stats.h"
+#include "unity.h"
+
+template <size_t N>
+bool sorts_all_binary_inputs() {
+  // 0-1 principle: a comparator network sorts everything if it sorts all
+  // the sequences of 0 and 1
+  for (uint32_t bits = 0; bits < (1u << N); bits++) {
+    int v[N];
+    for (size_t i = 0; i < N; i++) {
+      v[i] = (bits >> i) & 1;
+    }
+    SortingNetwork<N>::Sort(v);
+    for (size_t i = 1; i < N; i++) {
+      if (v[i - 1] > v[i]) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+void test_sorting_networks(void) {
+  TEST_ASSERT_TRUE(sorts_all_binary_inputs<2>());
+  TEST_ASSERT_TRUE(sorts_all_binary_inputs<3>());
+  TEST_ASSERT_TRUE(sorts_all_binary_inputs<4>());
+  TEST_ASSERT_TRUE(sorts_all_binary_inputs<5>());
+  TEST_ASSERT_TRUE(sorts_all_binary_inputs<6>());
+  TEST_ASSERT_TRUE(sorts_all_binary_inputs<7>());
+  TEST_ASSERT_TRUE(sorts_all_binary_inputs<8>());
+
+  // insertion sort above 8 values
+  float values[] = {5.0, 3.0, 9.0, 1.0, 7.0, 2.0, 8.0, 6.0, 4.0, 0.0};
+  sort_small(values, 10);
+  for (size_t i = 0; i < 10; i++) {
+    TEST_ASSERT_EQUAL_FLOAT((float)(i), values[i]);
+  }
+}
+
+void test_fusion_rejects_outlier(void) {
+  SensorFusion<8> fusion;
+  const float values[] = {12.0, 13.0, 11.5, 48.0, 12.5};
+  for (size_t i = 0; i < 5; i++) {
+    TEST_ASSERT_TRUE(fusion.Add(values[i]));
+  }
+  FusionResult result;
+  bool kept[5];
+  TEST_ASSERT_TRUE(fusion.Fuse(3.0, 1.0, result, kept));
+  TEST_ASSERT_EQUAL_FLOAT(12.5, result.median);
+  TEST_ASSERT_EQUAL_FLOAT(0.5, result.mad);
+  TEST_ASSERT_EQUAL(4, result.kept);
+  const bool expectedKept[] = {true, true, true, false, true};
+  for (size_t i = 0; i < 5; i++) {
+    TEST_ASSERT_EQUAL(expectedKept[i], kept[i]);
+  }
+  TEST_ASSERT_EQUAL_FLOAT(12.25, result.mean);
+  TEST_ASSERT_EQUAL_FLOAT(0.5, result.mae);
+
+  // without rejection, the outlier drags the mean
+  TEST_ASSERT_TRUE(fusion.Fuse(0.0, 0.0, result));
+  TEST_ASSERT_EQUAL(5, result.kept);
+  TEST_ASSERT_EQUAL_FLOAT(19.4, result.mean);
+}
+
+void test_fusion_weights(void) {
+  SensorFusion<8> fusion;
+  fusion.Add(10.0, 1.0);
+  fusion.Add(11.0, 1.0);
+  fusion.Add(13.0, 0.5);
+  FusionResult result;
+  TEST_ASSERT_TRUE(fusion.Fuse(3.0, 1.0, result));
+  TEST_ASSERT_EQUAL(3, result.kept);
+  TEST_ASSERT_EQUAL_FLOAT(27.5 / 2.5, result.mean);
+
+  // identical sensors: close values are kept thanks to minSigma
+  SensorFusion<8> same;
+  same.Add(20.0);
+  same.Add(20.0);
+  same.Add(20.0);
+  same.Add(21.0);
+  TEST_ASSERT_TRUE(same.Fuse(3.0, 1.0, result));
+  TEST_ASSERT_EQUAL_FLOAT(0.0, result.mad);
+  TEST_ASSERT_EQUAL(4, result.kept);
+
+  SensorFusion<2> empty;
+  TEST_ASSERT_FALSE(empty.Fuse(3.0, 1.0, result));
+  TEST_ASSERT_TRUE(empty.Add(1.0));
+  TEST_ASSERT_TRUE(empty.Add(2.0));
+  TEST_ASSERT_FALSE(empty.Add(3.0));
+}
+
+void test_benchmark_fusion(void) {
+  const int kLoops = 100000;
+  float sum = 0.0f;
+  clock_t start = clock();
+  for (int l = 0; l < kLoops; l++) {
+    SensorFusion<8> fusion;
+    for (int i = 0; i < 8; i++) {
+      fusion.Add(10.0f + (float)((l + i * 7) % 13), 1.0f);
+    }
+    FusionResult result;
+    fusion.Fuse(3.0f, 1.0f, result);
+    sum += result.mean;
+  }
+  float elapsed = (float)(clock() - start) / CLOCKS_PER_SEC;
+  printf("Fusion of 8 sensors: %.0f ns (mean %.2f)\n", elapsed / kLoops * 1e9f,
+         sum / kLoops);
+  TEST_ASSERT_TRUE(sum > 0.0f);
+}
+
+#if defined(ARDUINO)
+#include <Arduino.h>
+void setup() {
+#else
+int main(int argc, char **argv) {
+#endif
+  UNITY_BEGIN();
+  RUN_TEST(test_sorting_networks);
+  RUN_TEST(test_fusion_rejects_outlier);
+  RUN_TEST(test_fusion_weights);
+  RUN_TEST(test_benchmark_fusion);
+  UNITY_END();
+}
+
+#if defined(ARDUINO)
+void loop() {}
+#endif
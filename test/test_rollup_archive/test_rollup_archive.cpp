@@ -0,0 +1,151 @@
+#include "aaqim_debug.h"
+#include "counting_flash.h"
+#include "display_samples.h"
+#include "rollup_archive.h"
+#include "sample_encoding.h"
+#include "unity.h"
+
+#if defined(ARDUINO)
+EspFlash gSectors;
+#else
+#include "sim_flash.h"
+SimFlash gSectors;
+#endif
+
+CountingFlash gFlash(gSectors);
+
+const uint32_t kRawOffset = 0;
+const uint32_t kHourlyOffset = 8 * SPI_FLASH_SEC_SIZE;
+const uint32_t kDailyOffset = 12 * SPI_FLASH_SEC_SIZE;
+
+// midnight UTC
+const uint32_t kStartSeconds = k2019epoch + 400 * 24 * 3600;
+const uint32_t kSamplePeriod = 300;
+const uint32_t kSamplesPerDay = 24 * 3600 / kSamplePeriod;
+const uint32_t kDays = 3;
+
+typedef FlashSamples<AirSampleData, AirSampleTime> RawSamples;
+
+RawSamples gRawSamples(gFlash, 1024, kRawOffset);
+RollupFlashSamples gHourly(gFlash, 128, kHourlyOffset);
+RollupFlashSamples gDaily(gFlash, 16, kDailyOffset);
+
+float SampleValue(uint32_t i) { return 1.0f + (float)(i % 50) + (i / 97); }
+
+void StoreSample(RollupArchive<RawSamples> &archive, uint32_t i) {
+  AirSample sample(kStartSeconds + i * kSamplePeriod, 0.0f, SampleValue(i),
+                   0.0f, 1000.0f, 77, 33, 3, 0.5f);
+  AirSampleData data;
+  sample.ToData(data);
+  TEST_ASSERT_TRUE(archive.StoreSample(data));
+}
+
+void Setup(RollupArchive<RawSamples> &archive, bool erase) {
+  gRawSamples.Begin(erase);
+  gHourly.Begin(erase);
+  gDaily.Begin(erase);
+  TEST_ASSERT_TRUE(archive.AddTier(gHourly, 3600));
+  TEST_ASSERT_TRUE(archive.AddTier(gDaily, 24 * 3600));
+}
+
+void TestAddTier() {
+  RollupArchive<RawSamples> archive(gRawSamples);
+  TEST_ASSERT_TRUE(archive.AddTier(gHourly, 3600));
+  // not a multiple of the previous tier
+  TEST_ASSERT_FALSE(archive.AddTier(gDaily, 5400));
+  TEST_ASSERT_EQUAL(1, archive.TiersCount());
+}
+
+void TestRollupTiers() {
+  RollupArchive<RawSamples> archive(gRawSamples);
+  Setup(archive, true);
+
+  // the very first sample of the 4th day closes the 3rd one
+  for (uint32_t i = 0; i <= kDays * kSamplesPerDay; i++) {
+    StoreSample(archive, i);
+  }
+  TEST_ASSERT_EQUAL(kDays * kSamplesPerDay + 1, gRawSamples.NumberOfSamples());
+  TEST_ASSERT_EQUAL(kDays * 24, gHourly.NumberOfSamples());
+  TEST_ASSERT_EQUAL(kDays, gDaily.NumberOfSamples());
+
+  // check each day against the raw samples
+  for (uint32_t d = 0; d < kDays; d++) {
+    uint32_t sum = 0;
+    uint16_t minCode = UINT16_MAX;
+    uint16_t maxCode = 0;
+    for (uint32_t i = d * kSamplesPerDay; i < (d + 1) * kSamplesPerDay; i++) {
+      uint16_t code = cf_to_short(SampleValue(i));
+      sum += code;
+      minCode = (code < minCode) ? code : minCode;
+      maxCode = (code > maxCode) ? code : maxCode;
+    }
+    RollupData rollup;
+    TEST_ASSERT_TRUE(gDaily.ReadSample(kDays - 1 - d, rollup));
+    TEST_ASSERT_TRUE(rollup_is_valid(rollup));
+    TEST_ASSERT_EQUAL(kSamplesPerDay, rollup.count);
+    TEST_ASSERT_EQUAL(sum, rollup.pm_2_5_sum);
+    TEST_ASSERT_EQUAL(minCode, rollup.pm_2_5_min);
+    TEST_ASSERT_EQUAL(maxCode, rollup.pm_2_5_max);
+    // stamped with the most recent sample of the bucket
+    TEST_ASSERT_EQUAL(kStartSeconds + ((d + 1) * kSamplesPerDay - 1) *
+                                          kSamplePeriod,
+                      RollupTime::Seconds(rollup));
+  }
+
+  RollupData hour;
+  TEST_ASSERT_TRUE(gHourly.ReadSample(0, hour));
+  TEST_ASSERT_EQUAL(12, hour.count);
+}
+
+void TestRollupAfterRestart() {
+  // Same as waking up from deep sleep: rings are re-scanned
+  RollupArchive<RawSamples> archive(gRawSamples);
+  Setup(archive, false);
+  TEST_ASSERT_EQUAL(kDays * 24, gHourly.NumberOfSamples());
+
+  // complete the first hour of the 4th day
+  for (uint32_t i = kDays * kSamplesPerDay + 1;
+       i <= kDays * kSamplesPerDay + 12; i++) {
+    StoreSample(archive, i);
+  }
+  TEST_ASSERT_EQUAL(kDays * 24 + 1, gHourly.NumberOfSamples());
+  TEST_ASSERT_EQUAL(kDays, gDaily.NumberOfSamples());
+  RollupData hour;
+  TEST_ASSERT_TRUE(gHourly.ReadSample(0, hour));
+  TEST_ASSERT_EQUAL(12, hour.count);
+}
+
+void TestFillFromRollup() {
+  const uint32_t now = kStartSeconds + kDays * 24 * 3600 - 1;
+  DisplaySamples<kDays, int16_t> fromRaw(24 * 3600);
+  DisplaySamples<kDays, int16_t> fromDaily(24 * 3600);
+
+  gFlash.ResetCounters();
+  TEST_ASSERT_EQUAL(kDays, fromRaw.Fill(gRawSamples, now, pm25_to_aqi_value));
+  uint32_t rawReads = gFlash.Reads();
+
+  gFlash.ResetCounters();
+  TEST_ASSERT_EQUAL(kDays, fromDaily.Fill(gDaily, now, pm25_to_aqi_value));
+  uint32_t dailyReads = gFlash.Reads();
+
+  printf("Fill %d days: %d reads from raw, %d reads from daily rollup\n",
+         kDays, rawReads, dailyReads);
+  for (size_t i = 0; i < kDays; i++) {
+    TEST_ASSERT_INT_WITHIN(1, fromRaw.Value(i), fromDaily.Value(i));
+  }
+  TEST_ASSERT_TRUE(dailyReads * 4 < rawReads);
+}
+
+#if defined(ARDUINO)
+void loop() {}
+void setup() {
+#else
+int main() {
+#endif
+  UNITY_BEGIN();
+  RUN_TEST(TestAddTier);
+  RUN_TEST(TestRollupTiers);
+  RUN_TEST(TestRollupAfterRestart);
+  RUN_TEST(TestFillFromRollup);
+  UNITY_END();
+}
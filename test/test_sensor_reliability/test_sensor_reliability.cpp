@@ -0,0 +1,253 @@
+#include <string.h>
+
+#include "sensor_reliability.h"
+#include "unity.h"
+
+#if !defined(ARDUINO)
+
+#include "file_source.h"
+#include "memory_store.h"
+#include "sensors.h"
+#include "wake_up.h"
+
+// stands for the RTC memory across the wake ups
+MemoryStore gStore;
+
+const uint32_t kOutlierId = 65489;
+
+typedef SensorReliabilityTable<AirSensors::kCapacity> Reliability;
+
+/** A wake up of the monitor replayed on a recorded response: the scores are
+ * loaded, the sensors requested, the response parsed (the records of the
+ * skipped sensors are ignored, as if they were not requested), the sensors
+ * analyzed, and the scores saved.
+ * @return is the outlier requested? */
+static bool replay_wake(const char *path, SensorReliability &reliability) {
+  reliability.Load(gStore, 0);
+  AirSensors sensors;
+  RequestSensors(kSensorIds, sizeof(kSensorIds) / sizeof(size_t), reliability,
+                 sensors);
+  FileSource source(path);
+  TEST_ASSERT_TRUE(source.IsOpen());
+  sensors.ParseSensors(source);
+
+  AirSample sample;
+  GroupDiagnostics<AirSensors::kCapacity> diagnostics;
+  TEST_ASSERT_TRUE(
+      AnalyzeSensors(sensors, sample, diagnostics, nullptr, &reliability) > 0);
+  TEST_ASSERT_TRUE(reliability.Save(gStore, 0));
+  return !sensors.IsSkipped(kOutlierId);
+}
+
+void TestReplayOutlier() {
+  gStore.Clear();
+  Reliability reliability;
+  TEST_ASSERT_FALSE(reliability.Load(gStore, 0));
+
+  // the outlier is rejected at each wake up, and skipped once its average
+  // distance to the consensus is too large
+  int wakes = 0;
+  while (replay_wake("data/lowvalues_with_one_outlier.json", reliability)) {
+    wakes++;
+    TEST_ASSERT_TRUE(wakes < kUnreliableRejections);
+  }
+  TEST_ASSERT_TRUE(wakes > 1);
+  const SensorScore *score = reliability.Score(kOutlierId);
+  TEST_ASSERT_NOT_NULL(score);
+  TEST_ASSERT_EQUAL(wakes, score->rejections);
+  TEST_ASSERT_EQUAL(0, score->lastGood);
+  TEST_ASSERT_TRUE(score->error > kUnreliableScore);
+  TEST_ASSERT_FALSE(reliability.IsReliable(*score));
+  const SensorScore *good = reliability.Score(kSensorIds[0]);
+  TEST_ASSERT_EQUAL(0, good->rejections);
+  TEST_ASSERT_EQUAL(1600740796, good->lastGood);
+  TEST_ASSERT_TRUE(good->error < kUnreliableScore / 10);
+
+  // probed once every kUnreliableProbeWakes wake ups
+  for (uint8_t wake = 2; wake < kUnreliableProbeWakes; wake++) {
+    TEST_ASSERT_FALSE(
+        replay_wake("data/lowvalues_with_one_outlier.json", reliability));
+  }
+  score = reliability.Score(kOutlierId);
+  TEST_ASSERT_EQUAL(wakes, score->rejections);
+  TEST_ASSERT_EQUAL(kUnreliableProbeWakes - 1, score->skipped);
+  TEST_ASSERT_TRUE(
+      replay_wake("data/lowvalues_with_one_outlier.json", reliability));
+  TEST_ASSERT_EQUAL(wakes + 1, reliability.Score(kOutlierId)->rejections);
+
+  // reliable again as soon as it is kept at a probe
+  int wake = 0;
+  while (!replay_wake("data/sensor_group.json", reliability)) {
+    wake++;
+    TEST_ASSERT_TRUE(wake < kUnreliableProbeWakes);
+  }
+  score = reliability.Score(kOutlierId);
+  TEST_ASSERT_TRUE(reliability.IsReliable(*score));
+  TEST_ASSERT_EQUAL(0, score->rejections);
+  TEST_ASSERT_EQUAL(1600617076, score->lastGood);
+  TEST_ASSERT_TRUE(replay_wake("data/sensor_group.json", reliability));
+}
+
+void TestHighConcentration() {
+  // A smoke episode: healthy sensors 5 to 10% apart, and one reading 50%
+  // above the others
+  const float offsets[] = {-0.08f, -0.05f, -0.03f, 0.0f,
+                           0.02f,  0.05f,  0.09f,  0.5f};
+  const size_t count = sizeof(offsets) / sizeof(offsets[0]);
+  const size_t outlier = count - 1;
+  AgeFilter ageFilter;
+  ConsistencyFilter consistencyFilter;
+  SensorAnalysis analysis;
+  analysis.AddFilter(ageFilter);
+  analysis.AddFilter(consistencyFilter);
+  Reliability reliability;
+
+  bool skipped = false;
+  for (size_t wake = 0; wake < 3 * kUnreliableProbeWakes; wake++) {
+    const float level = 200.0f + 100.0f * (wake % 7) / 6;
+    SensorData data[count];
+    uint32_t ids[count];
+    memset(data, 0, sizeof(data));
+    for (size_t i = 0; i < count; i++) {
+      ids[i] = i + 1;
+      if (!reliability.ShouldRequest(ids[i])) {
+        // not in the response
+        TEST_ASSERT_EQUAL(outlier, i);
+        skipped = true;
+        continue;
+      }
+      float value = level * (1.0f + offsets[i]);
+      data[i].id = ids[i];
+      data[i].timestamp = 1600000000 + wake * 300;
+      data[i].pm_2_5_A = value;
+      data[i].pm_2_5_B = value;
+      data[i].averages[static_cast<int>(PmAvgIndexes::TenMinutes)] = value;
+    }
+    AirSample sample;
+    GroupDiagnostics<count> diagnostics;
+    TEST_ASSERT_EQUAL(count - 1,
+                      analysis.Analyze(data, count, sample, diagnostics));
+    reliability.Update(ids, data, count, diagnostics, sample.Seconds());
+  }
+  for (size_t i = 0; i < outlier; i++) {
+    const SensorScore *score = reliability.Score(i + 1);
+    TEST_ASSERT_TRUE(reliability.IsReliable(*score));
+    TEST_ASSERT_TRUE(score->error < kUnreliableScore);
+  }
+  TEST_ASSERT_TRUE(skipped);
+  TEST_ASSERT_FALSE(reliability.IsReliable(*reliability.Score(outlier + 1)));
+}
+
+void TestAllSkipped() {
+  // every sensor rejected 6 times in a row
+  const size_t ids[] = {1, 2, 3};
+  const size_t count = sizeof(ids) / sizeof(ids[0]);
+  Reliability reliability;
+  SensorData data[count];
+  uint32_t dataIds[count];
+  GroupDiagnostics<count> diagnostics;
+  memset(data, 0, sizeof(data));
+  diagnostics.sensorsCount = count;
+  for (size_t i = 0; i < count; i++) {
+    dataIds[i] = ids[i];
+    data[i].timestamp = 1000;
+    diagnostics.rejections[i] = Rejection::Consistency;
+  }
+  for (uint8_t wake = 0; wake < kUnreliableRejections; wake++) {
+    AirSensors sensors;
+    RequestSensors(ids, count, reliability, sensors);
+    TEST_ASSERT_EQUAL(count, sensors.RequestedCount());
+    reliability.Update(dataIds, data, count, diagnostics, 1000);
+  }
+
+  // they are all requested anyway, and scored from this response
+  AirSensors sensors;
+  RequestSensors(ids, count, reliability, sensors);
+  TEST_ASSERT_EQUAL(0, sensors.RequestedCount());
+  for (size_t i = 0; i < count; i++) {
+    TEST_ASSERT_FALSE(sensors.IsSkipped(ids[i]));
+    diagnostics.rejections[i] = Rejection::None;
+  }
+  diagnostics.keptCount = count;
+  reliability.Update(dataIds, data, count, diagnostics, 2000);
+  for (size_t i = 0; i < count; i++) {
+    const SensorScore *score = reliability.Score(ids[i]);
+    TEST_ASSERT_EQUAL(0, score->skipped);
+    TEST_ASSERT_EQUAL(0, score->rejections);
+    TEST_ASSERT_EQUAL(2000, score->lastGood);
+  }
+}
+
+void TestStateAndTable() {
+  gStore.Clear();
+  Reliability reliability;
+  TEST_ASSERT_EQUAL(kMaxSensors, reliability.Capacity());
+  for (uint32_t id = 1; id <= kMaxSensors; id++) {
+    TEST_ASSERT_TRUE(reliability.ShouldRequest(id));
+  }
+  TEST_ASSERT_EQUAL(kMaxSensors, reliability.Count());
+  TEST_ASSERT_TRUE(reliability.Save(gStore, 0));
+  TEST_ASSERT_TRUE(Reliability::StateSize() <= 100);
+
+  Reliability loaded;
+  TEST_ASSERT_TRUE(loaded.Load(gStore, 0));
+  TEST_ASSERT_EQUAL(kMaxSensors, loaded.Count());
+  TEST_ASSERT_NOT_NULL(loaded.Score(kMaxSensors));
+
+  // the least recently kept sensor is replaced by a new one
+  SensorData data[kMaxSensors];
+  memset(data, 0, sizeof(data));
+  uint32_t ids[kMaxSensors];
+  GroupDiagnostics<kMaxSensors> diagnostics;
+  diagnostics.sensorsCount = kMaxSensors;
+  for (size_t i = 0; i < kMaxSensors; i++) {
+    ids[i] = i + 1;
+    data[i].timestamp = 1000;
+  }
+  diagnostics.rejections[2] = Rejection::Age;
+  loaded.Update(ids, data, kMaxSensors, diagnostics, 1000);
+  TEST_ASSERT_TRUE(loaded.ShouldRequest(100));
+  TEST_ASSERT_NULL(loaded.Score(3));
+  TEST_ASSERT_EQUAL(kMaxSensors, loaded.Count());
+
+  // a larger table keeps all the sensors of a larger group
+  SensorReliabilityTable<2 * kMaxSensors> large;
+  for (uint32_t id = 1; id <= 2 * kMaxSensors; id++) {
+    TEST_ASSERT_TRUE(large.ShouldRequest(id));
+  }
+  TEST_ASSERT_EQUAL(2 * kMaxSensors, large.Count());
+  TEST_ASSERT_NOT_NULL(large.Score(1));
+  TEST_ASSERT_TRUE(large.Save(gStore, 128));
+  TEST_ASSERT_TRUE(loaded.Load(gStore, 0));
+  TEST_ASSERT_FALSE(loaded.Load(gStore, 128));
+
+  // corrupted state
+  uint32_t word = 0xFFFFFFFF;
+  TEST_ASSERT_TRUE(gStore.Write(4, &word, sizeof(word)));
+  TEST_ASSERT_FALSE(loaded.Load(gStore, 0));
+  TEST_ASSERT_EQUAL(0, loaded.Count());
+  gStore.Clear();
+}
+
+#endif
+
+#if defined(ARDUINO)
+#include <Arduino.h>
+void setup() {
+#else
+int main(int argc, char **argv) {
+#endif
+  UNITY_BEGIN();
+#if !defined(ARDUINO)
+  // the recorded responses are only available on the host
+  RUN_TEST(TestReplayOutlier);
+  RUN_TEST(TestHighConcentration);
+  RUN_TEST(TestAllSkipped);
+  RUN_TEST(TestStateAndTable);
+#endif
+  UNITY_END();
+}
+
+#if defined(ARDUINO)
+void loop() {}
+#endif
@@ -0,0 +1,226 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "analysis.h"
+#include "sensors_grid.h"
+#include "unity.h"
+
+#if !defined(ARDUINO)
+
+#include "file_source.h"
+#include "sites_parser.h"
+
+const size_t kSyntheticSites = 5000;
+typedef SensorsGrid<kSyntheticSites> LargeGrid;
+
+SimFlash gFlash;
+SensorSite gSites[kSyntheticSites];
+LargeGrid gGrid;
+LargeGrid gLoaded;
+
+/** Pseudo random sites over ~1 degree around the San Francisco bay */
+static void make_sites(SensorSite sites[], size_t count) {
+  srand(42);
+  for (size_t i = 0; i < count; i++) {
+    sites[i].id = 1000 + i;
+    sites[i].latitude = 37.0f + (float)(rand()) / RAND_MAX;
+    sites[i].longitude = -122.5f + (float)(rand()) / RAND_MAX;
+  }
+}
+
+/** Reference: distance to all the sites, and sort */
+static size_t brute_force(const SensorSite sites[], size_t count,
+                          float latitude, float longitude, float radius,
+                          size_t k, Neighbor neighbors[]) {
+  size_t found = 0;
+  for (size_t i = 0; i < count; i++) {
+    float distance = site_distance(latitude, longitude, sites[i].latitude,
+                                   sites[i].longitude);
+    if (distance > radius ||
+        (found == k && distance >= neighbors[k - 1].distance)) {
+      continue;
+    }
+    size_t position = (found < k) ? found++ : k - 1;
+    while (position > 0 && neighbors[position - 1].distance > distance) {
+      neighbors[position] = neighbors[position - 1];
+      position--;
+    }
+    neighbors[position].id = sites[i].id;
+    neighbors[position].distance = distance;
+  }
+  return found;
+}
+
+void TestSensorGroupSites() {
+  SensorSite sites[kMaxSensors];
+  SitesParser parser(sites, kMaxSensors);
+  FileSource source("data/sensor_group.json");
+  TEST_ASSERT_TRUE(source.IsOpen());
+  char buffer[256];
+  size_t size;
+  while ((size = source.Read(buffer, sizeof(buffer))) > 0) {
+    TEST_ASSERT_TRUE(parser.Feed(buffer, size));
+  }
+  TEST_ASSERT_TRUE(parser.IsComplete());
+  // the 8 sensors are outside, their channel B is skipped
+  TEST_ASSERT_EQUAL(8, parser.Count());
+  TEST_ASSERT_EQUAL(59927, sites[0].id);
+  TEST_ASSERT_EQUAL_FLOAT(37.503163f, sites[0].latitude);
+  TEST_ASSERT_EQUAL_FLOAT(-122.310045f, sites[0].longitude);
+
+  SensorsGrid<kMaxSensors, 4> grid;
+  TEST_ASSERT_FALSE(grid.IsValid());
+  grid.Build(sites, parser.Count());
+  TEST_ASSERT_TRUE(grid.IsValid());
+
+  // around the first sensor
+  Neighbor neighbors[3];
+  TEST_ASSERT_EQUAL(
+      3, grid.Nearest(37.503163f, -122.310045f, 2000.0f, 3, neighbors));
+  TEST_ASSERT_EQUAL(59927, neighbors[0].id);
+  TEST_ASSERT_FLOAT_WITHIN(0.1f, 0.0f, neighbors[0].distance);
+  TEST_ASSERT_EQUAL(65489, neighbors[1].id);
+  TEST_ASSERT_FLOAT_WITHIN(5.0f, 271.0f, neighbors[1].distance);
+  TEST_ASSERT_EQUAL(66029, neighbors[2].id);
+  TEST_ASSERT_FLOAT_WITHIN(5.0f, 373.0f, neighbors[2].distance);
+
+  // only the two closest within 300m
+  TEST_ASSERT_EQUAL(
+      2, grid.Nearest(37.503163f, -122.310045f, 300.0f, 3, neighbors));
+  // nothing in the middle of the bay
+  TEST_ASSERT_EQUAL(0, grid.Nearest(37.6f, -122.2f, 2000.0f, 3, neighbors));
+}
+
+void TestNearestMatchesBruteForce() {
+  make_sites(gSites, kSyntheticSites);
+  gGrid.Build(gSites, kSyntheticSites);
+  TEST_ASSERT_EQUAL(kSyntheticSites, gGrid.Count());
+
+  const size_t kK = 8;
+  const float kRadius = 5000.0f;
+  Neighbor expected[kK];
+  Neighbor neighbors[kK];
+  srand(7);
+  for (int q = 0; q < 200; q++) {
+    // including queries outside of the bounding box
+    float latitude = 36.95f + 1.1f * (float)(rand()) / RAND_MAX;
+    float longitude = -122.55f + 1.1f * (float)(rand()) / RAND_MAX;
+    size_t count = brute_force(gSites, kSyntheticSites, latitude, longitude,
+                               kRadius, kK, expected);
+    TEST_ASSERT_EQUAL(count, gGrid.Nearest(latitude, longitude, kRadius, kK,
+                                           neighbors));
+    for (size_t i = 0; i < count; i++) {
+      TEST_ASSERT_EQUAL_FLOAT(expected[i].distance, neighbors[i].distance);
+    }
+  }
+
+  const int kLoops = 20000;
+  size_t found = 0;
+  size_t examined = 0;
+  clock_t start = clock();
+  for (int l = 0; l < kLoops; l++) {
+    float step = 0.8f * l / kLoops;
+    found += gGrid.Nearest(37.1f + step, -122.4f + step, kRadius, kK,
+                           neighbors, &examined);
+  }
+  float elapsed = (float)(clock() - start) / CLOCKS_PER_SEC;
+  printf("%d nearest of %d sites within %.0fm: %.1f us, %.0f sites examined"
+         " (%.1f neighbors)\n",
+         (int)(kK), (int)(kSyntheticSites), kRadius, elapsed / kLoops * 1e6f,
+         (float)(examined) / kLoops, (float)(found) / kLoops);
+  TEST_ASSERT_EQUAL(kLoops * kK, found);
+  // only the cells around the radius are visited: a few percent of the sites
+  // (~100 distances, far below a millisecond even on the board)
+  TEST_ASSERT_TRUE(examined / kLoops < kSyntheticSites / 25);
+}
+
+void TestSaveLoad() {
+  make_sites(gSites, kSyntheticSites);
+  gGrid.Build(gSites, kSyntheticSites);
+
+  // aligned on a sector only
+  TEST_ASSERT_FALSE(gGrid.Save(gFlash, FS_PHYS_ADDR + 16));
+  TEST_ASSERT_FALSE(gLoaded.Load(gFlash, FS_PHYS_ADDR));
+  TEST_ASSERT_TRUE(gGrid.Save(gFlash, FS_PHYS_ADDR));
+  TEST_ASSERT_TRUE(gLoaded.Load(gFlash, FS_PHYS_ADDR));
+  TEST_ASSERT_EQUAL(kSyntheticSites, gLoaded.Count());
+
+  Neighbor expected[4];
+  Neighbor neighbors[4];
+  TEST_ASSERT_EQUAL(4, gGrid.Nearest(37.5f, -122.0f, 5000.0f, 4, expected));
+  TEST_ASSERT_EQUAL(4, gLoaded.Nearest(37.5f, -122.0f, 5000.0f, 4, neighbors));
+  TEST_ASSERT_EQUAL_MEMORY(expected, neighbors, sizeof(neighbors));
+
+  // saved again over the previous index
+  gGrid.Build(gSites, 10);
+  TEST_ASSERT_TRUE(gGrid.Save(gFlash, FS_PHYS_ADDR));
+  TEST_ASSERT_TRUE(gLoaded.Load(gFlash, FS_PHYS_ADDR));
+  TEST_ASSERT_EQUAL(10, gLoaded.Count());
+}
+
+void TestDistanceFilter() {
+  const Neighbor neighbors[] = {{1, 100.0f}, {2, 1000.0f}, {3, 2000.0f}};
+  DistanceFilter filter(neighbors, 3);
+  SensorData data;
+  memset(&data, 0, sizeof(data));
+
+  float weight = 1.0f;
+  data.id = 1;
+  TEST_ASSERT_EQUAL(Rejection::None, filter.Check(data, weight));
+  TEST_ASSERT_EQUAL_FLOAT(1.0f, weight);
+  data.id = 2;
+  TEST_ASSERT_EQUAL(Rejection::None, filter.Check(data, weight));
+  TEST_ASSERT_EQUAL_FLOAT(0.25f, weight);
+  weight = 1.0f;
+  data.id = 3;
+  TEST_ASSERT_EQUAL(Rejection::None, filter.Check(data, weight));
+  TEST_ASSERT_EQUAL_FLOAT(0.0625f, weight);
+  // not a neighbor
+  data.id = 4;
+  TEST_ASSERT_EQUAL(Rejection::Distance, filter.Check(data, weight));
+
+  // in the fusion: the closest sensor dominates
+  SensorData sensors[3];
+  memset(sensors, 0, sizeof(sensors));
+  const float values[] = {10.0f, 20.0f, 40.0f};
+  for (size_t i = 0; i < 3; i++) {
+    sensors[i].id = 1 + i * 2;  // 1, 3 and 5
+    sensors[i].pm_2_5_A = sensors[i].pm_2_5_B = values[i];
+    for (short a = 0; a < PmAvgSize; a++) {
+      sensors[i].averages[a] = values[i];
+    }
+  }
+  SensorAnalysis analysis;
+  analysis.SetOutlierRejection(0.0f);
+  analysis.AddFilter(filter);
+  AirSample sample;
+  GroupDiagnostics<3> diagnostics;
+  TEST_ASSERT_EQUAL(2, analysis.Analyze(sensors, 3, sample, diagnostics));
+  TEST_ASSERT_EQUAL(Rejection::Distance, diagnostics.rejections[2]);
+  TEST_ASSERT_FLOAT_WITHIN(0.001, (10.0f + 20.0f * 0.0625f) / 1.0625f,
+                           diagnostics.fusion.mean);
+}
+
+#endif
+
+#if defined(ARDUINO)
+#include <Arduino.h>
+void setup() {
+#else
+int main(int argc, char **argv) {
+#endif
+  UNITY_BEGIN();
+#if !defined(ARDUINO)
+  // the recorded responses and the simulated flash are only on the host
+  RUN_TEST(TestSensorGroupSites);
+  RUN_TEST(TestNearestMatchesBruteForce);
+  RUN_TEST(TestSaveLoad);
+  RUN_TEST(TestDistanceFilter);
+#endif
+  UNITY_END();
+}
+
+#if defined(ARDUINO)
+void loop() {}
+#endif
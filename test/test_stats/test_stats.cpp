@@ -32,6 +32,72 @@ void test_avg_int_10(void) {
     TEST_ASSERT_EQUAL_FLOAT(0.2857143, nmae);
 }
 
+void test_avg_zero_sum(void) {
+    const float data[] = {0.0, 0.0, 0.0};
+    float mae;
+    float nmae;
+    float avg = mean_error(3, data, mae, nmae);
+    TEST_ASSERT_EQUAL_FLOAT(0.0, avg);
+    TEST_ASSERT_EQUAL_FLOAT(0.0, mae);
+    TEST_ASSERT_EQUAL_FLOAT(0.0, nmae);
+}
+
+void test_accumulator(void) {
+    const float data[] = {1.0, 2.0, 3.0, 3.0, 3.0, 4.0, 5.0 };
+    StatsAccumulator<float> stats;
+    TEST_ASSERT_TRUE(stats.IsEmpty());
+    TEST_ASSERT_EQUAL_FLOAT(0.0, stats.Nmae());
+    for (size_t i = 0; i < 7; i++) {
+        stats.Add(data[i]);
+    }
+    TEST_ASSERT_EQUAL(7, stats.Count());
+    TEST_ASSERT_EQUAL_FLOAT(3.0, stats.Mean());
+    TEST_ASSERT_EQUAL_FLOAT(1.0, stats.Min());
+    TEST_ASSERT_EQUAL_FLOAT(5.0, stats.Max());
+    TEST_ASSERT_EQUAL_FLOAT(10.0/7.0, stats.Variance());
+    // one pass estimate of 6/7
+    TEST_ASSERT_FLOAT_WITHIN(0.05, 6.0/7.0, stats.Mae());
+    TEST_ASSERT_FLOAT_WITHIN(0.02, 0.2857143, stats.Nmae());
+
+    StatsAccumulator<int> constant;
+    for (size_t i = 0; i < 5; i++) {
+        constant.Add(42);
+    }
+    TEST_ASSERT_EQUAL_INT(42, constant.Mean());
+    TEST_ASSERT_EQUAL_INT(0, constant.Mae());
+    TEST_ASSERT_EQUAL_FLOAT(0.0, constant.Variance());
+}
+
+void test_accumulator_merge(void) {
+    StatsAccumulator<float> all;
+    StatsAccumulator<float> parts[3];
+    for (int i = 0; i < 300; i++) {
+        float value = (float)((i * 37) % 101) / 4.0f;
+        all.Add(value);
+        parts[i % 3].Add(value);
+    }
+    StatsAccumulator<float> merged;
+    for (int p = 0; p < 3; p++) {
+        merged.Merge(parts[p]);
+    }
+    TEST_ASSERT_EQUAL(all.Count(), merged.Count());
+    TEST_ASSERT_FLOAT_WITHIN(1e-3, all.Mean(), merged.Mean());
+    TEST_ASSERT_FLOAT_WITHIN(1e-2, all.Variance(), merged.Variance());
+    TEST_ASSERT_EQUAL_FLOAT(all.Min(), merged.Min());
+    TEST_ASSERT_EQUAL_FLOAT(all.Max(), merged.Max());
+    TEST_ASSERT_FLOAT_WITHIN(0.05 * all.Mae(), all.Mae(), merged.Mae());
+
+    // aggregated values (unknown spread) only move the mean
+    StatsAccumulator<float> aggregate;
+    aggregate.AddAggregate(10, 2.0, 1.0, 3.0);
+    aggregate.AddAggregate(10, 4.0, 3.0, 5.0);
+    TEST_ASSERT_EQUAL(20, aggregate.Count());
+    TEST_ASSERT_EQUAL_FLOAT(3.0, aggregate.Mean());
+    TEST_ASSERT_EQUAL_FLOAT(1.0, aggregate.Variance());
+    TEST_ASSERT_EQUAL_FLOAT(1.0, aggregate.Min());
+    TEST_ASSERT_EQUAL_FLOAT(5.0, aggregate.Max());
+}
+
 #if defined(ARDUINO)
 #include <Arduino.h>
 void setup() {
@@ -42,6 +108,9 @@ int main(int argc, char **argv) {
   RUN_TEST(test_avg_float_1);
   RUN_TEST(test_avg_float_100);
   RUN_TEST(test_avg_int_10);
+  RUN_TEST(test_avg_zero_sum);
+  RUN_TEST(test_accumulator);
+  RUN_TEST(test_accumulator_merge);
   UNITY_END();
 }
 